@@ -1,10 +1,14 @@
 #ifndef ASM_H
 #define ASM_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
 
+// Part of every cache key; bump when the generated images change
+#define ASM_VERSION "beag-asm 1.4"
+
 // Token types for the assembler
 typedef enum {
     // Basic tokens
@@ -27,6 +31,16 @@ typedef enum {
     TOKEN_WORD_DIRECTIVE,  // .word directive
     TOKEN_ASCII_DIRECTIVE, // .ascii directive
     TOKEN_ASCIZ_DIRECTIVE, // .asciz directive
+    TOKEN_GLOBAL_DIRECTIVE, // .global directive
+
+    // Preprocessor directives, expanded before parsing (see preprocess.c)
+    TOKEN_INCLUDE_DIRECTIVE, // .include "file"
+    TOKEN_MACRO_DIRECTIVE, // .macro name [param, ...]
+    TOKEN_ENDM_DIRECTIVE,  // .endm
+    TOKEN_REPT_DIRECTIVE,  // .rept count
+    TOKEN_IRP_DIRECTIVE,   // .irp param, value, ...
+    TOKEN_ENDR_DIRECTIVE,  // .endr
+    TOKEN_MACRO_PARAM,     // \param inside a macro or .irp body
     
     // Literals
     TOKEN_STRING_LITERAL,  // String literal in quotes
@@ -53,27 +67,65 @@ typedef enum {
     INST_WORD,   // Word directive
     INST_ASCII,  // ASCII directive
     INST_ASCIZ,  // ASCIZ directive (null-terminated)
-    INST_EOP     // End of program marker
+    INST_EOP,    // End of program marker
+    INST_LABEL,  // Label definition (IR only, emits no word)
+
+    // Pseudo-instructions whose expansion depends on label addresses. They
+    // stay in the IR and the code generator sizes them (see codegen.c).
+    INST_LA,     // la rd, label
+    INST_J,      // j label
+    INST_CALL,   // call label
+
+    // Pseudo-instructions the parser rewrites to real instructions
+    INST_LI,     // li rd, value (or label, as la)
+    INST_MOV,    // mov rd, rs
+    INST_RET,    // ret
+    INST_NOP     // nop
 } InstructionType;
 
-// Token structure for the assembler
+// Registers with a role in pseudo-instruction expansions: call saves the
+// return address in the link register, and j, call and relaxed branches
+// load far targets into the temporary
+#define REG_LINK 7
+#define REG_TEMP 6
+
+// Token structure for the assembler. Tokens are slices of the source
+// buffer: the text is never copied, only its offset and length recorded.
+// The file is an index into the assembler's file table, so tokens of
+// included files and macro expansions still lead back to their text.
 typedef struct {
-    TokenType type;        // Type of token
+    uint8_t type;          // TokenType
+    uint8_t reserved;
+    uint16_t file;         // Source file the text lives in
+    uint32_t offset;       // Byte offset of the token text in the source
+    uint32_t length;       // Length of the token text in bytes
     union {
-        char* str;         // For labels, label references, and string literals
         uint8_t reg_num;   // For registers (0-7)
         int16_t immediate; // For immediate values
         InstructionType inst_type; // For instructions and directives
+        int symbol_id;     // For labels and label references
     } value;
     int line;             // Line number where token was found
-    int column;           // Column number where token was found
 } Token;
 
+// Growable token arena produced by the lexer
+typedef struct {
+    Token* tokens;        // Tokens, terminated by a TOKEN_EOF token
+    size_t count;         // Number of tokens, excluding the EOF token
+    size_t capacity;      // Allocated slots in tokens
+    const char* source;   // Buffer the token slices point into
+    uint16_t file;        // File the tokens were lexed from
+    bool preprocess;      // Contains preprocessor directives
+} TokenList;
+
 // Operand types
 typedef enum {
     OP_REGISTER,
     OP_IMMEDIATE,
-    OP_LABEL
+    OP_LABEL,
+    OP_LABEL_HI,        // %hi(label)
+    OP_LABEL_LO,        // %lo(label)
+    OP_NONE             // No operand (IR immediate column unused)
 } OperandType;
 
 // Operand structure
@@ -82,7 +134,7 @@ typedef struct {
     union {
         uint8_t reg_num;    // 3-bit register number (0-7)
         int immediate;      // 16-bit (or more) immediate for .word
-        char* label;        // Label name for branch targets
+        int symbol_id;      // Interned label for branch targets
     } value;
 } Operand;
 
@@ -91,29 +143,590 @@ typedef struct {
     InstructionType type;
     Operand operands[3];    // Max 3 operands per instruction
     int operand_count;
+    int file;
     int line;
 } Instruction;
 
+// Source file contents. The data is either a read-only mapping of the file
+// or a heap buffer filled in chunks; it is not NUL-terminated.
+typedef struct {
+    const char* data;
+    size_t length;
+    void* mapping;     // mmap'd view, or NULL
+    char* buffer;      // Heap buffer for non-mappable inputs, or NULL
+} SourceFile;
+
+// Instruction encoding formats (see isa.c). Each operand, in assembly
+// order, is placed in the word as (value & mask) << shift.
+typedef enum {
+    ISA_NONE,               // Unused operand slot
+    ISA_REG,                // Register number
+    ISA_IMM,                // Immediate value
+    ISA_OFF                 // PC-relative branch offset
+} IsaOperandKind;
+
+typedef struct {
+    uint8_t kind;           // IsaOperandKind
+    uint8_t shift;
+    uint16_t mask;
+} IsaField;
+
+typedef struct {
+    const char* mnemonic;   // NULL for types that are not encoded
+    uint16_t opcode_bits;   // Opcode already shifted into [15:12]
+    uint8_t operand_count;
+    IsaField operands[3];
+} IsaFormat;
+
+extern const IsaFormat isa_formats[INST_EOP];
+
+// Program IR, stored column-wise. Each entry is one emitted word, a label
+// definition (INST_LABEL, symbol ID in imm), or a pseudo-instruction or
+// branch to a label that the code generator expands to one to five words.
+// An entry costs 8 bytes: the register operands are packed 4 bits apiece
+// in operand order, and the at most one immediate or label operand lives
+// in the imm column with its OperandType in kind. Line numbers are kept in
+// a side table that only records where the line changes; it is consulted
+// for diagnostics.
+typedef struct {
+    uint32_t index;         // First IR entry on this line
+    uint32_t file;
+    int line;
+} LineEntry;
+
+typedef struct {
+    uint8_t* op;            // InstructionType
+    uint8_t* kind;          // OperandType of the imm column
+    uint16_t* regs;         // Register operands, 4 bits each
+    int32_t* imm;           // Immediate value or symbol ID
+    size_t count;
+    size_t capacity;
+    LineEntry* lines;
+    size_t line_count;
+    size_t line_capacity;
+    size_t pseudo_count;    // Entries from INST_LA on
+} Program;
+
+#define IR_REG(regs, i) (((regs) >> (4 * (i))) & 0xF)
+
 // Symbol table entry
 typedef struct {
-    char* name;
+    const char* name;       // Interned, NUL-terminated name
+    uint32_t length;        // Name length in bytes
+    uint32_t hash;          // Precomputed name hash
     uint16_t value;
     bool is_defined;
+    bool is_global;         // Exported by .global
 } SymbolEntry;
 
+// Interned symbol names are packed into large chunks, each stored once and
+// released in bulk by symbol_table_free().
+typedef struct NameChunk {
+    struct NameChunk* next;
+    size_t used;
+    size_t size;
+    char data[];
+} NameChunk;
+
+// Open-addressing index slot. The hash is kept next to the entry ID so
+// probing rarely has to touch the entries themselves.
+typedef struct {
+    uint32_t hash;
+    uint32_t id;           // Entry index + 1; 0 marks an empty slot
+} SymbolSlot;
+
+typedef struct {
+    SymbolEntry* entries;  // Dense entry array indexed by symbol ID
+    int count;
+    int capacity;
+    SymbolSlot* slots;     // Hash index into entries
+    uint32_t slot_mask;    // Slot count - 1
+    NameChunk* names;      // Name pool; the head chunk is being filled
+    uint64_t lookups;
+    uint64_t probes;       // Occupied slots inspected
+    uint64_t collisions;   // Probes that hit a different symbol
+} SymbolTable;
+
+// Kinds of symbol references: patched by the code generator, or by the
+// linker through relocations of the same kind
+typedef enum {
+    FIXUP_BRANCH8,  // imm8 [7:0] = target - address
+    FIXUP_HI8,      // imm8 [7:0] = target >> 8
+    FIXUP_LO8,      // imm8 [7:0] = target & 0xFF
+    FIXUP_WORD16    // whole word = target
+} FixupKind;
+
+// Relocatable object file (see object.c). The file is the header followed
+// by the section, symbol and relocation tables, the string table and the
+// section contents, all little-endian and 4-byte aligned. In memory an
+// object is one buffer with the tables pointing into it, so an object is
+// written and read without conversion.
+#define OBJ_MAGIC 0x314F4742u  // "BGO1"
+#define OBJ_VERSION 1
+
+typedef enum {
+    OBJ_LOCAL,
+    OBJ_GLOBAL
+} ObjBinding;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t section_count;
+    uint32_t symbol_count;
+    uint32_t reloc_count;
+    uint32_t string_size;   // Padded to a multiple of 4
+    uint32_t word_count;    // Total over all sections
+} ObjHeader;
+
+typedef struct {
+    uint32_t name;          // String table offset
+    uint32_t size;          // Words; contents follow the previous section's
+} ObjSection;
+
+typedef struct {
+    uint32_t name;
+    int16_t section;        // -1 if undefined in this object
+    uint16_t value;         // Offset within the section
+    uint8_t binding;        // ObjBinding
+    uint8_t reserved[3];
+} ObjSymbol;
+
+typedef struct {
+    uint16_t section;
+    uint16_t offset;        // Word within the section
+    uint32_t symbol;
+    uint8_t kind;           // FixupKind
+    uint8_t reserved[3];
+} ObjReloc;
+
+typedef struct {
+    ObjHeader* header;
+    ObjSection* sections;
+    ObjSymbol* symbols;
+    ObjReloc* relocs;
+    char* strings;
+    uint16_t* words;
+    void* data;             // The whole file
+    size_t size;
+} ObjectFile;
+
+// A source file of an assembly: the main input (file 0) or an include.
+// Each include is mapped and lexed once, however often it is included.
+typedef struct {
+    char* name;             // As opened; NULL for an unnamed main input
+    SourceFile source;      // The main input borrows the caller's text
+    TokenList* tokens;      // Includes only
+} AsmFile;
+
+// Trace categories and levels (see trace.c). A category traces messages at
+// or below its configured level. Building with -DBEAG_NO_TRACE turns every
+// TRACE() into dead code; otherwise a disabled trace costs one byte load.
+typedef enum {
+    TRACE_LEXER,
+    TRACE_PARSER,
+    TRACE_SYMBOLS,
+    TRACE_CODEGEN,
+    TRACE_CATEGORY_COUNT
+} TraceCategory;
+
+typedef enum {
+    TRACE_OFF,
+    TRACE_INFO,     // Per-phase summaries
+    TRACE_DEBUG,    // Token, instruction and symbol dumps
+    TRACE_VERBOSE   // Per-item events
+} TraceLevel;
+
+extern uint8_t trace_levels[TRACE_CATEGORY_COUNT];
+
+#ifdef BEAG_NO_TRACE
+#define TRACE_ENABLED(category, level) 0
+#else
+#define TRACE_ENABLED(category, level) \
+    __builtin_expect(trace_levels[category] >= (level), 0)
+#endif
+
+#define TRACE(category, level, ...) \
+    do { if (TRACE_ENABLED(category, level)) trace_printf(__VA_ARGS__); } while (0)
+
+// Assembler phases timed by --stats
+typedef enum {
+    PHASE_READ,
+    PHASE_CACHE,
+    PHASE_LEX,
+    PHASE_EXPAND,
+    PHASE_PARSE,
+    PHASE_OPTIMIZE,
+    PHASE_LAYOUT,
+    PHASE_CODEGEN,
+    PHASE_ANALYZE,
+    PHASE_LINK,
+    PHASE_WRITE,
+    PHASE_COUNT
+} StatsPhase;
+
+// Peephole optimizer rules (see peephole.c)
+typedef enum {
+    PEEPHOLE_ZERO_DEST,         // Instruction whose only effect is a write to r0
+    PEEPHOLE_REDUNDANT_LOAD,    // lli/lhi of the value the register already holds
+    PEEPHOLE_REDUNDANT_MOVE,    // Copy into a register already holding the value
+    PEEPHOLE_BRANCH_CHAIN,      // Branch to a jump, retargeted past it
+    PEEPHOLE_BRANCH_NEXT,       // Branch to the next instruction
+    PEEPHOLE_RULE_COUNT
+} PeepholeRule;
+
+// Statistics for one assembly (see stats.c). Counters are always
+// maintained; they are plain increments and only reported by --stats.
+typedef struct {
+    double wall[PHASE_COUNT];       // Seconds per phase
+    double cpu[PHASE_COUNT];
+    uint64_t bytes_read;
+    uint64_t lines;
+    uint64_t tokens;
+    uint64_t include_files;
+    uint64_t macro_expansions;      // Macros, .rept and .irp bodies expanded
+    uint64_t ir_entries;
+    uint64_t words;
+    uint64_t relaxed_branches;      // Branches rewritten as long jumps
+    uint64_t relaxed_words;         // Words they added
+    uint64_t peephole_hits[PEEPHOLE_RULE_COUNT];
+    uint64_t peephole_words[PEEPHOLE_RULE_COUNT];   // Words removed
+    uint64_t peephole_cycles[PEEPHOLE_RULE_COUNT];  // Estimated cycles saved
+    uint64_t layout_blocks;         // Blocks placed by the profile-guided layout
+    uint64_t layout_moved;          // Blocks no longer after their source predecessor
+    uint64_t layout_jumps_added;
+    uint64_t layout_jumps_removed;
+    uint64_t layout_inverted;       // Branches inverted to fall through
+    uint64_t layout_taken_before;   // Profiled taken block exits, source order
+    uint64_t layout_taken_after;    // The same with the new layout
+    uint64_t symbol_lookups;
+    uint64_t symbol_probes;         // Occupied slots inspected
+    uint64_t symbol_collisions;     // Probes that hit a different symbol
+    uint64_t allocations;
+    uint64_t reallocations;
+    uint64_t frees;
+    size_t heap_current;
+    size_t heap_peak;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    double cache_saved;             // Assembly seconds avoided by hits
+} Stats;
+
+// Diagnostics of one assembly: written straight to stderr, or collected in
+// a buffer for callers that report them later (library, batch mode)
+typedef struct {
+    bool buffered;
+    char* text;            // NUL-terminated when non-NULL
+    size_t length;
+    size_t capacity;
+    int count;
+} Diagnostics;
+
+// Where the words of an image came from (see map.c): the labels and the
+// source line changes, each in address order
+typedef struct {
+    uint16_t address;
+    char* name;
+} MapLabel;
+
+typedef struct {
+    uint16_t address;
+    uint32_t file;              // Index into ImageMap.files
+    int line;
+} MapLine;
+
+typedef struct {
+    uint16_t address;
+    uint32_t size;              // Words
+} MapRange;
+
+typedef struct {
+    char** files;               // Source file names, main input first
+    size_t file_count;
+    MapLabel* labels;
+    size_t label_count;
+    MapLine* lines;
+    size_t line_count;
+    MapRange* data;             // Words of data directives
+    size_t data_count;
+    uint32_t size;              // Image words
+} ImageMap;
+
+// Settings shared by every assembly of a run
+typedef struct {
+    const char* cache_dir;  // Image cache directory, NULL to disable
+    bool relocatable;       // Emit objects for beag-ld instead of images
+    char* const* include_dirs;  // Searched for .include after the includer's directory
+    size_t include_dir_count;
+    bool depfile;           // Write a make dependency file with the output
+    const char* depfile_name;   // Defaults to the output name with .d
+    bool optimize;          // Run the peephole optimizer before code generation
+    bool map;               // Write an image map with the output
+    const char* map_name;   // Defaults to the output name with .map
+    const char* layout_profile; // Reorder code by this beag-sim profile, or NULL
+    bool cost;              // Analyze the static cost of the image
+    const uint16_t* latencies;  // Cycles per InstructionType for the cost, or NULL
+} AsmOptions;
+
+// Static cost of an image (see cost.c): its code split into basic blocks,
+// the blocks grouped into functions by the calls between them, and the
+// loops of each function. Blocks are in address order and functions in
+// order of their entry address.
+typedef enum {
+    COST_NEXT,              // Falls through, branches or jumps to its successors
+    COST_CALL,              // Calls, then continues at its successor
+    COST_RETURN,            // jalr through the link register
+    COST_INDIRECT,          // jalr to an address not known statically
+    COST_HALT,              // Jumps to itself
+    COST_ILLEGAL            // Ends at a word with an undefined opcode
+} CostExit;
+
+#define COST_NONE UINT32_MAX
+
+typedef struct {
+    uint16_t address;
+    uint16_t size;          // Instructions
+    uint32_t cycles;
+    uint32_t function;
+    uint32_t depth;         // Loops the block is in
+    uint8_t exit;           // CostExit
+    uint32_t next[2];       // Successor addresses, fall-through first, or COST_NONE
+    uint32_t callee;        // Address a COST_CALL block calls, or COST_NONE
+} CostBlock;
+
+typedef struct {
+    uint32_t entry;         // Block index
+    uint32_t blocks;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint32_t loops;
+} CostFunction;
+
+typedef struct {
+    uint32_t header;        // Block index
+    uint32_t function;
+    uint32_t blocks;
+    uint64_t instructions;
+    uint64_t cycles;        // One pass over every block of the loop
+    uint32_t depth;         // 1 for an outermost loop
+} CostLoop;
+
+typedef struct {
+    CostBlock* blocks;
+    size_t block_count;
+    CostFunction* functions;
+    size_t function_count;
+    CostLoop* loops;        // By function, then header address
+    size_t loop_count;
+    uint32_t* order;        // Block indices by function, then address
+    uint16_t latencies[INST_WORD];
+} CostAnalysis;
+
+// Assembler context. Everything one assembly touches lives here, so any
+// number of assemblies can run side by side, on any threads.
+typedef struct {
+    AsmOptions options;
+    AsmFile* files;
+    size_t file_count;
+    size_t file_capacity;
+    SymbolTable symbols;
+    Diagnostics diagnostics;
+    Stats stats;
+    ImageMap map;           // Map of the last image, if options.map or cost is set
+    CostAnalysis cost;      // Cost of the last image, if options.cost is set
+} Assembler;
+
+// One file of a batch (see batch.c)
+typedef struct {
+    char* input;
+    char* output;
+    bool ok;
+    char* diagnostics;     // Buffered messages, NULL if there were none
+    Stats stats;
+} BatchJob;
+
+// Instruction-set simulator (see sim.c). Every word of memory has a
+// predecoded slot, so executing an instruction is one indirect jump to its
+// handler; a store into the image decodes the stored word again.
+#define SIM_MEMORY_WORDS 65536
+#define SIM_SINK 8              // Register slot that absorbs writes to r0
+
+typedef enum {
+    SIM_RUNNING,
+    SIM_HALTED,                 // Jumped to itself
+    SIM_END,                    // Ran past the end of the image
+    SIM_STEP_LIMIT,
+    SIM_DIVIDE_BY_ZERO,
+    SIM_ILLEGAL                 // Word with an undefined opcode
+} SimStatus;
+
+typedef struct {
+    const void* handler;        // Dispatch address, set by sim_run()
+    uint8_t op;                 // InstructionType; INST_WORD if illegal, INST_EOP past the image
+    uint8_t a, b, c;            // Register operands in assembly order
+    int16_t imm;                // Sign-extended immediate or branch offset
+} SimInsn;
+
+// Execution profile of simulator runs (see profile.c). Counting is two
+// array increments per instruction, so a profile can be kept on whole
+// regression runs. Calls are the jalr instructions that save a return
+// address, counted per (site, target) pair in an open-addressing table.
+// The image is identified by its size and hash, so a saved profile is
+// only applied to the image it was recorded on.
+#define PROFILE_CALL_SLOTS 4096
+
+typedef struct {
+    uint16_t site;
+    uint16_t target;
+    uint64_t count;             // 0 for an empty slot
+} ProfileCall;
+
+typedef struct {
+    uint64_t* counts;           // Executions per address
+    uint64_t* taken;            // Taken branches per address
+    ProfileCall* calls;         // PROFILE_CALL_SLOTS slots
+    uint64_t lost_calls;        // Calls of pairs that found the table full
+    uint32_t image_size;
+    uint64_t image_hash;        // cache_hash() of the image words
+} Profile;
+
+typedef struct {
+    uint16_t regs[SIM_SINK + 1];
+    uint16_t pc;
+    uint16_t* memory;           // SIM_MEMORY_WORDS words
+    SimInsn* decoded;           // One slot per word of memory
+    uint32_t image_size;        // Words loaded from address 0
+    uint8_t opcodes[16];        // InstructionType per opcode, INST_WORD if undefined
+    uint64_t steps;             // Instructions executed
+    uint64_t step_limit;        // 0 for no limit
+    SimStatus status;
+    Profile* profile;           // Counters sim_run() updates, or NULL
+} Simulator;
+
+// x86-64 translator for the simulator (see jit.c)
+typedef struct {
+    uint8_t* cache;             // Executable code cache
+    size_t cache_size;
+    size_t used;
+    size_t code_start;          // Translations start after the entry trampoline
+    uint8_t* epilogue;
+    void** blocks;              // Translation per address, or NULL
+    uint8_t* code_map;          // Nonzero for words inside a translation
+    uint32_t generation;        // Counts flushes, so stale jumps are not patched
+    uint64_t translations;
+    uint64_t chains;            // Jumps patched to go straight to their target
+    uint64_t flushes;
+} Jit;
+
 // Function declarations
-Token* lexer_init(const char* input);
-InstructionType get_instruction_type(const char* name);
-void lexer_free(Token* tokens);
-Instruction* parser_parse(Token* tokens);
-void parser_free(Instruction* instructions);
-uint16_t* codegen_generate(Instruction* instructions, size_t* size);
-void symbol_table_init(void);
-void symbol_table_add(const char* name, uint16_t value);
-uint16_t symbol_table_get(const char* name);
-void symbol_table_free(void);
-void debug_print_instructions(Instruction* instructions);
-void debug_print_symbol_table(void);
-void debug_print_tokens(Token* tokens);
+void assembler_init(Assembler* as, const AsmOptions* options, bool buffer_diagnostics);
+uint16_t* assembler_run(Assembler* as, const char* input, size_t length, size_t* size);
+bool assembler_run_object(Assembler* as, const char* input, size_t length, ObjectFile* object);
+bool assembler_run_file(Assembler* as, const char* input, const char* output);
+void assembler_report(Assembler* as, const char* format, ...) __attribute__((format(printf, 2, 3)));
+int assembler_add_file(Assembler* as, const char* name, const char* data, size_t length);
+const char* assembler_file_note(const Assembler* as, int file);
+bool assembler_write_depfile(Assembler* as, const char* output);
+bool assembler_write_map(Assembler* as, const char* output);
+void assembler_free(Assembler* as);
+int batch_default_threads(void);
+bool batch_add_job(BatchJob** jobs, size_t* count, size_t* capacity,
+                   const char* input, const char* output, const char* dir, const char* extension);
+bool batch_load_manifest(const char* filename, const char* dir, const char* extension,
+                         BatchJob** jobs, size_t* count, size_t* capacity);
+char* batch_output_name(const char* input, const char* dir, const char* extension);
+bool batch_run(BatchJob* jobs, size_t count, int threads, const AsmOptions* options);
+void batch_report(const BatchJob* jobs, size_t count, FILE* out);
+void batch_free(BatchJob* jobs, size_t count);
+uint64_t cache_hash(const void* data, size_t length, uint64_t seed);
+uint64_t cache_key(const Assembler* as, const char* source, size_t length);
+bool cache_fetch(Assembler* as, uint64_t key, const char* output);
+void cache_store(Assembler* as, uint64_t key, const void* data, size_t bytes, size_t words,
+                 double seconds);
+bool source_open(Assembler* as, SourceFile* source, const char* filename);
+void source_close(SourceFile* source);
+void scan_init(void);
+const char* scan_whitespace(const char* p, const char* end, int* line, const char** line_start);
+const char* scan_identifier(const char* p, const char* end);
+const char* scan_line_end(const char* p, const char* end);
+TokenList* lexer_init(Assembler* as, int file, const char* input, size_t length);
+char lexer_string_char(const char** p);
+void lexer_free(TokenList* tokens);
+TokenList* preprocess(Assembler* as, TokenList* tokens);
+bool parser_parse(Assembler* as, TokenList* tokens, Program* program);
+void program_init(Program* program);
+bool program_append(Program* program, uint8_t op, uint8_t kind, uint16_t regs, int32_t imm,
+                    int file, int line);
+int program_line(const Program* program, size_t index);
+int program_file(const Program* program, size_t index);
+void program_remove(Program* program, const uint8_t* removed);
+bool program_numeric_addresses(const Program* program);
+void program_free(Program* program);
+bool peephole_optimize(Assembler* as, Program* program);
+const char* peephole_rule_name(PeepholeRule rule);
+bool layout_optimize(Assembler* as, Program* program);
+uint16_t* codegen_generate(Assembler* as, const Program* program, size_t* size);
+uint16_t* codegen_generate_at(Assembler* as, const Program* program, size_t* size,
+                              uint32_t* addresses);
+bool codegen_generate_object(Assembler* as, const Program* program, ObjectFile* object);
+bool map_build(Assembler* as, const Program* program, const uint32_t* addresses,
+               ImageMap* map);
+bool map_write(const ImageMap* map, const char* filename);
+bool map_read(const char* filename, ImageMap* map);
+const MapLabel* map_label_at(const ImageMap* map, uint16_t address);
+const MapLine* map_line_at(const ImageMap* map, uint16_t address);
+void map_free(ImageMap* map);
+bool cost_analyze(Assembler* as, const uint16_t* code, size_t size, const ImageMap* map,
+                  CostAnalysis* cost);
+void cost_report(const CostAnalysis* cost, const ImageMap* map, FILE* out, bool json);
+bool cost_read_latencies(const char* filename, uint16_t* latencies);
+void cost_free(CostAnalysis* cost);
+bool codegen_resolve(FixupKind kind, uint16_t address, uint16_t target, uint16_t* bits);
+bool object_init(ObjectFile* object, size_t sections, size_t symbols, size_t relocs,
+                 size_t strings, size_t words);
+bool object_read(Assembler* as, const char* filename, ObjectFile* object);
+void object_free(ObjectFile* object);
+bool link_objects(Assembler* as, char* const* inputs, size_t count, const char* output);
+bool symbol_table_init(SymbolTable* table);
+bool symbol_table_add(SymbolTable* table, const char* name, size_t length, uint16_t value);
+uint16_t symbol_table_get(SymbolTable* table, const char* name, size_t length);
+int symbol_table_intern(SymbolTable* table, const char* name, size_t length);
+void symbol_table_export(SymbolTable* table, int id);
+bool symbol_table_define(SymbolTable* table, int id, uint16_t value);
+uint16_t symbol_table_get_by_id(const SymbolTable* table, int id);
+const SymbolEntry* symbol_table_entry(const SymbolTable* table, int id);
+void symbol_table_free(SymbolTable* table);
+bool sim_init(Simulator* sim);
+void sim_load(Simulator* sim, const uint16_t* image, size_t size);
+void sim_decode(Simulator* sim, uint16_t address);
+SimStatus sim_run(Simulator* sim);
+const char* sim_status_name(SimStatus status);
+void sim_free(Simulator* sim);
+bool profile_init(Profile* profile);
+void profile_call(Profile* profile, uint16_t site, uint16_t target);
+void profile_report(const Profile* profile, const Simulator* sim, const ImageMap* map, FILE* out);
+bool profile_write(const Profile* profile, const char* filename);
+bool profile_read(Assembler* as, const char* filename, Profile* profile);
+void profile_free(Profile* profile);
+bool jit_init(Jit* jit);
+SimStatus jit_run(Jit* jit, Simulator* sim);
+void jit_free(Jit* jit);
+void stats_begin(Stats* stats, StatsPhase phase);
+void stats_end(Stats* stats, StatsPhase phase);
+Stats* stats_attach(Stats* stats);
+void stats_merge(Stats* total, const Stats* stats);
+void stats_report(const Stats* stats, FILE* out, bool json);
+void* mem_alloc(size_t size);
+void* mem_calloc(size_t count, size_t size);
+void* mem_realloc(void* ptr, size_t size);
+void mem_free(void* ptr);
+bool trace_configure(const char* spec);
+bool trace_open(const char* filename);
+void trace_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void trace_flush(void);
+void trace_close(void);
+void debug_print_instructions(const SymbolTable* symbols, const Program* program);
+void debug_print_symbol_table(const SymbolTable* table);
+void debug_print_tokens(TokenList* tokens);
 
 #endif // ASM_H 
\ No newline at end of file
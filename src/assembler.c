@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "asm.h"
+#include "beagasm.h"
+
+void assembler_init(Assembler* as, const AsmOptions* options, bool buffer_diagnostics) {
+    memset(as, 0, sizeof(*as));
+    if (options) as->options = *options;
+    as->diagnostics.buffered = buffer_diagnostics;
+}
+
+// Reports a diagnostic. The text carries its own "Error: ..." prefix and
+// trailing newline, exactly as it would be printed to stderr.
+void assembler_report(Assembler* as, const char* format, ...) {
+    Diagnostics* diag = &as->diagnostics;
+    diag->count++;
+
+    va_list args;
+    va_start(args, format);
+    if (!diag->buffered) {
+        vfprintf(stderr, format, args);
+        va_end(args);
+        return;
+    }
+
+    va_list copy;
+    va_copy(copy, args);
+    int n = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (n >= 0 && diag->length + (size_t)n + 1 > diag->capacity) {
+        size_t capacity = diag->capacity ? diag->capacity : 256;
+        while (capacity < diag->length + (size_t)n + 1) capacity *= 2;
+        char* grown = mem_realloc(diag->text, capacity);
+        if (grown) {
+            diag->text = grown;
+            diag->capacity = capacity;
+        } else {
+            n = -1;  // Drop the message rather than fail the assembly
+        }
+    }
+    if (n >= 0) {
+        vsnprintf(diag->text + diag->length, diag->capacity - diag->length, format, args);
+        diag->length += (size_t)n;
+    }
+    va_end(args);
+}
+
+// Adds a file to the file table and returns its index, or -1 if out of
+// memory. Files other than the main input have a name; their text is
+// filled in by the caller.
+int assembler_add_file(Assembler* as, const char* name, const char* data, size_t length) {
+    if (as->file_count == as->file_capacity) {
+        size_t capacity = as->file_capacity ? as->file_capacity * 2 : 8;
+        if (capacity > UINT16_MAX + 1) return -1;  // Tokens store a 16-bit index
+        AsmFile* grown = mem_realloc(as->files, capacity * sizeof(AsmFile));
+        if (!grown) return -1;
+        as->files = grown;
+        as->file_capacity = capacity;
+    }
+
+    AsmFile* file = &as->files[as->file_count];
+    memset(file, 0, sizeof(*file));
+    if (name) {
+        // One block holds the name and the note diagnostics append
+        size_t size = strlen(name) + 1;
+        file->name = mem_alloc(2 * size + sizeof(" in ''"));
+        if (!file->name) return -1;
+        memcpy(file->name, name, size);
+        snprintf(file->name + size, size + sizeof(" in ''"), " in '%s'", name);
+    }
+    file->source.data = data;
+    file->source.length = length;
+    return (int)as->file_count++;
+}
+
+// Returns the suffix diagnostics add to a line number to name its file:
+// empty for the main input, " in 'name'" for included files
+const char* assembler_file_note(const Assembler* as, int file) {
+    if (file <= 0 || (size_t)file >= as->file_count) return "";
+    const char* name = as->files[file].name;
+    return name + strlen(name) + 1;
+}
+
+// Lexes, parses and generates code for input. With object set, the result
+// is a relocatable object; otherwise an image returned through code/size.
+static bool assemble(Assembler* as, const char* input, size_t length,
+                     uint16_t** code, size_t* size, ObjectFile* object) {
+    Stats* previous = stats_attach(&as->stats);
+    bool ok = false;
+    TokenList* tokens = NULL;
+    TokenList* expanded = NULL;
+    Program program;
+    program_init(&program);
+
+    if (!symbol_table_init(&as->symbols) ||
+        (as->file_count == 0 && assembler_add_file(as, NULL, input, length) < 0)) {
+        assembler_report(as, "Error: Out of memory\n");
+        goto done;
+    }
+
+    // Lexical analysis
+    stats_begin(&as->stats, PHASE_LEX);
+    tokens = lexer_init(as, 0, input, length);
+    stats_end(&as->stats, PHASE_LEX);
+    if (!tokens) goto done;
+    as->stats.tokens = tokens->count;
+    as->stats.lines = tokens->tokens[tokens->count].line;  // EOF token
+
+    // Includes, macros and repetitions
+    stats_begin(&as->stats, PHASE_EXPAND);
+    expanded = preprocess(as, tokens);
+    stats_end(&as->stats, PHASE_EXPAND);
+    if (!expanded) goto done;
+
+    // Parsing
+    stats_begin(&as->stats, PHASE_PARSE);
+    bool parsed = parser_parse(as, expanded, &program);
+    stats_end(&as->stats, PHASE_PARSE);
+    as->stats.ir_entries = program.count;
+    if (!parsed) goto done;
+
+    // Peephole optimization
+    if (as->options.optimize) {
+        stats_begin(&as->stats, PHASE_OPTIMIZE);
+        bool optimized = peephole_optimize(as, &program);
+        stats_end(&as->stats, PHASE_OPTIMIZE);
+        if (!optimized) goto done;
+    }
+
+    // Profile-guided code layout
+    if (as->options.layout_profile && !object) {
+        stats_begin(&as->stats, PHASE_LAYOUT);
+        bool laid_out = layout_optimize(as, &program);
+        stats_end(&as->stats, PHASE_LAYOUT);
+        if (!laid_out) goto done;
+    }
+
+    // Code generation
+    stats_begin(&as->stats, PHASE_CODEGEN);
+    if (object) {
+        ok = codegen_generate_object(as, &program, object);
+        if (ok) as->stats.words = object->header->word_count;
+    } else {
+        *code = codegen_generate(as, &program, size);
+        ok = *code != NULL;
+        if (ok) as->stats.words = *size;
+    }
+    stats_end(&as->stats, PHASE_CODEGEN);
+
+    // Static cost of the image
+    if (ok && as->options.cost && !object) {
+        stats_begin(&as->stats, PHASE_ANALYZE);
+        ok = cost_analyze(as, *code, *size, &as->map, &as->cost);
+        stats_end(&as->stats, PHASE_ANALYZE);
+        if (!ok) {
+            mem_free(*code);
+            *code = NULL;
+        }
+    }
+
+done:
+    as->stats.symbol_lookups = as->symbols.lookups;
+    as->stats.symbol_probes = as->symbols.probes;
+    as->stats.symbol_collisions = as->symbols.collisions;
+    program_free(&program);
+    if (expanded != tokens) lexer_free(expanded);
+    lexer_free(tokens);
+    stats_attach(previous);
+    return ok;
+}
+
+// Assembles source text into a word image. Returns NULL (with diagnostics
+// reported) on failure; the image is released with mem_free().
+uint16_t* assembler_run(Assembler* as, const char* input, size_t length, size_t* size) {
+    uint16_t* code = NULL;
+    return assemble(as, input, length, &code, size, NULL) ? code : NULL;
+}
+
+// Assembles source text into a relocatable object, released with
+// object_free()
+bool assembler_run_object(Assembler* as, const char* input, size_t length, ObjectFile* object) {
+    return assemble(as, input, length, NULL, NULL, object);
+}
+
+static bool write_file(Assembler* as, const char* filename, const void* data, size_t bytes) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        assembler_report(as, "Error: Could not open file '%s' for writing\n", filename);
+        return false;
+    }
+
+    bool ok = fwrite(data, 1, bytes, file) == bytes;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) assembler_report(as, "Error: Could not write file '%s'\n", filename);
+    return ok;
+}
+
+// Assembles the file input (or stdin for "-") into output: an image, or an
+// object if the options ask for one
+bool assembler_run_file(Assembler* as, const char* input, const char* output) {
+    Stats* previous = stats_attach(&as->stats);
+    bool ok = false;
+
+    // Map (or read) the input file
+    SourceFile source;
+    stats_begin(&as->stats, PHASE_READ);
+    bool opened = source_open(as, &source, input);
+    stats_end(&as->stats, PHASE_READ);
+    if (!opened) goto done;
+    as->stats.bytes_read = source.length;
+    if (assembler_add_file(as, input, source.data, source.length) < 0) {
+        assembler_report(as, "Error: Out of memory\n");
+        source_close(&source);
+        goto done;
+    }
+
+    // An unchanged source with the same options reuses the cached image
+    // A laid out image depends on the profile too, so it is not cached
+    uint64_t key = 0;
+    bool cached = as->options.cache_dir && !as->options.layout_profile;
+    if (cached) {
+        stats_begin(&as->stats, PHASE_CACHE);
+        key = cache_key(as, source.data, source.length);
+        // A cached image has no map, so asking for one (or for the cost,
+        // which is analyzed with the map) always assembles
+        bool hit = !as->options.map && !as->options.cost && cache_fetch(as, key, output);
+        stats_end(&as->stats, PHASE_CACHE);
+        if (hit) {
+            source_close(&source);
+            ok = !as->options.depfile || assembler_write_depfile(as, output);
+            goto done;
+        }
+        as->stats.cache_misses++;
+    }
+
+    // Lex, parse and generate code
+    uint16_t* code = NULL;
+    size_t code_size = 0;
+    ObjectFile object = { 0 };
+    bool assembled = as->options.relocatable
+        ? assembler_run_object(as, source.data, source.length, &object)
+        : (code = assembler_run(as, source.data, source.length, &code_size)) != NULL;
+    source_close(&source);
+    if (!assembled) goto done;
+    const void* data = code ? (const void*)code : object.data;
+    size_t bytes = code ? code_size * sizeof(uint16_t) : object.size;
+
+    // Write output file
+    stats_begin(&as->stats, PHASE_WRITE);
+    ok = write_file(as, output, data, bytes);
+    stats_end(&as->stats, PHASE_WRITE);
+
+    if (ok && cached) {
+        double seconds = as->stats.wall[PHASE_LEX] + as->stats.wall[PHASE_EXPAND] +
+                         as->stats.wall[PHASE_PARSE] + as->stats.wall[PHASE_OPTIMIZE] +
+                         as->stats.wall[PHASE_LAYOUT] + as->stats.wall[PHASE_CODEGEN];
+        stats_begin(&as->stats, PHASE_CACHE);
+        cache_store(as, key, data, bytes, as->stats.words, seconds);
+        stats_end(&as->stats, PHASE_CACHE);
+    }
+    mem_free(code);
+    object_free(&object);
+    if (ok && as->options.depfile) ok = assembler_write_depfile(as, output);
+    if (ok && as->options.map) ok = assembler_write_map(as, output);
+
+done:
+    stats_attach(previous);
+    return ok;
+}
+
+// Writes path escaped for a make rule
+static void write_make_path(FILE* file, const char* path) {
+    for (const char* p = path; *p; p++) {
+        if (*p == ' ' || *p == '#') fputc('\\', file);
+        if (*p == '$') fputc('$', file);
+        fputc(*p, file);
+    }
+}
+
+// Writes a make rule naming the main input and every included file as
+// prerequisites of output, plus an empty rule per include so that make
+// does not fail once an include is deleted
+bool assembler_write_depfile(Assembler* as, const char* output) {
+    char* derived = NULL;
+    const char* name = as->options.depfile_name;
+    if (!name) {
+        name = derived = batch_output_name(output, NULL, ".d");
+        if (!name) {
+            assembler_report(as, "Error: Out of memory\n");
+            return false;
+        }
+    }
+
+    FILE* file = fopen(name, "w");
+    if (!file) {
+        assembler_report(as, "Error: Could not open file '%s' for writing\n", name);
+        mem_free(derived);
+        return false;
+    }
+    write_make_path(file, output);
+    fputc(':', file);
+    for (size_t i = 0; i < as->file_count; i++) {
+        const char* path = as->files[i].name;
+        if (!path || strcmp(path, "-") == 0) continue;
+        fputc(' ', file);
+        write_make_path(file, path);
+    }
+    fputc('\n', file);
+    for (size_t i = 1; i < as->file_count; i++) {
+        fputc('\n', file);
+        write_make_path(file, as->files[i].name);
+        fputs(":\n", file);
+    }
+    bool ok = fclose(file) == 0;
+    if (!ok) assembler_report(as, "Error: Could not write file '%s'\n", name);
+    mem_free(derived);
+    return ok;
+}
+
+// Writes the map of the image just assembled to output
+bool assembler_write_map(Assembler* as, const char* output) {
+    char* derived = NULL;
+    const char* name = as->options.map_name;
+    if (!name) {
+        name = derived = batch_output_name(output, NULL, ".map");
+        if (!name) {
+            assembler_report(as, "Error: Out of memory\n");
+            return false;
+        }
+    }
+
+    bool ok = map_write(&as->map, name);
+    if (!ok) assembler_report(as, "Error: Could not write file '%s'\n", name);
+    mem_free(derived);
+    return ok;
+}
+
+void assembler_free(Assembler* as) {
+    Stats* previous = stats_attach(&as->stats);
+    for (size_t i = 0; i < as->file_count; i++) {
+        if (i > 0) source_close(&as->files[i].source);  // The main input is borrowed
+        lexer_free(as->files[i].tokens);
+        mem_free(as->files[i].name);
+    }
+    mem_free(as->files);
+    as->files = NULL;
+    as->file_count = as->file_capacity = 0;
+    symbol_table_free(&as->symbols);
+    mem_free(as->diagnostics.text);
+    as->diagnostics.text = NULL;
+    map_free(&as->map);
+    cost_free(&as->cost);
+    stats_attach(previous);
+}
+
+bool beag_assemble(const char* source, size_t length, BeagResult* result) {
+    memset(result, 0, sizeof(*result));
+
+    Assembler as;
+    assembler_init(&as, NULL, true);
+    size_t size = 0;
+    uint16_t* code = assembler_run(&as, source, length, &size);
+
+    // Hand the caller plain malloc'd memory it can release without us
+    bool ok = code != NULL;
+    if (code) {
+        result->words = malloc((size ? size : 1) * sizeof(uint16_t));
+        if (result->words) {
+            memcpy(result->words, code, size * sizeof(uint16_t));
+            result->size = size;
+        }
+        ok = result->words != NULL;
+        mem_free(code);
+    }
+    result->diagnostics = strdup(as.diagnostics.text ? as.diagnostics.text : "");
+    if (!result->diagnostics) ok = false;
+    assembler_free(&as);
+    return ok;
+}
+
+void beag_result_free(BeagResult* result) {
+    free(result->words);
+    free(result->diagnostics);
+    memset(result, 0, sizeof(*result));
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "asm.h"
+
+// Batch assembly on a work-stealing thread pool. Jobs are dealt round-robin
+// onto per-worker deques up front; a worker pops from the back of its own
+// deque and, once that is empty, steals from the front of the others. No
+// job creates more work, so a worker that finds every deque empty is done.
+// Each job has its own Assembler with buffered diagnostics, so files never
+// share state and their messages can be printed per file afterwards.
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t* items;         // Job indices
+    size_t head;           // Next to steal
+    size_t tail;           // One past the next to pop
+} WorkQueue;
+
+typedef struct {
+    BatchJob* jobs;
+    const AsmOptions* options;
+    WorkQueue* queues;
+    int worker_count;
+} BatchPool;
+
+typedef struct {
+    BatchPool* pool;
+    int id;
+} Worker;
+
+static bool queue_pop(WorkQueue* queue, size_t* job) {
+    pthread_mutex_lock(&queue->lock);
+    bool found = queue->head < queue->tail;
+    if (found) *job = queue->items[--queue->tail];
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static bool queue_steal(WorkQueue* queue, size_t* job) {
+    pthread_mutex_lock(&queue->lock);
+    bool found = queue->head < queue->tail;
+    if (found) *job = queue->items[queue->head++];
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void run_job(BatchJob* job, const AsmOptions* options) {
+    Assembler as;
+    assembler_init(&as, options, true);
+    job->ok = assembler_run_file(&as, job->input, job->output);
+
+    // Keep the diagnostics and statistics; the rest of the context goes
+    job->diagnostics = as.diagnostics.text;
+    as.diagnostics.text = NULL;
+    assembler_free(&as);
+    job->stats = as.stats;
+}
+
+static void* worker_main(void* arg) {
+    Worker* worker = arg;
+    BatchPool* pool = worker->pool;
+    WorkQueue* own = &pool->queues[worker->id];
+
+    for (;;) {
+        size_t job;
+        bool found = queue_pop(own, &job);
+        for (int i = 1; !found && i < pool->worker_count; i++) {
+            found = queue_steal(&pool->queues[(worker->id + i) % pool->worker_count], &job);
+        }
+        if (!found) return NULL;
+        run_job(&pool->jobs[job], pool->options);
+    }
+}
+
+int batch_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+bool batch_run(BatchJob* jobs, size_t count, int threads, const AsmOptions* options) {
+    if (threads < 1) threads = 1;
+    if ((size_t)threads > count) threads = count ? (int)count : 1;
+
+    BatchPool pool = { jobs, options, NULL, threads };
+    pool.queues = mem_calloc((size_t)threads, sizeof(WorkQueue));
+    size_t* items = mem_alloc((count ? count : 1) * sizeof(size_t));
+    Worker* workers = mem_calloc((size_t)threads, sizeof(Worker));
+    pthread_t* handles = mem_calloc((size_t)threads, sizeof(pthread_t));
+    if (!pool.queues || !items || !workers || !handles) {
+        fprintf(stderr, "Error: Out of memory starting batch\n");
+        mem_free(pool.queues);
+        mem_free(items);
+        mem_free(workers);
+        mem_free(handles);
+        return false;
+    }
+
+    // Deal jobs round-robin; each queue owns a contiguous slice of items
+    size_t next = 0;
+    for (int w = 0; w < threads; w++) {
+        WorkQueue* queue = &pool.queues[w];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->items = items + next;
+        for (size_t j = (size_t)w; j < count; j += (size_t)threads) {
+            queue->items[queue->tail++] = j;
+        }
+        next += queue->tail;
+    }
+
+    // The calling thread works as worker 0
+    int started = 1;
+    for (int w = 0; w < threads; w++) {
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+    for (int w = 1; w < threads; w++) {
+        if (pthread_create(&handles[w], NULL, worker_main, &workers[w]) != 0) break;
+        started++;
+    }
+    worker_main(&workers[0]);
+    for (int w = 1; w < started; w++) pthread_join(handles[w], NULL);
+
+    for (int w = 0; w < threads; w++) pthread_mutex_destroy(&pool.queues[w].lock);
+    mem_free(pool.queues);
+    mem_free(items);
+    mem_free(workers);
+    mem_free(handles);
+
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) ok = ok && jobs[i].ok;
+    return ok;
+}
+
+static char* copy_string(const char* str) {
+    size_t size = strlen(str) + 1;
+    char* copy = mem_alloc(size);
+    if (copy) memcpy(copy, str, size);
+    return copy;
+}
+
+// Prints each job's diagnostics in job order, every line prefixed with its
+// input file name
+void batch_report(const BatchJob* jobs, size_t count, FILE* out) {
+    for (size_t i = 0; i < count; i++) {
+        const char* p = jobs[i].diagnostics;
+        while (p && *p) {
+            size_t len = strcspn(p, "\n");
+            fprintf(out, "%s: %.*s\n", jobs[i].input, (int)len, p);
+            p += len + (p[len] == '\n');
+        }
+    }
+}
+
+// Derives the output name for input: its extension replaced by extension
+// (".bin" or ".o"), and placed in dir if one is given. An input that
+// already has that extension gets it appended, so the output never
+// overwrites the input.
+char* batch_output_name(const char* input, const char* dir, const char* extension) {
+    const char* base = input;
+    if (dir) {
+        const char* slash = strrchr(input, '/');
+        if (slash) base = slash + 1;
+    }
+    const char* dot = strrchr(base, '.');
+    const char* slash = strrchr(base, '/');
+    size_t stem = dot && (!slash || dot > slash) ? (size_t)(dot - base) : strlen(base);
+    if (strcmp(base + stem, extension) == 0) stem = strlen(base);
+
+    size_t dir_len = dir ? strlen(dir) : 0;
+    char* name = mem_alloc(dir_len + 1 + stem + strlen(extension) + 1);
+    if (!name) return NULL;
+    char* p = name;
+    if (dir) {
+        memcpy(p, dir, dir_len);
+        p += dir_len;
+        *p++ = '/';
+    }
+    memcpy(p, base, stem);
+    strcpy(p + stem, extension);
+    return name;
+}
+
+// Reads a manifest: one "input [output]" pair per line; blank lines and
+// lines starting with '#' are skipped. Jobs are appended to *jobs.
+bool batch_load_manifest(const char* filename, const char* dir, const char* extension,
+                         BatchJob** jobs, size_t* count, size_t* capacity) {
+    FILE* file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open manifest '%s'\n", filename);
+        return false;
+    }
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    int line_number = 0;
+    bool ok = true;
+    while (ok && getline(&line, &line_capacity, file) >= 0) {
+        line_number++;
+        char input[4096], output[4096];
+        int fields = sscanf(line, " %4095s %4095s", input, output);
+        if (fields < 1 || input[0] == '#') continue;
+        ok = batch_add_job(jobs, count, capacity, input, fields == 2 ? output : NULL, dir,
+                           extension);
+        if (!ok) fprintf(stderr, "Error: Out of memory at manifest line %d\n", line_number);
+    }
+    free(line);
+    if (file != stdin) fclose(file);
+    return ok;
+}
+
+// Appends a job; output defaults to batch_output_name(input, dir, extension)
+bool batch_add_job(BatchJob** jobs, size_t* count, size_t* capacity,
+                   const char* input, const char* output, const char* dir, const char* extension) {
+    if (*count == *capacity) {
+        size_t grown_capacity = *capacity ? *capacity * 2 : 64;
+        BatchJob* grown = mem_realloc(*jobs, grown_capacity * sizeof(BatchJob));
+        if (!grown) return false;
+        *jobs = grown;
+        *capacity = grown_capacity;
+    }
+
+    BatchJob* job = &(*jobs)[*count];
+    memset(job, 0, sizeof(*job));
+    job->input = copy_string(input);
+    job->output = output ? copy_string(output) : batch_output_name(input, dir, extension);
+    (*count)++;  // Counted even if incomplete, so batch_free releases it
+    return job->input && job->output;
+}
+
+void batch_free(BatchJob* jobs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        mem_free(jobs[i].input);
+        mem_free(jobs[i].output);
+        mem_free(jobs[i].diagnostics);
+    }
+    mem_free(jobs);
+}
@@ -0,0 +1,24 @@
+#ifndef BEAGASM_H
+#define BEAGASM_H
+
+// Public interface of libbeagasm, the BEAG assembler as a library.
+// Assembly is reentrant: calls may run concurrently on different threads.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    uint16_t* words;       // Assembled image, NULL on failure
+    size_t size;           // Image size in 16-bit words
+    char* diagnostics;     // NUL-terminated error text, empty on success;
+                           // NULL if out of memory
+} BeagResult;
+
+// Assembles length bytes of BEAG source (not necessarily NUL-terminated).
+// Returns true on success; running out of memory fails the assembly. The
+// result is always filled in and must be released with beag_result_free().
+bool beag_assemble(const char* source, size_t length, BeagResult* result);
+void beag_result_free(BeagResult* result);
+
+#endif // BEAGASM_H
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "asm.h"
+
+// On-disk output cache. An entry is named by a 64-bit hash of the source
+// text, seeded with the assembler version and the output-affecting options,
+// and holds the output file (an image or an object) plus the time it took
+// to assemble, so a hit can report what it saved. Included files are only
+// known after preprocessing, so an entry also lists each include with the
+// hash of its contents; a hit requires every one of them to be unchanged.
+// Entries are written to a temporary file and renamed into place, so
+// concurrent assemblers never see a partial entry.
+
+#define CACHE_MAGIC 0x33434742u  // "BGC3"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t words;         // Words generated, for --stats
+    uint64_t bytes;         // Size of the output file
+    uint64_t assemble_ns;   // Lex + parse + codegen time of the original run
+    uint32_t dep_count;     // Included files
+    uint32_t dep_bytes;     // Size of the dependency records
+} CacheHeader;
+
+// Dependency record: the include's content hash and name, unaligned
+typedef struct {
+    uint64_t hash;
+    uint32_t length;        // Name bytes that follow, no terminator
+} CacheDep;
+
+// XXH64: reads 32 bytes per round in four independent lanes
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+#define PRIME64_4 0x85EBCA77C2B2AE63ull
+#define PRIME64_5 0x27D4EB2F165667C5ull
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t lane) {
+    acc ^= xxh_round(0, lane);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t cache_hash(const void* data, size_t length, uint64_t seed) {
+    const unsigned char* p = data;
+    const unsigned char* end = p + length;
+    uint64_t h;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+    h += (uint64_t)length;
+
+    while (end - p >= 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p++) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// The key covers everything that determines the image. Options that change
+// the output must be folded into the seed here, and so must everything that
+// decides where .include looks: the main input's directory and the include
+// directories. Include contents are checked on fetch.
+uint64_t cache_key(const Assembler* as, const char* source, size_t length) {
+    uint64_t seed = cache_hash(ASM_VERSION, sizeof(ASM_VERSION) - 1, 0);
+    uint8_t relocatable = as->options.relocatable;
+    seed = cache_hash(&relocatable, sizeof(relocatable), seed);
+    uint8_t optimize = as->options.optimize;
+    seed = cache_hash(&optimize, sizeof(optimize), seed);
+
+    const char* input = as->file_count ? as->files[0].name : NULL;
+    const char* slash = input ? strrchr(input, '/') : NULL;
+    if (slash) seed = cache_hash(input, (size_t)(slash - input), seed);
+    for (size_t i = 0; i < as->options.include_dir_count; i++) {
+        const char* dir = as->options.include_dirs[i];
+        seed = cache_hash(dir, strlen(dir) + 1, seed);
+    }
+    return cache_hash(source, length, seed);
+}
+
+// Hashes a file's contents; false if it cannot be read
+static bool hash_file(const char* path, uint64_t* hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (ok && st.st_size == 0) {
+        *hash = cache_hash("", 0, 0);
+    } else if (ok) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = data != MAP_FAILED;
+        if (ok) {
+            *hash = cache_hash(data, (size_t)st.st_size, 0);
+            munmap(data, (size_t)st.st_size);
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+// Checks that every include recorded in an entry still has the recorded
+// contents; on success the includes are added to the file table, so the
+// dependency file of a hit names them as well
+static bool check_deps(Assembler* as, const char* deps, const CacheHeader* header) {
+    const char* p = deps;
+    const char* end = deps + header->dep_bytes;
+    for (uint32_t i = 0; i < header->dep_count; i++) {
+        CacheDep dep;
+        char name[4096];
+        if ((size_t)(end - p) < sizeof(dep)) return false;
+        memcpy(&dep, p, sizeof(dep));
+        p += sizeof(dep);
+        if (dep.length >= sizeof(name) || (size_t)(end - p) < dep.length) return false;
+        memcpy(name, p, dep.length);
+        name[dep.length] = '\0';
+        p += dep.length;
+
+        uint64_t hash;
+        if (!hash_file(name, &hash) || hash != dep.hash) return false;
+    }
+
+    p = deps;
+    for (uint32_t i = 0; i < header->dep_count; i++) {
+        CacheDep dep;
+        char name[4096];
+        memcpy(&dep, p, sizeof(dep));
+        memcpy(name, p + sizeof(dep), dep.length);
+        name[dep.length] = '\0';
+        p += sizeof(dep) + dep.length;
+        if (assembler_add_file(as, name, NULL, 0) < 0) return false;
+    }
+    return true;
+}
+
+static void entry_path(const Assembler* as, uint64_t key, char* path, size_t size) {
+    snprintf(path, size, "%s/%016llx.img", as->options.cache_dir, (unsigned long long)key);
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// On a hit, copies the cached output to output and returns true. The copy is
+// deliberate: a hard link would let a later in-place rewrite of the output
+// corrupt the cache entry.
+bool cache_fetch(Assembler* as, uint64_t key, const char* output) {
+    char path[4096];
+    entry_path(as, key, path, sizeof(path));
+    FILE* entry = fopen(path, "rb");
+    if (!entry) return false;
+
+    size_t file_count = as->file_count;
+    CacheHeader header;
+    char* deps = NULL;
+    char* data = NULL;
+    bool hit = fread(&header, sizeof(header), 1, entry) == 1 && header.magic == CACHE_MAGIC &&
+               (deps = mem_alloc(header.dep_bytes ? header.dep_bytes : 1)) != NULL &&
+               fread(deps, 1, header.dep_bytes, entry) == header.dep_bytes &&
+               check_deps(as, deps, &header) &&
+               (data = mem_alloc(header.bytes ? header.bytes : 1)) != NULL &&
+               fread(data, 1, header.bytes, entry) == header.bytes;
+    fclose(entry);
+    mem_free(deps);
+
+    if (hit) {
+        FILE* file = fopen(output, "wb");
+        hit = file && fwrite(data, 1, header.bytes, file) == header.bytes;
+        if (file) fclose(file);
+    }
+    mem_free(data);
+    if (!hit) {
+        // Drop includes a partial check added; the assembly will find them
+        while (as->file_count > file_count) mem_free(as->files[--as->file_count].name);
+        return false;
+    }
+
+    as->stats.cache_hits++;
+    as->stats.cache_saved += (double)header.assemble_ns * 1e-9;
+    as->stats.words = header.words;
+    return true;
+}
+
+// Adds an entry for key, recording the includes of the file table.
+// Failures are ignored: the cache is an optimization
+void cache_store(Assembler* as, uint64_t key, const void* data, size_t bytes, size_t words,
+                 double seconds) {
+    char path[4096], temp[sizeof(path) + 8];
+    entry_path(as, key, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+
+    mkdir(as->options.cache_dir, 0777);
+    int fd = mkstemp(temp);
+    if (fd < 0) return;
+    fchmod(fd, 0644);
+
+    CacheHeader header = { CACHE_MAGIC, (uint32_t)words, bytes, (uint64_t)(seconds * 1e9), 0, 0 };
+    for (size_t i = 1; i < as->file_count; i++) {
+        header.dep_count++;
+        header.dep_bytes += (uint32_t)(sizeof(CacheDep) + strlen(as->files[i].name));
+    }
+    bool ok = write_all(fd, &header, sizeof(header));
+    for (size_t i = 1; ok && i < as->file_count; i++) {
+        const AsmFile* file = &as->files[i];
+        CacheDep dep;
+        memset(&dep, 0, sizeof(dep));  // No stray padding bytes in the entry
+        dep.hash = cache_hash(file->source.data, file->source.length, 0);
+        dep.length = (uint32_t)strlen(file->name);
+        ok = write_all(fd, &dep, sizeof(dep)) && write_all(fd, file->name, dep.length);
+    }
+    ok = ok && write_all(fd, data, bytes);
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temp, path) != 0) unlink(temp);
+}
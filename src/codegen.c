@@ -4,182 +4,701 @@
 #include "asm.h"
 
 #define MAX_CODE_SIZE 65536  // 2^16 instructions max
+#define UNPLACED UINT32_MAX  // Layout address of a label the program does not define
 
-uint16_t* codegen_generate(Instruction* instructions, size_t* size) {
-    if (!instructions || !size) return NULL;
-
-    // First pass: count instructions and resolve labels
-    // Note: BEAG uses word-addressable memory (16-bit words)
-    // Each instruction takes exactly one memory word
-    int instruction_count = 0;
-    int current_address = 0;  // Address in terms of 16-bit words
-    for (int i = 0; instructions[i].type != INST_EOP; i++) {
-        instruction_count++;
-        current_address++;  // Each instruction takes one memory word
-    }
-
-    // Allocate memory for the machine code
-    // Each instruction is 16 bits (one memory word)
-    uint16_t* machine_code = malloc(instruction_count * sizeof(uint16_t));
-    if (!machine_code) return NULL;
-
-    // Second pass: generate machine code
-    current_address = 0;  // Reset address counter for second pass
-    for (int i = 0; instructions[i].type != INST_EOP; i++) {
-        Instruction* inst = &instructions[i];
-        uint16_t instruction = 0;
-
-        switch (inst->type) {
-            case INST_ADD:
-                instruction = (0x0 << 12) |  // opcode [15:12]
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |  // rd [10:8]
-                            ((inst->operands[1].value.reg_num & 0x7) << 4) |  // rs1 [6:4]
-                            (inst->operands[2].value.reg_num & 0x7);          // rs2 [2:0]
-                break;
-
-            case INST_SUB:
-                instruction = (0x1 << 12) |
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |
-                            ((inst->operands[1].value.reg_num & 0x7) << 4) |
-                            (inst->operands[2].value.reg_num & 0x7);
-                break;
-
-            case INST_MUL:
-                instruction = (0x2 << 12) |
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |
-                            ((inst->operands[1].value.reg_num & 0x7) << 4) |
-                            (inst->operands[2].value.reg_num & 0x7);
-                break;
-
-            case INST_DIV:
-                instruction = (0x3 << 12) |
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |
-                            ((inst->operands[1].value.reg_num & 0x7) << 4) |
-                            (inst->operands[2].value.reg_num & 0x7);
-                break;
-
-            case INST_JALR:
-                instruction = (0x4 << 12) |
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |
-                            ((inst->operands[1].value.reg_num & 0x7) << 4) |
-                            (inst->operands[2].value.reg_num & 0x7);
-                break;
-
-            case INST_SW:
-                instruction = (0x5 << 12) |  // opcode [15:12]
-                            0x0 |            // [11:8] = 0000 (unused)
-                            ((inst->operands[1].value.reg_num & 0x7) << 4) |  // ra [6:4]
-                            (inst->operands[0].value.reg_num & 0x7);          // rs [2:0]
-                break;
-
-            case INST_LW:
-                instruction = (0x6 << 12) |  // opcode [15:12]
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |  // rd [10:8]
-                            ((inst->operands[1].value.reg_num & 0x7) << 4) |  // ra [6:4]
-                            0x0;                                              // [3:0] = 0000 (unused)
-                break;
-
-            case INST_LHI:
-                instruction = (0x8 << 12) |  // opcode [15:12]
-                            0x0 |            // [11] = 0 (unused)
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |  // rd [10:8]
-                            0x0 |            // [7] = 0 (unused)
-                            (inst->operands[1].value.immediate & 0xFF);       // imm8 [7:0]
-                break;
-
-            case INST_LLI:
-                instruction = (0x9 << 12) |  // opcode [15:12]
-                            0x0 |            // [11] = 0 (unused)
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |  // rd [10:8]
-                            0x0 |            // [7] = 0 (unused)
-                            (inst->operands[1].value.immediate & 0xFF);       // imm8 [7:0]
-                break;
-
-            case INST_WORD:
-                if (inst->operands[0].type == OP_IMMEDIATE) {
-                    instruction = inst->operands[0].value.immediate & 0xFFFF;
-                } else if (inst->operands[0].type == OP_LABEL) {
-                    uint16_t target = symbol_table_get(inst->operands[0].value.label);
-                    if (target == 0xFFFF) {
-                        fprintf(stderr, "Error: Undefined label '%s' at line %d\n",
-                                inst->operands[0].value.label, inst->line);
-                        free(machine_code);
-                        return NULL;
-                    }
-                    instruction = target;
-                }
-                break;
-
-            case INST_BNE:
-            case INST_BEQ:
-            case INST_BLT: {
-                uint16_t opcode;
-                switch (inst->type) {
-                    case INST_BNE: opcode = 0xD; break;  // Branch if register != 0
-                    case INST_BEQ: opcode = 0xE; break;  // Branch if register == 0
-                    case INST_BLT: opcode = 0xF; break;  // Branch if register < 0
-                    default: opcode = 0;  // Should never happen
-                }
-                
-                // Get target address from symbol table
-                // Note: All addresses in symbol table are in terms of 16-bit words
-                uint16_t target = symbol_table_get(inst->operands[1].value.label);
-                if (target == 0xFFFF) {
-                    fprintf(stderr, "Error: Undefined label '%s' at line %d\n",
-                            inst->operands[1].value.label, inst->line);
-                    free(machine_code);
-                    return NULL;
-                }
-                
-                // Calculate branch offset
-                // BEAG uses word-addressable memory, so:
-                // - current_address is in terms of 16-bit words
-                // - target is also in terms of 16-bit words
-                // For branch instructions:
-                // - PC is not pre-incremented (unlike regular instructions)
-                // - offset is relative to current instruction's address
-                // - positive offset means jump forward
-                // - negative offset means jump backward
-                // - 8-bit signed offset range: -128 to +127 instructions
-                //   This means we can branch up to 127 instructions forward
-                //   or 128 instructions backward from current position
-                // Example:
-                //   0x0000: beq r1, target    ; current_address = 0
-                //   0x0001: add r2, r3, r4    ; skipped if branch taken
-                //   0x0002: target: sub r5, r6, r7
-                //   offset = 2 - 0 = 2 (jump forward by 2 instructions)
-                //
-                // Branch conditions:
-                // - BEQ: branch if register value == 0
-                // - BNE: branch if register value != 0
-                // - BLT: branch if register value < 0
-                int16_t offset = target - current_address;
-                if (offset < -128 || offset > 127) {  // 8-bit signed offset
-                    fprintf(stderr, "Error: Branch target too far at line %d\n", inst->line);
-                    free(machine_code);
-                    return NULL;
-                }
-                
-                instruction = (opcode << 12) |  // opcode [15:12]
-                            0x0 |              // [11] = 0 (unused)
-                            ((inst->operands[0].value.reg_num & 0x7) << 8) |  // rd [10:8] - register to check
-                            0x0 |              // [7] = 0 (unused)
-                            (offset & 0xFF);                                   // imm8 [7:0] - branch offset
-                break;
+typedef struct {
+    uint16_t address;   // Word to patch
+    uint8_t kind;       // FixupKind
+    int symbol_id;
+    size_t index;       // IR entry, for diagnostics
+} Fixup;
+
+// Code is generated in a single pass over the IR: labels are bound as the
+// pass reaches them and every word is encoded immediately. References to
+// symbols that are already defined are resolved on the spot; forward
+// references leave the field zero and record a fixup that is patched in one
+// loop at the end.
+//
+// For a relocatable object everything is emitted into one .text section
+// based at zero. Branches to symbols defined in the same object are still
+// resolved here, since they are PC-relative; absolute references and
+// references to undefined symbols become relocations for the linker.
+//
+// Pseudo-instructions and branches to labels are sized before the pass
+// (see lay_out()), which is the only time label addresses are needed up
+// front. Branches that cannot reach their label become long jumps there.
+// Programs without pseudo-instructions are only laid out if a first pass
+// finds such a branch (see generate()).
+typedef struct {
+    Assembler* as;
+    const Program* program;
+    bool relocatable;
+    uint8_t* sizes;        // Words per IR entry, NULL without variable-size entries
+    uint32_t* labels;      // Layout address per symbol ID, or UNPLACED
+    uint16_t* code;
+    size_t code_size;
+    uint32_t* addresses;   // Address per IR entry for an image map, or NULL
+    Fixup* fixups;
+    size_t fixup_count;
+    size_t fixup_capacity;
+    bool out_of_range;     // A branch could not reach its label
+    bool reference;        // Not the output image: no notes on long jumps
+    bool failed;
+} CodeGen;
+
+// Reports an error at the source line of IR entry index
+static void report_at(CodeGen* gen, size_t index, const char* message) {
+    assembler_report(gen->as, "Error: %s at line %d%s\n", message,
+                     program_line(gen->program, index),
+                     assembler_file_note(gen->as, program_file(gen->program, index)));
+}
+
+// Whether IR entry index names REG_TEMP as a register operand
+static bool uses_temp(const Program* program, size_t index) {
+    uint8_t op = program->op[index];
+    if (op == INST_LA) return IR_REG(program->regs[index], 0) == REG_TEMP;
+    if (op >= INST_WORD) return false;
+    const IsaFormat* format = &isa_formats[op];
+    int reg = 0;
+    for (int k = 0; k < format->operand_count; k++) {
+        if (format->operands[k].kind != ISA_REG) continue;
+        if (IR_REG(program->regs[index], reg++) == REG_TEMP) return true;
+    }
+    return false;
+}
+
+// Notes the laid-out entries that load their label into REG_TEMP: relaxed
+// branches, long jumps and calls. They are listed under --trace=codegen,
+// and each gets a warning if the program uses r6 itself, since the load
+// silently overwrites it.
+static void note_long_jumps(CodeGen* gen, const uint32_t* entries, size_t count) {
+    const Program* program = gen->program;
+    bool temp_used = false;
+    for (size_t i = 0; i < program->count && !temp_used; i++) temp_used = uses_temp(program, i);
+
+    for (size_t k = 0; k < count; k++) {
+        size_t i = entries[k];
+        uint8_t op = program->op[i];
+        if (op == INST_LA || (op != INST_CALL && gen->sizes[i] == 1)) continue;
+        const char* what = op == INST_CALL ? "Call" : op == INST_J ? "Long jump" : "Relaxed branch";
+        int line = program_line(program, i);
+        const char* note = assembler_file_note(gen->as, program_file(program, i));
+        if (op != INST_CALL && op != INST_J) {
+            TRACE(TRACE_CODEGEN, TRACE_INFO, "codegen: relaxed branch at line %d%s\n", line, note);
+        }
+        if (temp_used) {
+            assembler_report(gen->as, "Warning: %s at line %d%s overwrites r6, "
+                             "which the program also uses\n", what, line, note);
+        }
+    }
+}
+
+static bool push_fixup(CodeGen* gen, FixupKind kind, int symbol_id, size_t index) {
+    if (gen->fixup_count == gen->fixup_capacity) {
+        size_t capacity = gen->fixup_capacity ? gen->fixup_capacity * 2 : 64;
+        Fixup* grown = mem_realloc(gen->fixups, capacity * sizeof(Fixup));
+        if (!grown) {
+            report_at(gen, index, "Out of memory");
+            return false;
+        }
+        gen->fixups = grown;
+        gen->fixup_capacity = capacity;
+    }
+
+    Fixup* fixup = &gen->fixups[gen->fixup_count++];
+    fixup->address = (uint16_t)gen->code_size;
+    fixup->kind = kind;
+    fixup->symbol_id = symbol_id;
+    fixup->index = index;
+    return true;
+}
+
+// Computes the bits a resolved symbol reference contributes to the word at
+// address. Returns false if a branch target is out of range.
+bool codegen_resolve(FixupKind kind, uint16_t address, uint16_t target, uint16_t* bits) {
+    switch (kind) {
+        case FIXUP_BRANCH8: {
+            // Calculate branch offset
+            // BEAG uses word-addressable memory, so:
+            // - address is in terms of 16-bit words
+            // - target is also in terms of 16-bit words
+            // For branch instructions:
+            // - PC is not pre-incremented (unlike regular instructions)
+            // - offset is relative to current instruction's address
+            // - positive offset means jump forward
+            // - negative offset means jump backward
+            // - 8-bit signed offset range: -128 to +127 instructions
+            //   This means we can branch up to 127 instructions forward
+            //   or 128 instructions backward from current position
+            // Example:
+            //   0x0000: beq r1, target    ; address = 0
+            //   0x0001: add r2, r3, r4    ; skipped if branch taken
+            //   0x0002: target: sub r5, r6, r7
+            //   offset = 2 - 0 = 2 (jump forward by 2 instructions)
+            //
+            // Branch conditions:
+            // - BEQ: branch if register value == 0
+            // - BNE: branch if register value != 0
+            // - BLT: branch if register value < 0
+            int offset = (int)target - (int)address;
+            if (offset < -128 || offset > 127) return false;  // 8-bit signed offset
+            *bits = offset & 0xFF;
+            return true;
+        }
+        case FIXUP_HI8:
+            *bits = (target >> 8) & 0xFF;  // High 8 bits
+            return true;
+        case FIXUP_LO8:
+            *bits = target & 0xFF;         // Low 8 bits
+            return true;
+        case FIXUP_WORD16:
+            *bits = target;
+            return true;
+    }
+    return false;
+}
+
+static bool resolve_reference(CodeGen* gen, FixupKind kind, uint16_t address, uint16_t target,
+                              size_t index, uint16_t* bits) {
+    if (!codegen_resolve(kind, address, target, bits)) {
+        if (!gen->sizes) {
+            // Without a layout yet, generate() relaxes the branch
+            gen->out_of_range = true;
+            *bits = 0;
+            return true;
+        }
+        report_at(gen, index, "Branch target too far");
+        return false;
+    }
+    return true;
+}
+
+// Encodes a symbol operand: resolved now if the symbol is defined,
+// otherwise left as zero bits with a fixup recorded
+static uint16_t encode_reference(CodeGen* gen, FixupKind kind, int symbol_id, size_t index) {
+    const SymbolEntry* symbol = symbol_table_entry(&gen->as->symbols, symbol_id);
+    bool absolute = kind != FIXUP_BRANCH8;
+    if (!symbol->is_defined || (gen->relocatable && absolute)) {
+        if (!push_fixup(gen, kind, symbol_id, index)) gen->failed = true;
+        return 0;
+    }
+
+    uint16_t bits = 0;
+    if (!resolve_reference(gen, kind, (uint16_t)gen->code_size, symbol->value, index, &bits)) {
+        gen->failed = true;
+    }
+    return bits;
+}
+
+// Encodes one instruction from its format table entry and appends it.
+// Every operand slot is evaluated unconditionally (unused slots have a zero
+// mask), so the only branch that depends on the instruction is whether the
+// immediate refers to a symbol. Returns false on errors that end the pass.
+static bool emit_word(CodeGen* gen, size_t index, uint8_t op, uint8_t kind, uint16_t regs,
+                      int32_t value) {
+    const IsaFormat* format = op < INST_EOP ? &isa_formats[op] : NULL;
+    if (!format || !format->mnemonic) {
+        report_at(gen, index, "Unknown instruction type");
+        return false;
+    }
+    if (gen->code_size >= MAX_CODE_SIZE) {
+        char message[64];
+        snprintf(message, sizeof(message), "Program exceeds %d words", MAX_CODE_SIZE);
+        report_at(gen, index, message);
+        return false;
+    }
+
+    uint16_t imm = (uint16_t)value;
+    if (kind == OP_LABEL_HI) {
+        imm = encode_reference(gen, FIXUP_HI8, value, index);
+    } else if (kind == OP_LABEL_LO) {
+        imm = encode_reference(gen, FIXUP_LO8, value, index);
+    } else if (kind == OP_LABEL) {
+        // Branch targets are PC-relative; anything else takes the address
+        bool relative = format->operands[0].kind == ISA_OFF ||
+                        format->operands[1].kind == ISA_OFF ||
+                        format->operands[2].kind == ISA_OFF;
+        FixupKind fixup = relative ? FIXUP_BRANCH8 : FIXUP_WORD16;
+        imm = encode_reference(gen, fixup, value, index);
+    }
+
+    uint16_t instruction = format->opcode_bits;
+    for (int i = 0; i < 3; i++) {
+        const IsaField* field = &format->operands[i];
+        uint16_t operand = field->kind == ISA_REG ? IR_REG(regs, i) : imm;
+        instruction |= (operand & field->mask) << field->shift;
+    }
+
+    gen->code[gen->code_size++] = instruction;
+    return true;
+}
+
+#define PACK_REGS(rd, rs1, rs2) ((uint16_t)((rd) | (rs1) << 4 | (rs2) << 8))
+
+// True if lli alone loads address: it survives sign extension from 8 bits
+static bool fits_lli(uint32_t address) {
+    return address <= 0x7F || (address >= 0xFF80 && address != UNPLACED);
+}
+
+static bool fits_branch(uint32_t target, uint32_t address) {
+    int offset = (int)target - (int)address;
+    return target != UNPLACED && offset >= -128 && offset <= 127;
+}
+
+// Words of a long jump besides loading the target into r6:
+//   j label           jalr r0, r6, r0
+//   beq/bne rs, label bne/beq rs, +skip; ...; jalr r0, r6, r0
+//   blt rs, label     blt rs, +2; beq r0, +skip; ...; jalr r0, r6, r0
+//   call label        jalr r7, r6, r0
+static unsigned jump_overhead(uint8_t op) {
+    return op == INST_BLT ? 3 : op == INST_BEQ || op == INST_BNE ? 2 : 1;
+}
+
+// Words to load target with lli [+ lhi]. Absolute references in an object
+// are relocated, so they always take the full pair.
+static unsigned load_size(const CodeGen* gen, uint32_t target) {
+    return !gen->relocatable && fits_lli(target) ? 1 : 2;
+}
+
+// Words the variable-size IR entry index needs at address for a label at
+// target. A branch to a label the program does not define stays short: it
+// is an error in an image and a relocation in an object.
+//   la rd, label   lli rd, %lo(label) [lhi rd, %hi(label)]
+//   call label     lli r6, %lo(label) [lhi r6, %hi(label)]; jalr r7, r6, r0
+//   j and branches the short branch (beq r0 for j) when in range, otherwise
+//                  a long jump through r6
+static unsigned entry_size(const CodeGen* gen, size_t index, uint32_t address, uint32_t target) {
+    uint8_t op = gen->program->op[index];
+    if (op == INST_LA) return load_size(gen, target);
+    if (op == INST_CALL) return load_size(gen, target) + 1;
+    if (fits_branch(target, address) || (op != INST_J && target == UNPLACED)) return 1;
+    return load_size(gen, target) + jump_overhead(op);
+}
+
+static unsigned max_size(const CodeGen* gen, size_t index) {
+    uint8_t op = gen->program->op[index];
+    return (op == INST_LA ? 0 : jump_overhead(op)) + 2;
+}
+
+// Variable entries are numbered in program order. Their growth is kept in a
+// Fenwick tree, so the address of an entry or label is its address with
+// every entry at its shortest plus the growth of the entries before it.
+typedef struct {
+    uint32_t* entries;     // IR index per variable entry
+    uint32_t* base;        // Shortest-layout address per variable entry
+    uint32_t* growth;      // Fenwick tree over the variable entries
+    uint32_t* label_rank;  // Variable entries before each label, per symbol ID
+    size_t count;
+} Layout;
+
+static void growth_add(Layout* layout, size_t rank, uint32_t words) {
+    for (size_t i = rank + 1; i <= layout->count; i += i & -i) layout->growth[i - 1] += words;
+}
+
+// Growth of the variable entries before rank
+static uint32_t growth_before(const Layout* layout, size_t rank) {
+    uint32_t sum = 0;
+    for (size_t i = rank; i > 0; i -= i & -i) sum += layout->growth[i - 1];
+    return sum;
+}
+
+static uint32_t label_address(const CodeGen* gen, const Layout* layout, int32_t symbol) {
+    uint32_t base = gen->labels[symbol];
+    return base == UNPLACED ? UNPLACED : base + growth_before(layout, layout->label_rank[symbol]);
+}
+
+// Sizes every variable entry (pseudo-instructions and branches to labels)
+// before the pass. Each starts at its shortest form, on a worklist. A pass
+// over the worklist grows every entry whose label is out of reach at the
+// current addresses and drops entries that cannot grow any more; passes
+// repeat until one changes nothing. Sizes only ever grow, so this ends,
+// and since each pass only visits the worklist with O(log n) address
+// lookups, the usual two or three passes stay near-linear. An entry may
+// keep more room than its label ends up needing; expand() pads it rather
+// than move anything.
+static bool lay_out(CodeGen* gen, size_t* words) {
+    const Program* program = gen->program;
+    Stats* stats = &gen->as->stats;
+    size_t symbol_count = gen->as->symbols.count ? (size_t)gen->as->symbols.count : 1;
+    Layout layout = { 0 };
+    size_t n = program->count ? program->count : 1;
+    gen->sizes = mem_alloc(program->count ? program->count : 1);
+    gen->labels = mem_alloc(symbol_count * sizeof(uint32_t));
+    layout.entries = mem_alloc(n * sizeof(uint32_t));
+    layout.base = mem_alloc(n * sizeof(uint32_t));
+    layout.growth = mem_calloc(n, sizeof(uint32_t));
+    layout.label_rank = mem_alloc(symbol_count * sizeof(uint32_t));
+    bool ok = gen->sizes && gen->labels && layout.entries && layout.base && layout.growth &&
+              layout.label_rank;
+    if (!ok) {
+        assembler_report(gen->as, "Error: Out of memory\n");
+        goto done;
+    }
+
+    // Shortest layout
+    for (size_t i = 0; i < symbol_count; i++) gen->labels[i] = UNPLACED;
+    uint32_t address = 0;
+    for (size_t i = 0; i < program->count; i++) {
+        uint8_t op = program->op[i];
+        unsigned size = 1;
+        if (op == INST_LABEL) {
+            // The first definition counts, as in the pass
+            int32_t id = program->imm[i];
+            if (gen->labels[id] == UNPLACED) {
+                gen->labels[id] = address;
+                layout.label_rank[id] = (uint32_t)layout.count;
+            }
+            size = 0;
+        } else if (op >= INST_LA || (program->kind[i] == OP_LABEL &&
+                                     (op == INST_BEQ || op == INST_BNE || op == INST_BLT))) {
+            size = op == INST_CALL ? 2 : 1;
+            layout.entries[layout.count] = (uint32_t)i;
+            layout.base[layout.count++] = address;
+        }
+        gen->sizes[i] = (uint8_t)size;
+        address += size;
+    }
+
+    // The worklist holds ranks; it starts as every variable entry
+    uint32_t* work = mem_alloc(n * sizeof(uint32_t));
+    if (!work) {
+        assembler_report(gen->as, "Error: Out of memory\n");
+        ok = false;
+        goto done;
+    }
+    size_t work_count = layout.count;
+    for (size_t k = 0; k < work_count; k++) work[k] = (uint32_t)k;
+
+    int passes = 0;
+    bool changed = true;
+    while (changed) {
+        passes++;
+        changed = false;
+        size_t kept = 0;
+        for (size_t w = 0; w < work_count; w++) {
+            uint32_t rank = work[w];
+            size_t i = layout.entries[rank];
+            uint32_t at = layout.base[rank] + growth_before(&layout, rank);
+            unsigned size = entry_size(gen, i, at, label_address(gen, &layout, program->imm[i]));
+            if (size > gen->sizes[i]) {
+                growth_add(&layout, rank, size - gen->sizes[i]);
+                gen->sizes[i] = (uint8_t)size;
+                changed = true;
+            }
+            if (gen->sizes[i] < max_size(gen, i)) work[kept++] = rank;
+        }
+        work_count = kept;
+    }
+    mem_free(work);
+
+    // Final label addresses, for expand(), and the image size
+    for (size_t i = 0; i < program->count; i++) {
+        if (program->op[i] == INST_LABEL) gen->labels[program->imm[i]] = UNPLACED;
+    }
+    address = 0;
+    for (size_t i = 0; i < program->count; i++) {
+        int32_t id = program->imm[i];
+        if (program->op[i] == INST_LABEL && gen->labels[id] == UNPLACED) gen->labels[id] = address;
+        address += gen->sizes[i];
+    }
+    *words = address;
+
+    for (size_t k = 0; k < layout.count; k++) {
+        size_t i = layout.entries[k];
+        uint8_t op = program->op[i];
+        if ((op == INST_BEQ || op == INST_BNE || op == INST_BLT) && gen->sizes[i] > 1) {
+            stats->relaxed_branches++;
+            stats->relaxed_words += gen->sizes[i] - 1;
+        }
+    }
+    TRACE(TRACE_CODEGEN, TRACE_INFO,
+          "codegen: %zu variable-size entries laid out in %d passes, %llu branches relaxed\n",
+          layout.count, passes, (unsigned long long)stats->relaxed_branches);
+    if (!gen->reference) note_long_jumps(gen, layout.entries, layout.count);
+
+done:
+    mem_free(layout.entries);
+    mem_free(layout.base);
+    mem_free(layout.growth);
+    mem_free(layout.label_rank);
+    return ok;
+}
+
+// Emits the variable-size IR entry index in exactly its laid out number of
+// words
+static bool expand(CodeGen* gen, size_t index) {
+    const Program* program = gen->program;
+    unsigned size = gen->sizes[index];
+    int32_t symbol = program->imm[index];
+    uint8_t op = program->op[index];
+    uint8_t rs = IR_REG(program->regs[index], 0);
+    uint32_t target = gen->labels[symbol];
+
+    if (op == INST_LA) {
+        if (!emit_word(gen, index, INST_LLI, OP_LABEL_LO, rs, symbol)) return false;
+        return size == 1 || emit_word(gen, index, INST_LHI, OP_LABEL_HI, rs, symbol);
+    }
+
+    // Too short for a long jump means the label is in branch range; a branch
+    // the layout gave more room than it needs now is padded with nops
+    unsigned overhead = jump_overhead(op);
+    if (op != INST_CALL && size < overhead + load_size(gen, target)) {
+        uint8_t branch = op == INST_J ? INST_BEQ : op;
+        uint16_t regs = op == INST_J ? 0 : rs;
+        if (!emit_word(gen, index, branch, OP_LABEL, regs, symbol)) return false;
+        for (unsigned k = 1; k < size; k++) {
+            if (!emit_word(gen, index, INST_ADD, OP_NONE, PACK_REGS(0, 0, 0), 0)) return false;
+        }
+        return true;
+    }
+
+    // The long jump: skip it unless the condition holds, then load r6 and go
+    bool ok = true;
+    if (op == INST_BEQ || op == INST_BNE) {
+        uint8_t inverse = op == INST_BEQ ? INST_BNE : INST_BEQ;
+        ok = emit_word(gen, index, inverse, OP_IMMEDIATE, rs, (int32_t)size);
+    } else if (op == INST_BLT) {
+        ok = emit_word(gen, index, INST_BLT, OP_IMMEDIATE, rs, 2) &&
+             emit_word(gen, index, INST_BEQ, OP_IMMEDIATE, 0, (int32_t)size - 1);
+    }
+    unsigned load = size - overhead;
+    uint8_t link = op == INST_CALL ? REG_LINK : 0;
+    return ok &&
+           emit_word(gen, index, INST_LLI, OP_LABEL_LO, REG_TEMP, symbol) &&
+           (load == 1 || emit_word(gen, index, INST_LHI, OP_LABEL_HI, REG_TEMP, symbol)) &&
+           emit_word(gen, index, INST_JALR, OP_NONE, PACK_REGS(link, REG_TEMP, 0), 0);
+}
+
+// Runs the pass and patches what can be patched. For a relocatable object
+// the fixups left unresolved are kept, compacted, at the front of
+// gen->fixups with gen->fixup_count updated. Returns false on error.
+static bool emit_program(CodeGen* gen) {
+    Assembler* as = gen->as;
+    const Program* program = gen->program;
+
+    for (size_t i = 0; i < program->count; i++) {
+        if (gen->addresses) gen->addresses[i] = (uint32_t)gen->code_size;
+        if (program->op[i] == INST_LABEL) {
+            // BEAG uses word-addressable memory (16-bit words), so a label's
+            // value is the number of words emitted before it
+            if (!symbol_table_define(&as->symbols, program->imm[i], (uint16_t)gen->code_size)) {
+                assembler_report(as, "Error: Symbol '%s' redefined\n",
+                                 symbol_table_entry(&as->symbols, program->imm[i])->name);
             }
+            continue;
+        }
+
+        // Variable-size entries other than in-range branches are expanded
+        uint8_t op = program->op[i];
+        bool ok = op >= INST_LA || (gen->sizes && gen->sizes[i] > 1)
+            ? expand(gen, i)
+            : emit_word(gen, i, op, program->kind[i], program->regs[i], program->imm[i]);
+        if (!ok) {
+            gen->failed = true;
+            break;
+        }
+    }
+
+    if (gen->addresses) gen->addresses[program->count] = (uint32_t)gen->code_size;
+
+    // Patch forward references now that every label has an address
+    bool emitted = !gen->failed;
+    size_t forward = gen->fixup_count;
+    size_t kept = 0;
+    for (size_t i = 0; emitted && i < gen->fixup_count; i++) {
+        const Fixup* fixup = &gen->fixups[i];
+        const SymbolEntry* symbol = symbol_table_entry(&as->symbols, fixup->symbol_id);
+        if (gen->relocatable && (!symbol->is_defined || fixup->kind != FIXUP_BRANCH8)) {
+            gen->fixups[kept++] = *fixup;
+            continue;
+        }
+        if (!symbol->is_defined) {
+            // The words of a pseudo-instruction or long jump share a label
+            if (i > 0 && fixup->index == fixup[-1].index) continue;
+            char message[256];
+            snprintf(message, sizeof(message), "Undefined label '%.200s'", symbol->name);
+            report_at(gen, fixup->index, message);
+            gen->failed = true;
+            continue;
+        }
+
+        uint16_t bits;
+        if (!resolve_reference(gen, fixup->kind, fixup->address, symbol->value, fixup->index,
+                               &bits)) {
+            gen->failed = true;
+            continue;
+        }
+        gen->code[fixup->address] |= bits;
+        TRACE(TRACE_CODEGEN, TRACE_VERBOSE, "codegen: patched %s at 0x%04X\n",
+              symbol->name, fixup->address);
+    }
+    if (gen->relocatable) gen->fixup_count = kept;
+
+    TRACE(TRACE_CODEGEN, TRACE_INFO, "codegen: %zu words, %zu forward references\n",
+          gen->code_size, forward);
+    return !gen->failed && !gen->out_of_range;
+}
+
+static bool allocate_code(CodeGen* gen, size_t words) {
+    mem_free(gen->code);
+    gen->code = mem_alloc((words ? words : 1) * sizeof(uint16_t));
+    if (!gen->code) assembler_report(gen->as, "Error: Out of memory\n");
+    return gen->code != NULL;
+}
+
+// Generates code for the program. Without pseudo-instructions the first
+// pass assumes every branch reaches its label, so most programs never pay
+// for a layout. If some branch does not, and nothing else went wrong, the
+// labels are forgotten and the program is laid out and emitted again,
+// relaxing just those branches.
+static bool generate(CodeGen* gen) {
+    Assembler* as = gen->as;
+    const Program* program = gen->program;
+    int errors = as->diagnostics.count;
 
-            default:
-                fprintf(stderr, "Error: Unknown instruction type at line %d\n", inst->line);
-                free(machine_code);
-                return NULL;
+    // Each non-label entry is one 16-bit word unless the layout says
+    // otherwise, so this bounds the image size
+    size_t words = program->count;
+    bool ok = (!program->pseudo_count || lay_out(gen, &words)) &&
+              allocate_code(gen, words) && emit_program(gen);
+
+    if (gen->out_of_range && !gen->failed && as->diagnostics.count == errors) {
+        TRACE(TRACE_CODEGEN, TRACE_INFO, "codegen: branches out of range, relaxing\n");
+        for (size_t i = 0; i < program->count; i++) {
+            if (program->op[i] != INST_LABEL) continue;
+            as->symbols.entries[program->imm[i]].is_defined = false;
         }
+        gen->code_size = 0;
+        gen->fixup_count = 0;
+        gen->out_of_range = false;
+        ok = lay_out(gen, &words) && allocate_code(gen, words) && emit_program(gen);
+    }
+
+    if (TRACE_ENABLED(TRACE_SYMBOLS, TRACE_DEBUG)) debug_print_symbol_table(&as->symbols);
+    return ok;
+}
+
+// Generates an image. If addresses is not NULL it receives the address of
+// every IR entry, and the image size at program->count.
+static uint16_t* generate_image(Assembler* as, const Program* program, size_t* size,
+                                uint32_t* addresses, bool reference) {
+    if (!program || !size) return NULL;
+
+    CodeGen gen = { 0 };
+    gen.as = as;
+    gen.program = program;
+    gen.addresses = addresses;
+    gen.reference = reference;
+    bool ok = generate(&gen);
+    mem_free(gen.fixups);
+    mem_free(gen.sizes);
+    mem_free(gen.labels);
+    if (!ok) {
+        mem_free(gen.code);
+        return NULL;
+    }
+
+    *size = gen.code_size;
+    return gen.code;
+}
+
+// Generates an image that is only measured, not written: as
+// generate_image(), without the notes on long jumps the output will repeat
+uint16_t* codegen_generate_at(Assembler* as, const Program* program, size_t* size,
+                              uint32_t* addresses) {
+    return generate_image(as, program, size, addresses, true);
+}
+
+// Generates an image; with the map or cost option set, as->map describes it
+uint16_t* codegen_generate(Assembler* as, const Program* program, size_t* size) {
+    if (!program || !(as->options.map || as->options.cost)) {
+        return generate_image(as, program, size, NULL, false);
+    }
 
-        // Store instruction in memory
-        // Each instruction takes exactly one 16-bit word
-        machine_code[current_address] = instruction;
-        current_address++;
+    uint32_t* addresses = mem_alloc((program->count + 1) * sizeof(uint32_t));
+    if (!addresses) {
+        assembler_report(as, "Error: Out of memory\n");
+        return NULL;
+    }
+    uint16_t* code = generate_image(as, program, size, addresses, false);
+    if (code && !map_build(as, program, addresses, &as->map)) {
+        mem_free(code);
+        code = NULL;
+    }
+    mem_free(addresses);
+    return code;
+}
+
+// Generates a relocatable object: one .text section, a relocation per
+// reference left for the linker, and the symbols that are defined, global
+// or relocated against. Names that only ever named macros or macro
+// parameters are left out. Undefined symbols are imported, so they are
+// global.
+bool codegen_generate_object(Assembler* as, const Program* program, ObjectFile* object) {
+    static const char section_name[] = ".text";
+
+    CodeGen gen = { 0 };
+    gen.as = as;
+    gen.program = program;
+    gen.relocatable = true;
+    bool ok = generate(&gen);
+
+    // Map symbol IDs to object symbol indices; 0 means not emitted
+    const SymbolTable* symbols = &as->symbols;
+    uint32_t* index = ok ? mem_calloc((size_t)symbols->count + 1, sizeof(uint32_t)) : NULL;
+    if (ok && !index) {
+        assembler_report(as, "Error: Out of memory\n");
+        ok = false;
+    }
+    size_t symbol_count = 0;
+    size_t strings = sizeof(section_name);
+    for (size_t i = 0; ok && i < gen.fixup_count; i++) index[gen.fixups[i].symbol_id] = 1;
+    for (int i = 0; ok && i < symbols->count; i++) {
+        const SymbolEntry* entry = &symbols->entries[i];
+        if (!index[i] && !entry->is_defined && !entry->is_global) continue;
+        index[i] = (uint32_t)++symbol_count;
+        strings += entry->length + 1;
+    }
+
+    if (ok && !object_init(object, 1, symbol_count, gen.fixup_count, strings, gen.code_size)) {
+        assembler_report(as, "Error: Out of memory\n");
+        ok = false;
+    }
+    if (ok) {
+        char* names = object->strings;
+        memcpy(names, section_name, sizeof(section_name));
+        size_t used = sizeof(section_name);
+        object->sections[0].name = 0;
+        object->sections[0].size = (uint32_t)gen.code_size;
+        memcpy(object->words, gen.code, gen.code_size * sizeof(uint16_t));
+
+        for (int i = 0; i < symbols->count; i++) {
+            if (!index[i]) continue;
+            const SymbolEntry* entry = &symbols->entries[i];
+            ObjSymbol* symbol = &object->symbols[index[i] - 1];
+            symbol->name = (uint32_t)used;
+            symbol->section = entry->is_defined ? 0 : -1;
+            symbol->value = entry->value;
+            symbol->binding = entry->is_global || !entry->is_defined ? OBJ_GLOBAL : OBJ_LOCAL;
+            memcpy(names + used, entry->name, entry->length + 1);
+            used += entry->length + 1;
+        }
+
+        for (size_t i = 0; i < gen.fixup_count; i++) {
+            ObjReloc* reloc = &object->relocs[i];
+            reloc->section = 0;
+            reloc->offset = gen.fixups[i].address;
+            reloc->symbol = index[gen.fixups[i].symbol_id] - 1;
+            reloc->kind = gen.fixups[i].kind;
+        }
+        TRACE(TRACE_CODEGEN, TRACE_INFO, "codegen: %zu symbols, %zu relocations\n",
+              symbol_count, gen.fixup_count);
     }
 
-    *size = instruction_count;
-    return machine_code;
-} 
\ No newline at end of file
+    mem_free(index);
+    mem_free(gen.fixups);
+    mem_free(gen.sizes);
+    mem_free(gen.labels);
+    mem_free(gen.code);
+    return ok;
+}
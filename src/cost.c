@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+// Static cost analysis of an image (--cost). The code is decoded from the
+// image itself, so long jumps and padding are costed as they were emitted;
+// the map supplies the labels and says which words are data.
+//
+// Basic blocks start at address 0, at labels, at branch and jump targets
+// and after every beq/bne/blt/jalr. A jalr target is known when the block
+// loads its registers with lli/lhi (j, call and long branches do), so
+// calls are found statically; jalr through the link register is a return.
+// Functions are address 0 and every call target, each owning the blocks
+// it reaches without a call; code no function reaches starts a function of
+// its own. Loops are the natural loops of back edges found by a depth-first
+// walk of each function.
+//
+// Cycles are summed over the instructions of a block from a latency table
+// per opcode. A loop's cycles are one pass over every block in it, so for
+// loops with branches inside they are an upper bound on one iteration.
+
+// Cycles per instruction unless a latency table overrides them: memory and
+// jumps take two, multiply and divide are iterative
+static const uint16_t default_latencies[INST_WORD] = {
+    [INST_ADD] = 1, [INST_SUB] = 1, [INST_MUL] = 4, [INST_DIV] = 16,
+    [INST_JALR] = 2, [INST_SW] = 2, [INST_LW] = 2, [INST_LHI] = 1,
+    [INST_LLI] = 1, [INST_BNE] = 1, [INST_BEQ] = 1, [INST_BLT] = 1,
+};
+
+typedef struct {
+    uint8_t op;             // InstructionType, INST_WORD if undefined
+    uint8_t reg[3];         // Register operands in assembly order
+    int16_t imm;            // Sign-extended immediate or branch offset
+} CostInsn;
+
+static void decode(const uint8_t* opcodes, uint16_t word, CostInsn* insn) {
+    memset(insn, 0, sizeof(*insn));
+    insn->op = opcodes[word >> 12];
+    if (insn->op == INST_WORD) return;
+    const IsaFormat* format = &isa_formats[insn->op];
+    int reg = 0;
+    for (int k = 0; k < format->operand_count; k++) {
+        const IsaField* field = &format->operands[k];
+        uint16_t value = (uint16_t)((word >> field->shift) & field->mask);
+        if (field->kind == ISA_REG) {
+            insn->reg[reg++] = (uint8_t)value;
+        } else {
+            insn->imm = (int16_t)(int8_t)value;
+        }
+    }
+}
+
+static bool is_branch(uint8_t op) {
+    return op == INST_BEQ || op == INST_BNE || op == INST_BLT;
+}
+
+static bool ends_block(uint8_t op) {
+    return is_branch(op) || op == INST_JALR || op == INST_WORD;
+}
+
+// Registers known to hold a constant, tracked through the lli/lhi loads
+// and register moves of straight-line code
+typedef struct {
+    bool known[8];
+    uint16_t value[8];
+} Constants;
+
+static void forget(Constants* constants) {
+    memset(constants, 0, sizeof(*constants));
+    constants->known[0] = true;
+}
+
+static void track(Constants* constants, const CostInsn* insn, uint16_t address) {
+    uint8_t rd = insn->reg[0], a = insn->reg[1], b = insn->reg[2];
+    bool sources = constants->known[a] && constants->known[b];
+    switch (insn->op) {
+        case INST_LLI:
+            constants->value[rd] = (uint16_t)insn->imm;
+            constants->known[rd] = true;
+            break;
+        case INST_LHI:
+            constants->value[rd] = (uint16_t)((uint16_t)insn->imm << 8 | (constants->value[rd] & 0xFF));
+            break;
+        case INST_ADD:
+        case INST_SUB:
+            constants->value[rd] = insn->op == INST_ADD
+                ? (uint16_t)(constants->value[a] + constants->value[b])
+                : (uint16_t)(constants->value[a] - constants->value[b]);
+            constants->known[rd] = sources;
+            break;
+        case INST_JALR:
+            constants->value[rd] = (uint16_t)(address + 1);
+            constants->known[rd] = true;
+            break;
+        case INST_MUL:
+        case INST_DIV:
+        case INST_LW:
+            constants->known[rd] = false;
+            break;
+        default:
+            break;
+    }
+    constants->known[0] = true;
+    constants->value[0] = 0;
+}
+
+// Working state of one analysis
+typedef struct {
+    CostAnalysis* cost;
+    size_t size;
+    CostInsn* insns;        // Per word
+    uint8_t* code;          // Per word: not data
+    uint8_t* leader;        // Per word: starts a block
+    uint32_t* jump;         // Per word: known jalr target, or COST_NONE
+    uint32_t* block_at;     // Per word: block starting there, or COST_NONE
+} Analysis;
+
+static uint32_t block_of(const Analysis* an, uint32_t address) {
+    return address < an->size ? an->block_at[address] : COST_NONE;
+}
+
+// Marks where blocks start. Jump targets need the constants of the block
+// the jalr is in, so they are found in a second pass over the blocks the
+// first one delimits.
+static void find_leaders(Analysis* an, const ImageMap* map) {
+    for (size_t i = 0; i < map->label_count; i++) {
+        if (map->labels[i].address < an->size) an->leader[map->labels[i].address] = 1;
+    }
+    for (uint32_t address = 0; address < an->size; address++) {
+        if (!an->code[address]) continue;
+        if (address == 0 || !an->code[address - 1]) an->leader[address] = 1;
+        const CostInsn* insn = &an->insns[address];
+        if (ends_block(insn->op) && address + 1 < an->size) an->leader[address + 1] = 1;
+        uint16_t target = (uint16_t)(address + insn->imm);
+        if (is_branch(insn->op) && insn->imm != 0 && target < an->size) an->leader[target] = 1;
+    }
+
+    Constants constants;
+    forget(&constants);
+    for (uint32_t address = 0; address < an->size; address++) {
+        if (an->leader[address]) forget(&constants);
+        const CostInsn* insn = &an->insns[address];
+        if (an->code[address] && insn->op == INST_JALR) {
+            uint8_t a = insn->reg[1], b = insn->reg[2];
+            if (constants.known[a] && constants.known[b]) {
+                uint16_t target = (uint16_t)(constants.value[a] + constants.value[b]);
+                an->jump[address] = target;
+                if (target < an->size && target != address) an->leader[target] = 1;
+            }
+        }
+        track(&constants, insn, (uint16_t)address);
+    }
+}
+
+// Fills in where a block whose last word is at address goes
+static void set_exit(Analysis* an, CostBlock* block, uint32_t address) {
+    const CostInsn* insn = &an->insns[address];
+    uint32_t fall = address + 1;
+    uint16_t target = (uint16_t)(address + insn->imm);
+    block->exit = COST_NEXT;
+    block->next[0] = block->next[1] = block->callee = COST_NONE;
+    if (!ends_block(insn->op)) {
+        block->next[0] = fall;
+    } else if (insn->op == INST_WORD) {
+        block->exit = COST_ILLEGAL;
+    } else if (is_branch(insn->op)) {
+        // r0 is zero: beq r0 always branches, bne r0 and blt r0 never do
+        bool always = insn->op == INST_BEQ && insn->reg[0] == 0;
+        bool never = insn->op != INST_BEQ && insn->reg[0] == 0;
+        if (always && insn->imm == 0) {
+            block->exit = COST_HALT;
+        } else if (always) {
+            block->next[0] = target;
+        } else {
+            block->next[0] = fall;
+            if (!never && insn->imm != 0) block->next[1] = target;
+        }
+    } else if (an->jump[address] == address) {
+        block->exit = COST_HALT;
+    } else if (insn->reg[0] != 0) {
+        block->exit = COST_CALL;
+        block->callee = an->jump[address];
+        block->next[0] = fall;
+    } else if (an->jump[address] != COST_NONE) {
+        block->next[0] = an->jump[address];
+    } else {
+        bool link = insn->reg[1] == REG_LINK && insn->reg[2] == 0;
+        block->exit = link ? COST_RETURN : COST_INDIRECT;
+    }
+}
+
+static bool build_blocks(Analysis* an) {
+    CostAnalysis* cost = an->cost;
+    size_t count = 0;
+    for (uint32_t address = 0; address < an->size; address++) {
+        count += an->code[address] && an->leader[address];
+    }
+    cost->blocks = mem_calloc(count ? count : 1, sizeof(CostBlock));
+    if (!cost->blocks) return false;
+
+    for (uint32_t address = 0; address < an->size; address++) {
+        if (!an->code[address] || !an->leader[address]) continue;
+        CostBlock* block = &cost->blocks[cost->block_count];
+        an->block_at[address] = (uint32_t)cost->block_count++;
+        block->address = (uint16_t)address;
+        block->function = COST_NONE;
+        uint32_t last = address;
+        while (true) {
+            const CostInsn* insn = &an->insns[last];
+            block->size++;
+            if (insn->op != INST_WORD) block->cycles += cost->latencies[insn->op];
+            if (ends_block(insn->op) || last + 1 >= an->size || !an->code[last + 1] ||
+                an->leader[last + 1]) {
+                break;
+            }
+            last++;
+        }
+        set_exit(an, block, last);
+    }
+    return true;
+}
+
+// Gives function the blocks reachable from its entry without entering
+// another function
+static void flood(Analysis* an, uint32_t entry, uint32_t function, const uint8_t* is_entry,
+                  uint32_t* stack) {
+    CostBlock* blocks = an->cost->blocks;
+    size_t depth = 0;
+    blocks[entry].function = function;
+    stack[depth++] = entry;
+    while (depth > 0) {
+        const CostBlock* block = &blocks[stack[--depth]];
+        for (int k = 0; k < 2; k++) {
+            uint32_t next = block_of(an, block->next[k]);
+            if (next == COST_NONE || is_entry[next] || blocks[next].function != COST_NONE) continue;
+            blocks[next].function = function;
+            stack[depth++] = next;
+        }
+    }
+}
+
+static bool add_function(CostAnalysis* cost, size_t* capacity, uint32_t entry) {
+    if (cost->function_count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 16;
+        CostFunction* functions = mem_realloc(cost->functions, grown * sizeof(CostFunction));
+        if (!functions) return false;
+        cost->functions = functions;
+        *capacity = grown;
+    }
+    memset(&cost->functions[cost->function_count], 0, sizeof(CostFunction));
+    cost->functions[cost->function_count++].entry = entry;
+    return true;
+}
+
+// Splits the blocks into functions: call targets and address 0 first, then
+// whatever is left, each unreached block starting a function in address
+// order. Functions are then numbered in address order.
+static bool find_functions(Analysis* an) {
+    CostAnalysis* cost = an->cost;
+    size_t count = cost->block_count;
+    uint8_t* is_entry = mem_calloc(count ? count : 1, 1);
+    uint32_t* stack = mem_alloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t* number = mem_alloc((count ? count : 1) * sizeof(uint32_t));
+    bool ok = is_entry && stack && number;
+    size_t capacity = 0;
+
+    for (size_t i = 0; ok && i < count; i++) {
+        uint32_t callee = block_of(an, cost->blocks[i].callee);
+        if (callee != COST_NONE) is_entry[callee] = 1;
+    }
+    if (ok && count > 0 && cost->blocks[0].address == 0) is_entry[0] = 1;
+    for (uint32_t i = 0; ok && i < count; i++) {
+        if (!is_entry[i]) continue;
+        ok = add_function(cost, &capacity, i);
+        if (ok) flood(an, i, (uint32_t)cost->function_count - 1, is_entry, stack);
+    }
+    for (uint32_t i = 0; ok && i < count; i++) {
+        if (cost->blocks[i].function != COST_NONE) continue;
+        is_entry[i] = 1;
+        ok = add_function(cost, &capacity, i);
+        if (ok) flood(an, i, (uint32_t)cost->function_count - 1, is_entry, stack);
+    }
+
+    if (ok) {
+        // An entry is owned by its own function
+        uint32_t rank = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (!is_entry[i]) continue;
+            number[cost->blocks[i].function] = rank;
+            cost->functions[rank++].entry = i;
+        }
+        for (size_t i = 0; i < count; i++) {
+            CostBlock* block = &cost->blocks[i];
+            block->function = number[block->function];
+            CostFunction* function = &cost->functions[block->function];
+            function->blocks++;
+            function->instructions += block->size;
+            function->cycles += block->cycles;
+        }
+    }
+    mem_free(is_entry);
+    mem_free(stack);
+    mem_free(number);
+    return ok;
+}
+
+// Successor k of block i if it is a block of the same function
+static uint32_t local_next(const Analysis* an, uint32_t i, int k) {
+    const CostBlock* block = &an->cost->blocks[i];
+    uint32_t next = block_of(an, block->next[k]);
+    return next != COST_NONE && an->cost->blocks[next].function == block->function ? next
+                                                                                     : COST_NONE;
+}
+
+typedef struct {
+    uint32_t header;
+    uint32_t latch;
+} BackEdge;
+
+static int compare_edges(const void* a, const void* b) {
+    const BackEdge* x = a;
+    const BackEdge* y = b;
+    if (x->header != y->header) return x->header < y->header ? -1 : 1;
+    return x->latch < y->latch ? -1 : x->latch > y->latch;
+}
+
+// Finds the back edges of every function, then the blocks of each loop by
+// walking backwards from its latches to its header
+static bool find_loops(Analysis* an) {
+    CostAnalysis* cost = an->cost;
+    size_t count = cost->block_count;
+    size_t slots = count ? count : 1;
+    uint8_t* state = mem_calloc(slots, 1);           // 1 on the walk, 2 done
+    uint32_t* stack = mem_alloc(slots * sizeof(uint32_t));
+    uint8_t* edge = mem_alloc(slots);                // Next successor to try
+    uint32_t* pred_start = mem_calloc(count + 1, sizeof(uint32_t));
+    uint32_t* preds = mem_alloc(2 * slots * sizeof(uint32_t));
+    uint32_t* mark = mem_alloc(slots * sizeof(uint32_t));
+    BackEdge* edges = NULL;
+    size_t edge_count = 0, edge_capacity = 0, loop_capacity = 0;
+    bool ok = state && stack && edge && pred_start && preds && mark;
+
+    // Predecessors within the function, as a compressed table; mark is the
+    // fill position of each block's list until the loops use it
+    for (uint32_t i = 0; ok && i < count; i++) {
+        for (int k = 0; k < 2; k++) {
+            uint32_t next = local_next(an, i, k);
+            if (next != COST_NONE) pred_start[next + 1]++;
+        }
+    }
+    for (size_t i = 0; ok && i < count; i++) {
+        pred_start[i + 1] += pred_start[i];
+        mark[i] = pred_start[i];
+    }
+    for (uint32_t i = 0; ok && i < count; i++) {
+        for (int k = 0; k < 2; k++) {
+            uint32_t next = local_next(an, i, k);
+            if (next != COST_NONE) preds[mark[next]++] = i;
+        }
+    }
+
+    // Back edges: to a block still on the depth-first walk
+    for (size_t f = 0; ok && f < cost->function_count; f++) {
+        size_t depth = 0;
+        uint32_t entry = cost->functions[f].entry;
+        state[entry] = 1;
+        edge[entry] = 0;
+        stack[depth++] = entry;
+        while (ok && depth > 0) {
+            uint32_t i = stack[depth - 1];
+            if (edge[i] == 2) {
+                state[i] = 2;
+                depth--;
+                continue;
+            }
+            uint32_t next = local_next(an, i, edge[i]++);
+            if (next == COST_NONE || state[next] == 2) continue;
+            if (state[next] == 1) {
+                if (edge_count == edge_capacity) {
+                    edge_capacity = edge_capacity ? edge_capacity * 2 : 16;
+                    BackEdge* grown = mem_realloc(edges, edge_capacity * sizeof(BackEdge));
+                    if (!grown) {
+                        ok = false;
+                        break;
+                    }
+                    edges = grown;
+                }
+                edges[edge_count].header = next;
+                edges[edge_count++].latch = i;
+                continue;
+            }
+            state[next] = 1;
+            edge[next] = 0;
+            stack[depth++] = next;
+        }
+    }
+    if (ok && edge_count > 0) qsort(edges, edge_count, sizeof(BackEdge), compare_edges);
+
+    // One loop per header, over all of its back edges. Headers are in
+    // address order, and so by function.
+    for (size_t i = 0; ok && i < count; i++) mark[i] = COST_NONE;
+    for (size_t e = 0; ok && e < edge_count;) {
+        uint32_t header = edges[e].header;
+        uint32_t id = (uint32_t)cost->loop_count;
+        if (cost->loop_count == loop_capacity) {
+            loop_capacity = loop_capacity ? loop_capacity * 2 : 16;
+            CostLoop* grown = mem_realloc(cost->loops, loop_capacity * sizeof(CostLoop));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            cost->loops = grown;
+        }
+        CostLoop* loop = &cost->loops[cost->loop_count++];
+        memset(loop, 0, sizeof(*loop));
+        loop->header = header;
+        loop->function = cost->blocks[header].function;
+
+        size_t depth = 0;
+        mark[header] = id;
+        stack[depth++] = header;
+        for (; e < edge_count && edges[e].header == header; e++) {
+            uint32_t latch = edges[e].latch;
+            if (mark[latch] == id) continue;
+            mark[latch] = id;
+            stack[depth++] = latch;
+        }
+        // The stack doubles as the list of the loop's blocks
+        for (size_t k = 1; k < depth; k++) {
+            uint32_t block = stack[k];
+            for (uint32_t p = pred_start[block]; p < pred_start[block + 1]; p++) {
+                if (mark[preds[p]] == id) continue;
+                mark[preds[p]] = id;
+                stack[depth++] = preds[p];
+            }
+        }
+        for (size_t k = 0; k < depth; k++) {
+            CostBlock* block = &cost->blocks[stack[k]];
+            block->depth++;
+            loop->blocks++;
+            loop->instructions += block->size;
+            loop->cycles += block->cycles;
+        }
+        cost->functions[loop->function].loops++;
+    }
+    for (size_t l = 0; ok && l < cost->loop_count; l++) {
+        cost->loops[l].depth = cost->blocks[cost->loops[l].header].depth;
+    }
+
+    mem_free(state);
+    mem_free(stack);
+    mem_free(edge);
+    mem_free(pred_start);
+    mem_free(preds);
+    mem_free(mark);
+    mem_free(edges);
+    return ok;
+}
+
+// Lists the blocks by function, in address order within each
+static bool order_blocks(CostAnalysis* cost) {
+    size_t count = cost->block_count;
+    uint32_t* start = mem_calloc(cost->function_count + 1, sizeof(uint32_t));
+    cost->order = mem_alloc((count ? count : 1) * sizeof(uint32_t));
+    if (!start || !cost->order) {
+        mem_free(start);
+        return false;
+    }
+    for (size_t f = 0; f < cost->function_count; f++) {
+        start[f + 1] = start[f] + cost->functions[f].blocks;
+    }
+    for (uint32_t i = 0; i < count; i++) cost->order[start[cost->blocks[i].function]++] = i;
+    mem_free(start);
+    return true;
+}
+
+// Analyzes the image code of size words described by map into cost
+bool cost_analyze(Assembler* as, const uint16_t* code, size_t size, const ImageMap* map,
+                  CostAnalysis* cost) {
+    cost_free(cost);
+    memcpy(cost->latencies, as->options.latencies ? as->options.latencies : default_latencies,
+           sizeof(cost->latencies));
+
+    Analysis an = { cost, size, NULL, NULL, NULL, NULL, NULL };
+    size_t slots = size ? size : 1;
+    an.insns = mem_alloc(slots * sizeof(CostInsn));
+    an.code = mem_alloc(slots);
+    an.leader = mem_calloc(slots, 1);
+    an.jump = mem_alloc(slots * sizeof(uint32_t));
+    an.block_at = mem_alloc(slots * sizeof(uint32_t));
+    bool ok = an.insns && an.code && an.leader && an.jump && an.block_at;
+    if (ok) {
+        uint8_t opcodes[16];
+        memset(opcodes, INST_WORD, sizeof(opcodes));
+        for (int op = INST_ADD; op < INST_WORD; op++) {
+            if (isa_formats[op].mnemonic) opcodes[isa_formats[op].opcode_bits >> 12] = (uint8_t)op;
+        }
+        memset(an.code, 1, size);
+        for (size_t i = 0; i < map->data_count; i++) {
+            const MapRange* data = &map->data[i];
+            if (data->address < size) {
+                memset(an.code + data->address, 0,
+                       data->address + data->size <= size ? data->size : size - data->address);
+            }
+        }
+        for (uint32_t address = 0; address < size; address++) {
+            decode(opcodes, code[address], &an.insns[address]);
+            an.jump[address] = an.block_at[address] = COST_NONE;
+        }
+        find_leaders(&an, map);
+        ok = build_blocks(&an) && find_functions(&an) && find_loops(&an) && order_blocks(cost);
+    }
+    mem_free(an.insns);
+    mem_free(an.code);
+    mem_free(an.leader);
+    mem_free(an.jump);
+    mem_free(an.block_at);
+    if (!ok) {
+        assembler_report(as, "Error: Out of memory\n");
+        cost_free(cost);
+    }
+    return ok;
+}
+
+// Writes the name of an address: its label, the label before it with an
+// offset, or the bare address
+static void print_name(FILE* out, const ImageMap* map, uint32_t address) {
+    const MapLabel* label = address < map->size ? map_label_at(map, (uint16_t)address) : NULL;
+    if (!label) {
+        fprintf(out, "0x%04X", address);
+    } else if (label->address == address) {
+        fputs(label->name, out);
+    } else {
+        fprintf(out, "%s+%u", label->name, address - label->address);
+    }
+}
+
+static void print_exits(const CostBlock* block, const ImageMap* map, FILE* out, bool json) {
+    const char* quote = json ? "\"" : "";
+    static const char* names[] = {
+        [COST_RETURN] = "return", [COST_INDIRECT] = "indirect",
+        [COST_HALT] = "halt", [COST_ILLEGAL] = "illegal",
+    };
+    if (block->exit != COST_NEXT && block->exit != COST_CALL) {
+        fprintf(out, "%s%s%s", quote, names[block->exit], quote);
+        return;
+    }
+    const char* separator = "";
+    if (block->exit == COST_CALL) {
+        fprintf(out, "%scall ", quote);
+        if (block->callee == COST_NONE) {
+            fputc('?', out);
+        } else {
+            print_name(out, map, block->callee);
+        }
+        fputs(quote, out);
+        separator = ", ";
+    }
+    for (int k = 0; k < 2; k++) {
+        if (block->next[k] == COST_NONE) continue;
+        fprintf(out, "%s%s", separator, quote);
+        if (block->next[k] >= map->size) {
+            fputs("end", out);
+        } else {
+            print_name(out, map, block->next[k]);
+        }
+        fputs(quote, out);
+        separator = ", ";
+    }
+}
+
+static const char* plural(uint64_t count) {
+    return count == 1 ? "" : "s";
+}
+
+static void report_text(const CostAnalysis* cost, const ImageMap* map, FILE* out) {
+    uint64_t instructions = 0, cycles = 0;
+    for (size_t f = 0; f < cost->function_count; f++) {
+        instructions += cost->functions[f].instructions;
+        cycles += cost->functions[f].cycles;
+    }
+    fprintf(out, "Cost: %zu function%s, %zu block%s, %zu loop%s, %llu instructions, %llu cycles\n",
+            cost->function_count, plural(cost->function_count), cost->block_count,
+            plural(cost->block_count), cost->loop_count, plural(cost->loop_count),
+            (unsigned long long)instructions, (unsigned long long)cycles);
+    fprintf(out, "Latencies:");
+    for (int op = INST_ADD; op < INST_WORD; op++) {
+        if (!isa_formats[op].mnemonic) continue;
+        fprintf(out, "%s %s %u", op == INST_ADD ? "" : ",", isa_formats[op].mnemonic,
+                cost->latencies[op]);
+    }
+    fprintf(out, "\n");
+
+    size_t next_block = 0, next_loop = 0;
+    for (size_t f = 0; f < cost->function_count; f++) {
+        const CostFunction* function = &cost->functions[f];
+        uint16_t entry = cost->blocks[function->entry].address;
+        fprintf(out, "\nFunction ");
+        print_name(out, map, entry);
+        fprintf(out, " at 0x%04X: %u block%s, %llu instructions, %llu cycles, %u loop%s\n", entry,
+                function->blocks, plural(function->blocks),
+                (unsigned long long)function->instructions, (unsigned long long)function->cycles,
+                function->loops, plural(function->loops));
+        fprintf(out, "  address  instructions  cycles  depth  block -> exits\n");
+        for (uint32_t k = 0; k < function->blocks; k++) {
+            const CostBlock* block = &cost->blocks[cost->order[next_block++]];
+            fprintf(out, "   0x%04X  %12u  %6u  %5u  ", block->address, block->size, block->cycles,
+                    block->depth);
+            print_name(out, map, block->address);
+            fprintf(out, " -> ");
+            print_exits(block, map, out, false);
+            fprintf(out, "\n");
+        }
+        for (; next_loop < cost->loop_count && cost->loops[next_loop].function == f; next_loop++) {
+            const CostLoop* loop = &cost->loops[next_loop];
+            fprintf(out, "  Loop at ");
+            print_name(out, map, cost->blocks[loop->header].address);
+            fprintf(out, ": %u block%s, %llu instructions, %llu cycles per pass, depth %u\n",
+                    loop->blocks, plural(loop->blocks), (unsigned long long)loop->instructions,
+                    (unsigned long long)loop->cycles, loop->depth);
+        }
+    }
+}
+
+static void report_json(const CostAnalysis* cost, const ImageMap* map, FILE* out) {
+    uint64_t instructions = 0, cycles = 0;
+    for (size_t f = 0; f < cost->function_count; f++) {
+        instructions += cost->functions[f].instructions;
+        cycles += cost->functions[f].cycles;
+    }
+    fprintf(out, "{\n  \"latencies\": {");
+    for (int op = INST_ADD; op < INST_WORD; op++) {
+        if (!isa_formats[op].mnemonic) continue;
+        fprintf(out, "%s\"%s\": %u", op == INST_ADD ? "" : ", ", isa_formats[op].mnemonic,
+                cost->latencies[op]);
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "  \"instructions\": %llu,\n", (unsigned long long)instructions);
+    fprintf(out, "  \"cycles\": %llu,\n", (unsigned long long)cycles);
+    fprintf(out, "  \"functions\": [");
+
+    size_t next_block = 0, next_loop = 0;
+    for (size_t f = 0; f < cost->function_count; f++) {
+        const CostFunction* function = &cost->functions[f];
+        uint16_t entry = cost->blocks[function->entry].address;
+        fprintf(out, "%s\n    {\"name\": \"", f ? "," : "");
+        print_name(out, map, entry);
+        fprintf(out, "\", \"address\": %u, \"instructions\": %llu, \"cycles\": %llu,\n", entry,
+                (unsigned long long)function->instructions, (unsigned long long)function->cycles);
+        fprintf(out, "     \"blocks\": [");
+        for (uint32_t k = 0; k < function->blocks; k++) {
+            const CostBlock* block = &cost->blocks[cost->order[next_block++]];
+            fprintf(out, "%s\n       {\"name\": \"", k ? "," : "");
+            print_name(out, map, block->address);
+            fprintf(out, "\", \"address\": %u, \"instructions\": %u, \"cycles\": %u, "
+                    "\"depth\": %u, \"exits\": [", block->address, block->size, block->cycles,
+                    block->depth);
+            print_exits(block, map, out, true);
+            fprintf(out, "]}");
+        }
+        fprintf(out, "\n     ],\n     \"loops\": [");
+        for (bool first = true; next_loop < cost->loop_count && cost->loops[next_loop].function == f;
+             next_loop++, first = false) {
+            const CostLoop* loop = &cost->loops[next_loop];
+            uint16_t header = cost->blocks[loop->header].address;
+            fprintf(out, "%s\n       {\"header\": \"", first ? "" : ",");
+            print_name(out, map, header);
+            fprintf(out, "\", \"address\": %u, \"blocks\": %u, \"instructions\": %llu, "
+                    "\"cycles\": %llu, \"depth\": %u}", header, loop->blocks,
+                    (unsigned long long)loop->instructions, (unsigned long long)loop->cycles,
+                    loop->depth);
+        }
+        fprintf(out, "%s]}", function->loops ? "\n     " : "");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// Writes the report of an analysis, as text or JSON. map is the one the
+// analysis was made with.
+void cost_report(const CostAnalysis* cost, const ImageMap* map, FILE* out, bool json) {
+    if (json) {
+        report_json(cost, map, out);
+    } else {
+        report_text(cost, map, out);
+    }
+}
+
+// Reads a latency table: "mnemonic cycles" lines, with # comments. Opcodes
+// the table leaves out keep their default. Errors are reported on stderr.
+bool cost_read_latencies(const char* filename, uint16_t* latencies) {
+    memcpy(latencies, default_latencies, sizeof(default_latencies));
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open latency table '%s'\n", filename);
+        return false;
+    }
+
+    char* text = NULL;
+    size_t capacity = 0;
+    int line_number = 0;
+    bool ok = true;
+    while (ok && getline(&text, &capacity, file) >= 0) {
+        line_number++;
+        char* comment = strchr(text, '#');
+        if (comment) *comment = '\0';
+        char name[16];
+        unsigned cycles;
+        int offset = 0;
+        int fields = sscanf(text, "%15s %u %n", name, &cycles, &offset);
+        if (fields == EOF) continue;
+        int op = INST_ADD;
+        while (op < INST_WORD &&
+               !(isa_formats[op].mnemonic && strcmp(isa_formats[op].mnemonic, name) == 0)) {
+            op++;
+        }
+        ok = fields == 2 && !text[offset] && cycles <= UINT16_MAX && op < INST_WORD;
+        if (ok) latencies[op] = (uint16_t)cycles;
+    }
+    free(text);
+    fclose(file);
+    if (!ok) fprintf(stderr, "Error: Invalid latency table '%s' at line %d\n", filename, line_number);
+    return ok;
+}
+
+void cost_free(CostAnalysis* cost) {
+    mem_free(cost->blocks);
+    mem_free(cost->functions);
+    mem_free(cost->loops);
+    mem_free(cost->order);
+    memset(cost, 0, sizeof(*cost));
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+#define INITIAL_PROGRAM_CAPACITY 1024
+
+static bool program_grow(Program* program) {
+    size_t capacity = program->capacity ? program->capacity * 2 : INITIAL_PROGRAM_CAPACITY;
+
+    uint8_t* op = mem_realloc(program->op, capacity * sizeof(uint8_t));
+    if (!op) return false;
+    program->op = op;
+    uint8_t* kind = mem_realloc(program->kind, capacity * sizeof(uint8_t));
+    if (!kind) return false;
+    program->kind = kind;
+    uint16_t* regs = mem_realloc(program->regs, capacity * sizeof(uint16_t));
+    if (!regs) return false;
+    program->regs = regs;
+    int32_t* imm = mem_realloc(program->imm, capacity * sizeof(int32_t));
+    if (!imm) return false;
+    program->imm = imm;
+
+    program->capacity = capacity;
+    return true;
+}
+
+// Records the line of entry index if it differs from the previous entry's
+static bool program_note_line(Program* program, size_t index, int file, int line) {
+    if (program->line_count > 0 && program->lines[program->line_count - 1].line == line &&
+        program->lines[program->line_count - 1].file == (uint32_t)file) {
+        return true;
+    }
+    if (program->line_count == program->line_capacity) {
+        size_t capacity = program->line_capacity ? program->line_capacity * 2 : 256;
+        LineEntry* lines = mem_realloc(program->lines, capacity * sizeof(LineEntry));
+        if (!lines) return false;
+        program->lines = lines;
+        program->line_capacity = capacity;
+    }
+    program->lines[program->line_count].index = (uint32_t)index;
+    program->lines[program->line_count].file = (uint32_t)file;
+    program->lines[program->line_count].line = line;
+    program->line_count++;
+    return true;
+}
+
+void program_init(Program* program) {
+    memset(program, 0, sizeof(*program));
+}
+
+bool program_append(Program* program, uint8_t op, uint8_t kind, uint16_t regs, int32_t imm,
+                    int file, int line) {
+    if (program->count == program->capacity && !program_grow(program)) return false;
+
+    size_t index = program->count;
+    if (!program_note_line(program, index, file, line)) return false;
+
+    program->op[index] = op;
+    program->kind[index] = kind;
+    program->regs[index] = regs;
+    program->imm[index] = imm;
+    program->count++;
+    if (op >= INST_LA) program->pseudo_count++;
+    return true;
+}
+
+// Drops the entries flagged in removed, closing up the columns. A line
+// whose entries all went no longer appears in the line table.
+void program_remove(Program* program, const uint8_t* removed) {
+    size_t kept = 0;
+    size_t line = 0, lines_kept = 0;
+    for (size_t i = 0; i <= program->count; i++) {
+        // Lines starting here now start at the next kept entry
+        for (; line < program->line_count && program->lines[line].index == i; line++) {
+            if (lines_kept > 0 && program->lines[lines_kept - 1].index == kept) lines_kept--;
+            program->lines[lines_kept] = program->lines[line];
+            program->lines[lines_kept++].index = (uint32_t)kept;
+        }
+        if (i == program->count) break;
+        if (removed[i]) {
+            if (program->op[i] >= INST_LA) program->pseudo_count--;
+            continue;
+        }
+        program->op[kept] = program->op[i];
+        program->kind[kept] = program->kind[i];
+        program->regs[kept] = program->regs[i];
+        program->imm[kept] = program->imm[i];
+        kept++;
+    }
+    program->count = kept;
+    program->line_count = lines_kept;
+}
+
+// Whether the program may use a numeric address, which pins every word
+// where it is: a branch with a numeric offset, or a jalr, lw or sw through
+// a register that may hold a number rather than a label address. Registers
+// are tracked regardless of control flow, so a register counts as numeric
+// if any lli/lhi anywhere gives it a numeric value, directly or through
+// arithmetic. A numeric .word, or a numeric register stored to memory,
+// makes every lw numeric too (a jump table).
+bool program_numeric_addresses(const Program* program) {
+    bool numeric[8] = { false };
+    bool memory = false;
+    for (size_t i = 0; i < program->count; i++) {
+        uint8_t op = program->op[i];
+        if ((op == INST_BEQ || op == INST_BNE || op == INST_BLT || op == INST_WORD) &&
+            program->kind[i] == OP_IMMEDIATE) {
+            if (op != INST_WORD) return true;
+            memory = true;
+        }
+    }
+
+    // Spread numeric values until nothing changes; each pass adds at least
+    // one register or the memory, so there are at most ten
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < program->count; i++) {
+            uint8_t op = program->op[i];
+            uint16_t regs = program->regs[i];
+            uint8_t rd = IR_REG(regs, 0);
+            bool value;
+            switch (op) {
+                case INST_LLI:
+                case INST_LHI:
+                    value = program->kind[i] == OP_IMMEDIATE;
+                    break;
+                case INST_ADD:
+                case INST_SUB:
+                case INST_MUL:
+                case INST_DIV:
+                    value = numeric[IR_REG(regs, 1)] || numeric[IR_REG(regs, 2)];
+                    break;
+                case INST_LW:
+                    value = memory;
+                    break;
+                case INST_SW:
+                    if (numeric[rd] && !memory) changed = memory = true;
+                    continue;
+                default:
+                    continue;
+            }
+            if (value && rd != 0 && !numeric[rd]) changed = numeric[rd] = true;
+        }
+    }
+
+    for (size_t i = 0; i < program->count; i++) {
+        uint8_t op = program->op[i];
+        uint16_t regs = program->regs[i];
+        if (op == INST_JALR && (numeric[IR_REG(regs, 1)] || numeric[IR_REG(regs, 2)])) return true;
+        if ((op == INST_LW || op == INST_SW) && numeric[IR_REG(regs, 1)]) return true;
+    }
+    return false;
+}
+
+// Binary search for the last line change at or before index
+static const LineEntry* program_line_entry(const Program* program, size_t index) {
+    if (program->line_count == 0) return NULL;
+    size_t lo = 0, hi = program->line_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (program->lines[mid].index <= index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &program->lines[lo];
+}
+
+int program_line(const Program* program, size_t index) {
+    const LineEntry* entry = program_line_entry(program, index);
+    return entry ? entry->line : 0;
+}
+
+int program_file(const Program* program, size_t index) {
+    const LineEntry* entry = program_line_entry(program, index);
+    return entry ? (int)entry->file : 0;
+}
+
+void program_free(Program* program) {
+    mem_free(program->op);
+    mem_free(program->kind);
+    mem_free(program->regs);
+    mem_free(program->imm);
+    mem_free(program->lines);
+    memset(program, 0, sizeof(*program));
+}
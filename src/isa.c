@@ -0,0 +1,14 @@
+#include "asm.h"
+#include "isa_table.h"
+
+// Instruction formats, indexed by InstructionType. The machine instructions
+// come from the table generated from instructions-encoding.txt; .word is
+// the only entry maintained by hand.
+const IsaFormat isa_formats[INST_EOP] = {
+#define ISA_FORMAT(name, mnemonic, c0, c1, clast, opcode, count, k0, s0, m0, k1, s1, m1, k2, s2, m2) \
+    [INST_##name] = { mnemonic, (opcode) << 12, count, \
+                      { { k0, s0, m0 }, { k1, s1, m1 }, { k2, s2, m2 } } },
+    ISA_INSTRUCTIONS(ISA_FORMAT)
+#undef ISA_FORMAT
+    [INST_WORD] = { ".word", 0x0000, 1, { { ISA_IMM, 0, 0xFFFF } } },
+};
@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "asm.h"
+
+// Dynamic binary translation of BEAG code to x86-64. A basic block runs
+// from its entry address to the first branch or jalr (or MAX_BLOCK_INSNS
+// instructions, or an undefined opcode) and is translated into the code
+// cache on first execution. The BEAG registers stay in sim->regs, which
+// the generated code addresses off rbx; only eax, ecx and edx are scratch:
+//
+//   rbx  Simulator*          r13  code map: nonzero for translated words
+//   r12  sim->memory         r14  instructions executed
+//   r15  step limit
+//
+// The code produced for a block exits to a stub for every way out of it.
+// A stub for a fixed successor address returns to jit_run(), which looks
+// up or translates the successor and patches the jump that led to the stub
+// to go straight to it, so hot paths end up chained together. jalr looks
+// its target up in the block table inline.
+//
+// Stores check the code map and leave the block when they hit translated
+// code; jit_run() then drops every translation and carries on after the
+// store. Instruction counts are added at the end of each block and the step
+// limit is checked there, where the interpreter checks it, so both modes
+// stop in the same state.
+
+#define JIT_CACHE_SIZE (16u << 20)
+#define MAX_BLOCK_INSNS 64
+#define MAX_BLOCK_BYTES 8192   // Worst case for a block, with its stubs
+
+// Exit reasons beyond the SimStatus values
+enum {
+    JIT_EXIT_CHAIN = 100,  // Fixed successor not yet chained; rdx is the jump to patch
+    JIT_EXIT_LOOKUP,       // jalr to an address without a translation
+    JIT_EXIT_STORE         // A store hit translated code
+};
+
+// Returned in rax:rdx by the entry trampoline
+typedef struct {
+    uint64_t reason;
+    uint8_t* site;         // rel32 field of the jump to patch
+} JitExit;
+
+typedef JitExit (*JitEntry)(Simulator* sim, const void* code, uint8_t* code_map, uint64_t limit);
+
+#define REG_DISP(r) ((uint8_t)(2 * (r)))
+#define PC_DISP ((uint8_t)offsetof(Simulator, pc))
+_Static_assert(offsetof(Simulator, regs) == 0 && offsetof(Simulator, pc) < 128,
+               "registers and pc must be reachable with an 8-bit displacement");
+
+#if defined(__x86_64__)
+
+// Stubs a block needs, emitted after its body
+typedef enum {
+    STUB_CHAIN,
+    STUB_LIMIT,
+    STUB_HALT,
+    STUB_DIVIDE,
+    STUB_STORE
+} StubKind;
+
+typedef struct {
+    uint8_t kind;          // StubKind
+    uint16_t pc;           // PC to report (the successor, for chains)
+    uint32_t steps;        // Instructions to add before leaving
+    uint8_t* site;         // rel32 field that jumps to the stub
+} Stub;
+
+typedef struct {
+    uint8_t* p;
+    Stub stubs[2 * MAX_BLOCK_INSNS + 4];
+    int stub_count;
+} Emitter;
+
+static void emit(Emitter* e, const uint8_t* bytes, size_t n) {
+    memcpy(e->p, bytes, n);
+    e->p += n;
+}
+
+#define EMIT(e, ...) do {                               \
+        static const uint8_t bytes_[] = { __VA_ARGS__ }; \
+        emit(e, bytes_, sizeof(bytes_));                 \
+    } while (0)
+
+static void emit8(Emitter* e, uint8_t value) {
+    *e->p++ = value;
+}
+
+static void emit16(Emitter* e, uint16_t value) {
+    memcpy(e->p, &value, 2);
+    e->p += 2;
+}
+
+static void emit32(Emitter* e, uint32_t value) {
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static void emit64(Emitter* e, uint64_t value) {
+    memcpy(e->p, &value, 8);
+    e->p += 8;
+}
+
+static void patch_rel32(uint8_t* site, const uint8_t* target) {
+    int32_t rel = (int32_t)(target - (site + 4));
+    memcpy(site, &rel, 4);
+}
+
+// Emits a rel32 field to be resolved to stub kind
+static void emit_stub_ref(Emitter* e, StubKind kind, uint16_t pc, uint32_t steps) {
+    Stub* stub = &e->stubs[e->stub_count++];
+    stub->kind = (uint8_t)kind;
+    stub->pc = pc;
+    stub->steps = steps;
+    stub->site = e->p;
+    emit32(e, 0);
+}
+
+// movzx eax, word [rbx + 2*r]
+static void load_eax(Emitter* e, int r) {
+    EMIT(e, 0x0F, 0xB7, 0x43);
+    emit8(e, REG_DISP(r));
+}
+
+// mov [rbx + 2*r], ax
+static void store_ax(Emitter* e, int r) {
+    EMIT(e, 0x66, 0x89, 0x43);
+    emit8(e, REG_DISP(r));
+}
+
+// add r14, steps
+static void add_steps(Emitter* e, uint32_t steps) {
+    if (steps == 0) return;
+    EMIT(e, 0x49, 0x81, 0xC6);
+    emit32(e, steps);
+}
+
+// Counts the block's instructions and leaves through the limit stub when
+// the branch at pc would go over the step limit
+static void check_limit(Emitter* e, uint32_t steps, uint16_t pc) {
+    add_steps(e, steps);
+    EMIT(e, 0x4D, 0x39, 0xFE);           // cmp r14, r15
+    EMIT(e, 0x0F, 0x87);                 // ja limit
+    emit_stub_ref(e, STUB_LIMIT, pc, 0);
+}
+
+// Sets the reported pc and status and jumps to the epilogue
+static void emit_leave(Emitter* e, uint16_t pc, uint32_t reason, const uint8_t* epilogue) {
+    EMIT(e, 0x66, 0xC7, 0x43);           // mov word [rbx + pc], imm16
+    emit8(e, PC_DISP);
+    emit16(e, pc);
+    emit8(e, 0xB8);                      // mov eax, reason
+    emit32(e, reason);
+    emit8(e, 0xE9);                      // jmp epilogue
+    emit32(e, 0);
+    patch_rel32(e->p - 4, epilogue);
+}
+
+static void emit_stubs(Emitter* e, const uint8_t* epilogue) {
+    for (int i = 0; i < e->stub_count; i++) {
+        Stub* stub = &e->stubs[i];
+        patch_rel32(stub->site, e->p);
+        switch (stub->kind) {
+            case STUB_CHAIN:
+                EMIT(e, 0x48, 0xBA);     // mov rdx, site
+                emit64(e, (uint64_t)(uintptr_t)stub->site);
+                emit_leave(e, stub->pc, JIT_EXIT_CHAIN, epilogue);
+                break;
+            case STUB_LIMIT:
+            case STUB_HALT:
+                EMIT(e, 0x49, 0xFF, 0xCE);   // dec r14: the branch did not run
+                emit_leave(e, stub->pc, stub->kind == STUB_LIMIT ? SIM_STEP_LIMIT : SIM_HALTED,
+                           epilogue);
+                break;
+            case STUB_DIVIDE:
+                add_steps(e, stub->steps);
+                emit_leave(e, stub->pc, SIM_DIVIDE_BY_ZERO, epilogue);
+                break;
+            case STUB_STORE:
+                add_steps(e, stub->steps);
+                emit_leave(e, stub->pc, JIT_EXIT_STORE, epilogue);
+                break;
+        }
+    }
+}
+
+// Emits the entry trampoline and the shared epilogue at the start of the
+// cache; returns the epilogue
+static uint8_t* emit_trampoline(Emitter* e) {
+    EMIT(e, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);  // push rbx ... r15
+    EMIT(e, 0x48, 0x89, 0xFB);           // mov rbx, rdi
+    EMIT(e, 0x4C, 0x8B, 0xA3);           // mov r12, [rbx + memory]
+    emit32(e, (uint32_t)offsetof(Simulator, memory));
+    EMIT(e, 0x49, 0x89, 0xD5);           // mov r13, rdx
+    EMIT(e, 0x4C, 0x8B, 0xB3);           // mov r14, [rbx + steps]
+    emit32(e, (uint32_t)offsetof(Simulator, steps));
+    EMIT(e, 0x49, 0x89, 0xCF);           // mov r15, rcx
+    EMIT(e, 0xFF, 0xE6);                 // jmp rsi
+
+    uint8_t* epilogue = e->p;
+    EMIT(e, 0x4C, 0x89, 0xB3);           // mov [rbx + steps], r14
+    emit32(e, (uint32_t)offsetof(Simulator, steps));
+    EMIT(e, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B);  // pop r15 ... rbx
+    EMIT(e, 0xC3);                       // ret
+    return epilogue;
+}
+
+// Translates the block at pc. The cache must have MAX_BLOCK_BYTES free.
+static uint8_t* translate(Jit* jit, Simulator* sim, uint16_t pc) {
+    Emitter e;
+    e.p = jit->cache + jit->used;
+    e.stub_count = 0;
+    uint8_t* start = e.p;
+    uint8_t* epilogue = jit->epilogue;
+
+    uint32_t k = 0;
+    uint32_t address = pc;
+    bool ended = false;
+    while (!ended) {
+        if (k == MAX_BLOCK_INSNS || address >= sim->image_size) {
+            // Falls through to the next block (or the end of the image)
+            add_steps(&e, k);
+            emit8(&e, 0xE9);
+            emit_stub_ref(&e, STUB_CHAIN, (uint16_t)address, 0);
+            break;
+        }
+        uint16_t at = (uint16_t)address;
+        sim_decode(sim, at);
+        const SimInsn* insn = &sim->decoded[at];
+        jit->code_map[at] = 1;
+        if (insn->op >= INST_WORD) {
+            // Undefined opcode: stop before it
+            add_steps(&e, k);
+            emit_leave(&e, at, SIM_ILLEGAL, epilogue);
+            break;
+        }
+        bool sink = insn->a == SIM_SINK;
+
+        switch (insn->op) {
+            case INST_ADD:
+            case INST_SUB:
+            case INST_MUL:
+                if (sink) break;
+                load_eax(&e, insn->b);
+                if (insn->op == INST_ADD) EMIT(&e, 0x66, 0x03, 0x43);        // add ax, [c]
+                else if (insn->op == INST_SUB) EMIT(&e, 0x66, 0x2B, 0x43);   // sub ax, [c]
+                else EMIT(&e, 0x66, 0x0F, 0xAF, 0x43);                       // imul ax, [c]
+                emit8(&e, REG_DISP(insn->c));
+                store_ax(&e, insn->a);
+                break;
+            case INST_DIV:
+                EMIT(&e, 0x0F, 0xBF, 0x43);      // movsx eax, word [b]
+                emit8(&e, REG_DISP(insn->b));
+                EMIT(&e, 0x0F, 0xBF, 0x4B);      // movsx ecx, word [c]
+                emit8(&e, REG_DISP(insn->c));
+                EMIT(&e, 0x85, 0xC9);            // test ecx, ecx
+                EMIT(&e, 0x0F, 0x84);            // jz divide
+                emit_stub_ref(&e, STUB_DIVIDE, at, k);
+                EMIT(&e, 0x99, 0xF7, 0xF9);      // cdq; idiv ecx
+                if (!sink) store_ax(&e, insn->a);
+                break;
+            case INST_LW:
+                if (sink) break;
+                load_eax(&e, insn->b);
+                EMIT(&e, 0x41, 0x0F, 0xB7, 0x04, 0x44);  // movzx eax, word [r12 + rax*2]
+                store_ax(&e, insn->a);
+                break;
+            case INST_SW:
+                load_eax(&e, insn->b);
+                EMIT(&e, 0x0F, 0xB7, 0x4B);      // movzx ecx, word [a]
+                emit8(&e, REG_DISP(insn->a));
+                EMIT(&e, 0x66, 0x41, 0x89, 0x0C, 0x44);        // mov [r12 + rax*2], cx
+                EMIT(&e, 0x41, 0x80, 0x7C, 0x05, 0x00, 0x00);  // cmp byte [r13 + rax], 0
+                EMIT(&e, 0x0F, 0x85);            // jne store
+                emit_stub_ref(&e, STUB_STORE, (uint16_t)(at + 1), k + 1);
+                break;
+            case INST_LHI:
+                if (sink) break;
+                EMIT(&e, 0xC6, 0x43);            // mov byte [a + 1], imm8
+                emit8(&e, (uint8_t)(REG_DISP(insn->a) + 1));
+                emit8(&e, (uint8_t)insn->imm);
+                break;
+            case INST_LLI:
+                if (sink) break;
+                EMIT(&e, 0x66, 0xC7, 0x43);      // mov word [a], imm16
+                emit8(&e, REG_DISP(insn->a));
+                emit16(&e, (uint16_t)insn->imm);
+                break;
+            case INST_BEQ:
+            case INST_BNE:
+            case INST_BLT: {
+                check_limit(&e, k + 1, at);
+                EMIT(&e, 0x66, 0x83, 0x7B);      // cmp word [a], 0
+                emit8(&e, REG_DISP(insn->a));
+                emit8(&e, 0x00);
+                emit8(&e, 0x0F);                 // je / jne / jl taken
+                emit8(&e, insn->op == INST_BEQ ? 0x84 : insn->op == INST_BNE ? 0x85 : 0x8C);
+                if (insn->imm == 0) {
+                    emit_stub_ref(&e, STUB_HALT, at, 0);
+                } else {
+                    emit_stub_ref(&e, STUB_CHAIN, (uint16_t)(at + insn->imm), 0);
+                }
+                emit8(&e, 0xE9);                 // jmp fall-through
+                emit_stub_ref(&e, STUB_CHAIN, (uint16_t)(at + 1), 0);
+                ended = true;
+                break;
+            }
+            case INST_JALR:
+                check_limit(&e, k + 1, at);
+                load_eax(&e, insn->b);
+                EMIT(&e, 0x66, 0x03, 0x43);      // add ax, [c]
+                emit8(&e, REG_DISP(insn->c));
+                EMIT(&e, 0x0F, 0xB7, 0xC0);      // movzx eax, ax
+                emit8(&e, 0x3D);                 // cmp eax, pc
+                emit32(&e, at);
+                EMIT(&e, 0x0F, 0x84);            // je halt
+                emit_stub_ref(&e, STUB_HALT, at, 0);
+                EMIT(&e, 0x66, 0xC7, 0x43);      // mov word [a], pc + 1
+                emit8(&e, REG_DISP(insn->a));
+                emit16(&e, (uint16_t)(at + 1));
+                EMIT(&e, 0x48, 0xB9);            // mov rcx, blocks
+                emit64(&e, (uint64_t)(uintptr_t)jit->blocks);
+                EMIT(&e, 0x48, 0x8B, 0x0C, 0xC1);  // mov rcx, [rcx + rax*8]
+                EMIT(&e, 0x48, 0x85, 0xC9);      // test rcx, rcx
+                EMIT(&e, 0x74, 0x02);            // jz miss
+                EMIT(&e, 0xFF, 0xE1);            // jmp rcx
+                EMIT(&e, 0x66, 0x89, 0x43);      // miss: mov [rbx + pc], ax
+                emit8(&e, PC_DISP);
+                emit8(&e, 0xB8);                 // mov eax, JIT_EXIT_LOOKUP
+                emit32(&e, JIT_EXIT_LOOKUP);
+                emit8(&e, 0xE9);                 // jmp epilogue
+                emit32(&e, 0);
+                patch_rel32(e.p - 4, epilogue);
+                ended = true;
+                break;
+        }
+        k++;
+        address++;
+    }
+
+    emit_stubs(&e, epilogue);
+    jit->used = (size_t)(e.p - jit->cache);
+    jit->blocks[pc] = start;
+    jit->translations++;
+    return start;
+}
+
+// Drops every translation
+static void flush(Jit* jit) {
+    jit->used = jit->code_start;
+    memset(jit->blocks, 0, SIM_MEMORY_WORDS * sizeof(void*));
+    memset(jit->code_map, 0, SIM_MEMORY_WORDS);
+    jit->generation++;
+    jit->flushes++;
+}
+
+// The translation of the block at pc, translating it if need be
+static uint8_t* block_at(Jit* jit, Simulator* sim, uint16_t pc) {
+    if (jit->blocks[pc]) return jit->blocks[pc];
+    if (jit->cache_size - jit->used < MAX_BLOCK_BYTES) flush(jit);
+    return translate(jit, sim, pc);
+}
+
+bool jit_init(Jit* jit) {
+    memset(jit, 0, sizeof(*jit));
+    void* cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) return false;
+    jit->cache = cache;
+    jit->cache_size = JIT_CACHE_SIZE;
+    jit->blocks = mem_calloc(SIM_MEMORY_WORDS, sizeof(void*));
+    jit->code_map = mem_calloc(SIM_MEMORY_WORDS, 1);
+    if (!jit->blocks || !jit->code_map) {
+        jit_free(jit);
+        return false;
+    }
+
+    Emitter e;
+    e.p = jit->cache;
+    jit->epilogue = emit_trampoline(&e);
+    jit->code_start = jit->used = (size_t)(e.p - jit->cache);
+    return true;
+}
+
+// Runs the loaded program from sim->pc until it stops, like sim_run()
+SimStatus jit_run(Jit* jit, Simulator* sim) {
+    JitEntry enter = (JitEntry)(void*)jit->cache;
+    uint64_t limit = sim->step_limit ? sim->step_limit : UINT64_MAX;
+    SimStatus status = SIM_RUNNING;
+    while (status == SIM_RUNNING) {
+        if (sim->pc >= sim->image_size) {
+            status = SIM_END;
+            break;
+        }
+        JitExit exit = enter(sim, block_at(jit, sim, sim->pc), jit->code_map, limit);
+        switch (exit.reason) {
+            case JIT_EXIT_CHAIN: {
+                // Translate the successor and patch the jump, unless that
+                // flushed the block the jump is in
+                if (sim->pc >= sim->image_size) break;
+                uint32_t generation = jit->generation;
+                uint8_t* target = block_at(jit, sim, sim->pc);
+                if (jit->generation == generation) {
+                    patch_rel32(exit.site, target);
+                    jit->chains++;
+                }
+                break;
+            }
+            case JIT_EXIT_LOOKUP:
+                break;
+            case JIT_EXIT_STORE:
+                flush(jit);
+                break;
+            default:
+                status = (SimStatus)exit.reason;
+                break;
+        }
+    }
+    sim->status = status;
+    return status;
+}
+
+void jit_free(Jit* jit) {
+    if (jit->cache) munmap(jit->cache, jit->cache_size);
+    mem_free(jit->blocks);
+    mem_free(jit->code_map);
+    memset(jit, 0, sizeof(*jit));
+}
+
+#else
+
+// Other hosts have no translator; jit_init() fails and callers interpret
+bool jit_init(Jit* jit) {
+    memset(jit, 0, sizeof(*jit));
+    return false;
+}
+
+SimStatus jit_run(Jit* jit, Simulator* sim) {
+    (void)jit;
+    return sim_run(sim);
+}
+
+void jit_free(Jit* jit) {
+    memset(jit, 0, sizeof(*jit));
+}
+
+#endif
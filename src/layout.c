@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+// Profile-guided code layout (--layout=PROFILE), run between the peephole
+// optimizer and code generation. The program is cut into blocks at labels:
+// a block is a run of labels and the entries up to the next label, so any
+// block but the first can be reached by name and moved as a whole. The
+// profile weighs each block's exits, how often it fell through and how
+// often its final branch or jump was taken, and blocks are chained
+// greedily along the heaviest exits (Pettis and Hansen) so that a block's
+// hot successor comes right after it. The chain holding the entry point is
+// laid out first, then the others, hottest first.
+//
+// Placing a block fixes up its exit:
+// - a block whose fall-through successor moved away gets a "j" to it
+// - a final beq or bne whose target now follows is inverted to branch to
+//   the fall-through successor instead
+// - a final jump to the block that now follows is dropped
+// The code generator then sizes jumps and branches as usual, so a hot
+// branch placed next to its target also stops needing a long jump.
+//
+// Profile addresses refer to the image the program assembles to without
+// the layout, so that image is generated first to place them; a profile
+// recorded on another image is ignored with a warning. Programs with
+// numeric branch offsets or a label defined twice are left as they are.
+// A block ending in data stays in front of its successor, in case the
+// data is executed, and a block that runs off the end of the program
+// stays last.
+
+typedef enum {
+    EXIT_FALL,              // Falls through (a call returns to the next entry)
+    EXIT_BRANCH,            // Conditional branch to a label, else falls through
+    EXIT_JUMP,              // Always jumps to a label
+    EXIT_STOP,              // Leaves through a register, or for a non-label
+    EXIT_DATA               // Ends in data
+} BlockExit;
+
+typedef struct {
+    size_t start, end;      // IR entries
+    size_t last;            // Final instruction entry, or SIZE_MAX for none
+    uint8_t exit;           // BlockExit
+    int32_t fall;           // Fall-through successor, -1 past the end
+    int32_t target;         // Block the final branch or jump goes to, or -1
+    uint64_t count;         // Executions of the first instruction
+    uint64_t fall_weight;   // Times the block fell through
+    uint64_t target_weight; // Times its final branch or jump was taken
+    int32_t next;           // Successor in its chain, or -1
+    int32_t chain;          // Chain holding the block
+} Block;
+
+// Chains are numbered by the block they started with; a chain merged into
+// another is left with size 0
+typedef struct {
+    int32_t head, tail;
+    size_t size;
+    uint64_t heat;          // Largest block count in the chain
+} Chain;
+
+typedef struct {
+    int32_t from, to;
+    uint64_t weight;
+    bool fall;
+} Edge;
+
+typedef struct {
+    Assembler* as;
+    Program* program;
+    Profile profile;
+    uint32_t* addresses;    // Reference address per IR entry
+    uint16_t* code;         // Reference image
+    int32_t* block_of;      // Block per symbol ID whose label heads it, or -1
+    Block* blocks;
+    size_t block_count;
+    Chain* chains;
+    int32_t pinned_last;    // Block that runs off the end, or -1
+} BlockLayout;
+
+static bool is_data(uint8_t op) {
+    return op == INST_WORD || op == INST_ASCII || op == INST_ASCIZ;
+}
+
+// Whether the layout can move code of this program without changing what
+// it does: only labels may be jumped to or accessed (see
+// program_numeric_addresses()), each defined once
+static bool can_move(BlockLayout* bl) {
+    const Program* program = bl->program;
+    size_t symbol_count = bl->as->symbols.count ? (size_t)bl->as->symbols.count : 1;
+    bl->block_of = mem_alloc(symbol_count * sizeof(int32_t));
+    if (!bl->block_of) return false;
+    for (size_t i = 0; i < symbol_count; i++) bl->block_of[i] = -1;
+
+    if (program_numeric_addresses(program)) {
+        TRACE(TRACE_CODEGEN, TRACE_INFO, "layout: numeric addresses, not moving code\n");
+        return false;
+    }
+    for (size_t i = 0; i < program->count; i++) {
+        if (program->op[i] != INST_LABEL) continue;
+        if (bl->block_of[program->imm[i]] >= 0) {
+            TRACE(TRACE_CODEGEN, TRACE_INFO, "layout: label defined twice, not moving code\n");
+            return false;
+        }
+        bl->block_of[program->imm[i]] = 0;
+    }
+    return true;
+}
+
+// Generates the image the profile should have been recorded on and checks
+// that it was. Returns false on errors; *matches tells if the profile fits.
+static bool generate_reference(BlockLayout* bl, bool* matches) {
+    Assembler* as = bl->as;
+    const Program* program = bl->program;
+    bl->addresses = mem_alloc((program->count + 1) * sizeof(uint32_t));
+    if (!bl->addresses) {
+        assembler_report(as, "Error: Out of memory\n");
+        return false;
+    }
+
+    // This image is not the output: its relaxations are not counted, and
+    // its labels are defined again by the real code generation
+    uint64_t relaxed_branches = as->stats.relaxed_branches;
+    uint64_t relaxed_words = as->stats.relaxed_words;
+    size_t size = 0;
+    bl->code = codegen_generate_at(as, program, &size, bl->addresses);
+    as->stats.relaxed_branches = relaxed_branches;
+    as->stats.relaxed_words = relaxed_words;
+    if (!bl->code) return false;
+    for (size_t i = 0; i < program->count; i++) {
+        if (program->op[i] == INST_LABEL) as->symbols.entries[program->imm[i]].is_defined = false;
+    }
+
+    *matches = bl->profile.image_size == size &&
+               bl->profile.image_hash == cache_hash(bl->code, size * sizeof(uint16_t), 0);
+    return true;
+}
+
+static bool find_blocks(BlockLayout* bl) {
+    const Program* program = bl->program;
+    size_t count = 0;
+    for (size_t i = 0; i < program->count; i++) {
+        if (i == 0 || (program->op[i] == INST_LABEL && program->op[i - 1] != INST_LABEL)) count++;
+    }
+    bl->blocks = mem_calloc(count ? count : 1, sizeof(Block));
+    bl->chains = mem_calloc(count ? count : 1, sizeof(Chain));
+    if (!bl->blocks || !bl->chains) return false;
+
+    size_t b = 0;
+    for (size_t i = 0; i < program->count; i++) {
+        if (i > 0 && (program->op[i] != INST_LABEL || program->op[i - 1] == INST_LABEL)) continue;
+        if (b > 0) bl->blocks[b - 1].end = i;
+        bl->blocks[b++].start = i;
+    }
+    if (b > 0) bl->blocks[b - 1].end = program->count;
+    bl->block_count = count;
+
+    for (size_t k = 0; k < count; k++) {
+        Block* block = &bl->blocks[k];
+        for (size_t i = block->start; i < block->end && program->op[i] == INST_LABEL; i++) {
+            bl->block_of[program->imm[i]] = (int32_t)k;
+        }
+        block->next = -1;
+        block->chain = (int32_t)k;
+        bl->chains[k].head = bl->chains[k].tail = (int32_t)k;
+        bl->chains[k].size = 1;
+    }
+    return true;
+}
+
+// Times the branch at entry index went to its label. A relaxed branch is
+// the inverted branch over a long jump, taken when the jump's jalr runs.
+static uint64_t branch_taken(const BlockLayout* bl, size_t index) {
+    const Program* program = bl->program;
+    uint32_t address = bl->addresses[index];
+    uint32_t words = bl->addresses[index + 1] - address;
+    uint32_t target = bl->addresses[bl->blocks[bl->block_of[program->imm[index]]].start];
+    uint16_t word = bl->code[address];
+    bool short_form = words == 1 ||
+        ((word & 0xF000) == isa_formats[program->op[index]].opcode_bits &&
+         (word & 0xFF) == ((target - address) & 0xFF));
+    return short_form ? bl->profile.taken[address] : bl->profile.counts[address + words - 1];
+}
+
+// Classifies each block's exit and weighs it with the profile
+static void weigh_blocks(BlockLayout* bl) {
+    const Program* program = bl->program;
+    const uint64_t* counts = bl->profile.counts;
+    bl->pinned_last = -1;
+    for (size_t k = 0; k < bl->block_count; k++) {
+        Block* block = &bl->blocks[k];
+        block->fall = k + 1 < bl->block_count ? (int32_t)k + 1 : -1;
+        block->target = -1;
+        block->last = SIZE_MAX;
+        size_t first = block->start;
+        while (first < block->end && program->op[first] == INST_LABEL) first++;
+        if (first == block->end) {
+            block->exit = EXIT_FALL;
+            continue;
+        }
+        block->count = counts[bl->addresses[first]];
+        block->last = block->end - 1;
+
+        size_t last = block->last;
+        uint8_t op = program->op[last];
+        uint64_t executed = counts[bl->addresses[last]];
+        bool to_label = program->kind[last] == OP_LABEL &&
+                        bl->block_of[program->imm[last]] >= 0;
+        bool jump = op == INST_J || (op == INST_BEQ && IR_REG(program->regs[last], 0) == 0);
+        if (is_data(op)) {
+            block->exit = EXIT_DATA;
+        } else if (jump || (op == INST_JALR && IR_REG(program->regs[last], 0) == 0)) {
+            block->exit = jump && to_label ? EXIT_JUMP : EXIT_STOP;
+            if (block->exit == EXIT_JUMP) {
+                block->target = bl->block_of[program->imm[last]];
+                block->target_weight = executed;
+            }
+        } else if ((op == INST_BEQ || op == INST_BNE || op == INST_BLT) && to_label) {
+            block->exit = EXIT_BRANCH;
+            block->target = bl->block_of[program->imm[last]];
+            block->target_weight = branch_taken(bl, last);
+            block->fall_weight = executed - block->target_weight;
+        } else {
+            block->exit = EXIT_FALL;
+            block->fall_weight = executed;
+        }
+    }
+
+    if (bl->block_count > 0) {
+        const Block* last = &bl->blocks[bl->block_count - 1];
+        if (last->exit == EXIT_FALL || last->exit == EXIT_BRANCH || last->exit == EXIT_DATA) {
+            bl->pinned_last = (int32_t)bl->block_count - 1;
+        }
+    }
+}
+
+// Appends chain b to chain a if a ends with from and b starts with to
+static bool merge(BlockLayout* bl, int32_t from, int32_t to) {
+    Block* blocks = bl->blocks;
+    int32_t a = blocks[from].chain, b = blocks[to].chain;
+    if (a == b || to == 0 || bl->chains[a].tail != from || bl->chains[b].head != to) return false;
+
+    // The entry chain goes first and the one running off the end last, so
+    // they only join when nothing is left to go between them
+    bool entry = a == blocks[0].chain || b == blocks[0].chain;
+    bool end = bl->pinned_last >= 0 &&
+               (a == blocks[bl->pinned_last].chain || b == blocks[bl->pinned_last].chain);
+    if (entry && end && bl->chains[a].size + bl->chains[b].size < bl->block_count) return false;
+
+    // The smaller chain takes the other's number
+    int32_t keep = bl->chains[a].size >= bl->chains[b].size ? a : b;
+    int32_t drop = keep == a ? b : a;
+    for (int32_t k = bl->chains[drop].head; k >= 0; k = blocks[k].next) blocks[k].chain = keep;
+    blocks[from].next = to;
+    Chain merged = { bl->chains[a].head, bl->chains[b].tail,
+                     bl->chains[a].size + bl->chains[b].size,
+                     bl->chains[a].heat > bl->chains[b].heat ? bl->chains[a].heat
+                                                             : bl->chains[b].heat };
+    bl->chains[keep] = merged;
+    bl->chains[drop].size = 0;
+    return true;
+}
+
+// Heaviest first; between equals, fall-throughs first, then source order
+static int compare_edges(const void* a, const void* b) {
+    const Edge* x = a;
+    const Edge* y = b;
+    if (x->weight != y->weight) return x->weight > y->weight ? -1 : 1;
+    if (x->fall != y->fall) return x->fall ? -1 : 1;
+    return x->from - y->from;
+}
+
+static bool chain_blocks(BlockLayout* bl) {
+    Block* blocks = bl->blocks;
+    for (size_t k = 0; k < bl->block_count; k++) bl->chains[k].heat = blocks[k].count;
+
+    // Data stays with what follows it before anything else is placed
+    for (size_t k = 0; k < bl->block_count; k++) {
+        if (blocks[k].exit == EXIT_DATA && blocks[k].fall >= 0) {
+            merge(bl, (int32_t)k, blocks[k].fall);
+        }
+    }
+
+    Edge* edges = mem_alloc((bl->block_count * 2 + 1) * sizeof(Edge));
+    if (!edges) return false;
+    size_t count = 0;
+    for (size_t k = 0; k < bl->block_count; k++) {
+        const Block* block = &blocks[k];
+        bool falls = block->exit == EXIT_FALL || block->exit == EXIT_BRANCH;
+        if (falls && block->fall >= 0) {
+            edges[count++] = (Edge){ (int32_t)k, block->fall, block->fall_weight, true };
+        }
+        // Only beq and bne can be inverted to fall through to their target
+        uint8_t op = block->last != SIZE_MAX ? bl->program->op[block->last] : INST_LABEL;
+        bool invertible = block->exit == EXIT_BRANCH && block->fall >= 0 &&
+                          (op == INST_BEQ || op == INST_BNE);
+        if ((invertible || block->exit == EXIT_JUMP) && block->target != (int32_t)k) {
+            edges[count++] = (Edge){ (int32_t)k, block->target, block->target_weight, false };
+        }
+    }
+    qsort(edges, count, sizeof(Edge), compare_edges);
+    for (size_t i = 0; i < count; i++) merge(bl, edges[i].from, edges[i].to);
+    mem_free(edges);
+    return true;
+}
+
+// Hottest first; between equals, source order
+static int compare_chains(const void* a, const void* b) {
+    const Chain* x = a;
+    const Chain* y = b;
+    if (x->heat != y->heat) return x->heat > y->heat ? -1 : 1;
+    return x->head - y->head;
+}
+
+// Fills order with the blocks in their new order
+static bool order_blocks(BlockLayout* bl, int32_t* order) {
+    Chain* chains = mem_alloc((bl->block_count ? bl->block_count : 1) * sizeof(Chain));
+    if (!chains) return false;
+    int32_t first = bl->blocks[0].chain;
+    int32_t last = bl->pinned_last >= 0 ? bl->blocks[bl->pinned_last].chain : -1;
+    size_t count = 0;
+    chains[count++] = bl->chains[first];
+    size_t middle = count;
+    for (size_t k = 0; k < bl->block_count; k++) {
+        if (bl->chains[k].size == 0 || (int32_t)k == first || (int32_t)k == last) continue;
+        chains[count++] = bl->chains[k];
+    }
+    qsort(chains + middle, count - middle, sizeof(Chain), compare_chains);
+    if (last >= 0 && last != first) chains[count++] = bl->chains[last];
+
+    size_t placed = 0;
+    for (size_t c = 0; c < count; c++) {
+        for (int32_t k = chains[c].head; k >= 0; k = bl->blocks[k].next) order[placed++] = k;
+    }
+    mem_free(chains);
+    return true;
+}
+
+static bool append_entry(Program* to, const Program* from, size_t index, uint8_t op,
+                         int32_t imm) {
+    return program_append(to, op, from->kind[index], from->regs[index], imm,
+                          program_file(from, index), program_line(from, index));
+}
+
+// Rebuilds the program in the given block order, fixing up block exits
+static bool rebuild(BlockLayout* bl, const int32_t* order) {
+    Program* program = bl->program;
+    Stats* stats = &bl->as->stats;
+    Program laid_out;
+    program_init(&laid_out);
+    bool ok = true;
+    uint64_t taken_before = 0, taken_after = 0;
+
+    for (size_t k = 0; ok && k < bl->block_count; k++) {
+        int32_t b = order[k];
+        int32_t next = k + 1 < bl->block_count ? order[k + 1] : -1;
+        const Block* block = &bl->blocks[b];
+        if (k > 0 && order[k - 1] != b - 1) stats->layout_moved++;
+
+        bool falls = block->exit == EXIT_FALL || block->exit == EXIT_BRANCH;
+        bool needs_jump = falls && block->fall >= 0 && next != block->fall;
+        bool inverted = false;
+        for (size_t i = block->start; ok && i < block->end; i++) {
+            uint8_t op = program->op[i];
+            int32_t imm = program->imm[i];
+            if (i == block->last && block->exit == EXIT_JUMP && block->target == next) {
+                stats->layout_jumps_removed++;
+                continue;
+            }
+            if (i == block->last && block->exit == EXIT_BRANCH && needs_jump &&
+                block->target == next && (op == INST_BEQ || op == INST_BNE)) {
+                // Branch to the fall-through successor instead
+                op = op == INST_BEQ ? INST_BNE : INST_BEQ;
+                imm = program->imm[bl->blocks[block->fall].start];
+                needs_jump = false;
+                inverted = true;
+                stats->layout_inverted++;
+            }
+            ok = append_entry(&laid_out, program, i, op, imm);
+        }
+        if (ok && needs_jump) {
+            size_t at = block->last != SIZE_MAX ? block->last : block->start;
+            ok = program_append(&laid_out, INST_J, OP_LABEL, 0,
+                                program->imm[bl->blocks[block->fall].start],
+                                program_file(program, at), program_line(program, at));
+            stats->layout_jumps_added++;
+        }
+
+        // Exits that are taken jumps or branches, before and after
+        taken_before += block->target_weight;
+        if (block->exit == EXIT_JUMP && block->target != next) {
+            taken_after += block->target_weight;
+        } else if (block->exit == EXIT_BRANCH) {
+            taken_after += inverted ? block->fall_weight : block->target_weight;
+        }
+        if (needs_jump) taken_after += block->fall_weight;
+    }
+    if (!ok) {
+        assembler_report(bl->as, "Error: Out of memory\n");
+        program_free(&laid_out);
+        return false;
+    }
+
+    stats->layout_blocks += bl->block_count;
+    stats->layout_taken_before += taken_before;
+    stats->layout_taken_after += taken_after;
+    program_free(program);
+    *program = laid_out;
+    return true;
+}
+
+// Reorders program by the profile named in the options. Returns false on
+// errors; a profile that does not fit the program only warns.
+bool layout_optimize(Assembler* as, Program* program) {
+    const char* filename = as->options.layout_profile;
+    BlockLayout bl = { 0 };
+    bl.as = as;
+    bl.program = program;
+    if (!profile_read(as, filename, &bl.profile)) return false;
+
+    bool ok = true, matches = false;
+    int32_t* order = NULL;
+    if (program->count == 0) goto done;
+    if (!can_move(&bl)) {
+        ok = bl.block_of != NULL;
+        if (!ok) assembler_report(as, "Error: Out of memory\n");
+        goto done;
+    }
+    ok = generate_reference(&bl, &matches);
+    if (!ok) goto done;
+    if (!matches) {
+        assembler_report(as, "Warning: Profile '%s' was not recorded on this program; "
+                         "layout unchanged\n", filename);
+        goto done;
+    }
+
+    ok = find_blocks(&bl);
+    if (ok) {
+        weigh_blocks(&bl);
+        ok = chain_blocks(&bl);
+    }
+    order = ok ? mem_alloc(bl.block_count * sizeof(int32_t)) : NULL;
+    ok = ok && order && order_blocks(&bl, order);
+    if (!ok) {
+        assembler_report(as, "Error: Out of memory\n");
+        goto done;
+    }
+
+    // Source order needs no rebuilding
+    bool moved = false;
+    for (size_t k = 0; k < bl.block_count; k++) moved = moved || order[k] != (int32_t)k;
+    if (moved) ok = rebuild(&bl, order);
+    TRACE(TRACE_CODEGEN, TRACE_INFO, "layout: %zu blocks, %llu moved\n", bl.block_count,
+          (unsigned long long)as->stats.layout_moved);
+
+done:
+    mem_free(order);
+    mem_free(bl.addresses);
+    mem_free(bl.code);
+    mem_free(bl.block_of);
+    mem_free(bl.blocks);
+    mem_free(bl.chains);
+    profile_free(&bl.profile);
+    return ok;
+}
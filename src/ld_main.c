@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "asm.h"
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options] -o <output.bin> <input.o>...\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -o FILE            Write the linked image to FILE\n");
+    fprintf(stderr, "  --trace=SPEC       Trace categories, e.g. 'symbols:verbose' or 'all'\n");
+    fprintf(stderr, "  --trace-file=PATH  Write trace output to PATH instead of stderr\n");
+    fprintf(stderr, "  --stats[=json]     Print phase timings and counters to stdout\n");
+}
+
+enum {
+    OPT_TRACE = 256,
+    OPT_TRACE_FILE,
+    OPT_STATS
+};
+
+int main(int argc, char** argv) {
+    static const struct option options[] = {
+        { "trace",      required_argument, NULL, OPT_TRACE },
+        { "trace-file", required_argument, NULL, OPT_TRACE_FILE },
+        { "stats",      optional_argument, NULL, OPT_STATS },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    const char* output = NULL;
+    bool show_stats = false;
+    bool stats_json = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "ho:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case OPT_TRACE:
+                if (!trace_configure(optarg)) return 1;
+                break;
+            case OPT_TRACE_FILE:
+                if (!trace_open(optarg)) return 1;
+                break;
+            case OPT_STATS:
+                show_stats = true;
+                if (optarg && strcmp(optarg, "json") == 0) {
+                    stats_json = true;
+                } else if (optarg && strcmp(optarg, "text") != 0) {
+                    fprintf(stderr, "Error: Unknown stats format '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!output || optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Assembler as;
+    assembler_init(&as, NULL, false);
+    int status = link_objects(&as, argv + optind, (size_t)(argc - optind), output) ? 0 : 1;
+    assembler_free(&as);
+    trace_close();
+    if (show_stats) stats_report(&as.stats, stdout, stats_json);
+    return status;
+}
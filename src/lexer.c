@@ -3,22 +3,72 @@
 #include <string.h>
 #include <ctype.h>
 #include "asm.h"
-
-#define MAX_TOKENS 1024
-#define MAX_TOKEN_LENGTH 256
-
-static const char* register_names[] = {
-    "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
-    NULL
+#include "isa_table.h"
+
+#define INITIAL_TOKEN_CAPACITY 256
+
+// Keyword classification: every mnemonic (from the generated instruction
+// table), pseudo-instruction, directive, register and label modifier
+// occupies its own slot in a 128-entry table indexed by a hash of the
+// length and the first, second and last characters (the first stands in
+// for the second in "j"). The hash is collision-free over the keyword set,
+// so an identifier is classified with one probe and a single memcmp. A
+// collision shows up at compile time as an overridden initializer
+// (-Woverride-init).
+#define KEYWORD_SLOTS 128
+#define KEYWORD_HASH(len, c0, c1, clast) \
+    (((c0) + (c1) + 4 * (clast) + 5 * (len)) & (KEYWORD_SLOTS - 1))
+#define KEYWORD(name, c0, c1, clast, type, value) \
+    [KEYWORD_HASH(sizeof(name) - 1, c0, c1, clast)] = { name, sizeof(name) - 1, type, value }
+
+typedef struct {
+    const char* name;
+    uint8_t length;
+    uint8_t type;          // TokenType
+    uint8_t value;         // InstructionType or register number
+} Keyword;
+
+static const Keyword keywords[KEYWORD_SLOTS] = {
+#define MNEMONIC_KEYWORD(name, mnemonic, c0, c1, clast, ...) \
+    KEYWORD(mnemonic, c0, c1, clast, TOKEN_INSTRUCTION, INST_##name),
+    ISA_INSTRUCTIONS(MNEMONIC_KEYWORD)
+#undef MNEMONIC_KEYWORD
+    KEYWORD("li",     'l', 'i', 'i', TOKEN_INSTRUCTION, INST_LI),
+    KEYWORD("la",     'l', 'a', 'a', TOKEN_INSTRUCTION, INST_LA),
+    KEYWORD("j",      'j', 'j', 'j', TOKEN_INSTRUCTION, INST_J),
+    KEYWORD("call",   'c', 'a', 'l', TOKEN_INSTRUCTION, INST_CALL),
+    KEYWORD("ret",    'r', 'e', 't', TOKEN_INSTRUCTION, INST_RET),
+    KEYWORD("mov",    'm', 'o', 'v', TOKEN_INSTRUCTION, INST_MOV),
+    KEYWORD("nop",    'n', 'o', 'p', TOKEN_INSTRUCTION, INST_NOP),
+    KEYWORD(".word",  '.', 'w', 'd', TOKEN_WORD_DIRECTIVE, INST_WORD),
+    KEYWORD(".ascii", '.', 'a', 'i', TOKEN_ASCII_DIRECTIVE, INST_ASCII),
+    KEYWORD(".asciz", '.', 'a', 'z', TOKEN_ASCIZ_DIRECTIVE, INST_ASCIZ),
+    KEYWORD(".global", '.', 'g', 'l', TOKEN_GLOBAL_DIRECTIVE, 0),
+    KEYWORD(".include", '.', 'i', 'e', TOKEN_INCLUDE_DIRECTIVE, 0),
+    KEYWORD(".macro", '.', 'm', 'o', TOKEN_MACRO_DIRECTIVE, 0),
+    KEYWORD(".endm",  '.', 'e', 'm', TOKEN_ENDM_DIRECTIVE, 0),
+    KEYWORD(".rept",  '.', 'r', 't', TOKEN_REPT_DIRECTIVE, 0),
+    KEYWORD(".irp",   '.', 'i', 'p', TOKEN_IRP_DIRECTIVE, 0),
+    KEYWORD(".endr",  '.', 'e', 'r', TOKEN_ENDR_DIRECTIVE, 0),
+    KEYWORD("%hi",    '%', 'h', 'i', TOKEN_LABEL_HI, 0),
+    KEYWORD("%lo",    '%', 'l', 'o', TOKEN_LABEL_LO, 0),
+    KEYWORD("r0",     'r', '0', '0', TOKEN_REGISTER, 0),
+    KEYWORD("r1",     'r', '1', '1', TOKEN_REGISTER, 1),
+    KEYWORD("r2",     'r', '2', '2', TOKEN_REGISTER, 2),
+    KEYWORD("r3",     'r', '3', '3', TOKEN_REGISTER, 3),
+    KEYWORD("r4",     'r', '4', '4', TOKEN_REGISTER, 4),
+    KEYWORD("r5",     'r', '5', '5', TOKEN_REGISTER, 5),
+    KEYWORD("r6",     'r', '6', '6', TOKEN_REGISTER, 6),
+    KEYWORD("r7",     'r', '7', '7', TOKEN_REGISTER, 7),
 };
 
-static const char* instruction_names[] = {
-    "add", "sub", "mul", "div",
-    "jalr", "sw", "lw",
-    "lhi", "lli",
-    "bne", "beq", "blt",
-    NULL
-};
+static const Keyword* keyword_lookup(const char* str, size_t len) {
+    if (len < 1 || len > 8) return NULL;
+    const unsigned char* s = (const unsigned char*)str;
+    const Keyword* keyword = &keywords[KEYWORD_HASH(len, s[0], s[len > 1], s[len - 1])];
+    if (keyword->length != len || memcmp(keyword->name, str, len) != 0) return NULL;
+    return keyword;
+}
 
 // Token type names for debugging
 static const char* token_type_names[] = {
@@ -35,402 +85,313 @@ static const char* token_type_names[] = {
     "TOKEN_WORD_DIRECTIVE",
     "TOKEN_ASCII_DIRECTIVE",
     "TOKEN_ASCIZ_DIRECTIVE",
+    "TOKEN_GLOBAL_DIRECTIVE",
+    "TOKEN_INCLUDE_DIRECTIVE",
+    "TOKEN_MACRO_DIRECTIVE",
+    "TOKEN_ENDM_DIRECTIVE",
+    "TOKEN_REPT_DIRECTIVE",
+    "TOKEN_IRP_DIRECTIVE",
+    "TOKEN_ENDR_DIRECTIVE",
+    "TOKEN_MACRO_PARAM",
     "TOKEN_STRING_LITERAL",
     "TOKEN_EOF",
     "TOKEN_ERROR"
 };
 
-static bool is_register(const char* str) {
-    for (int i = 0; register_names[i] != NULL; i++) {
-        if (strcmp(str, register_names[i]) == 0) {
-            return true;
-        }
+// Appends a token to the arena, growing it geometrically. The arena always
+// keeps one free slot so the EOF token can be added without a check.
+static Token* push_token(TokenList* list, TokenType type, const char* start, size_t len, int line) {
+    if (list->count + 1 >= list->capacity) {
+        size_t capacity = list->capacity * 2;
+        Token* grown = mem_realloc(list->tokens, capacity * sizeof(Token));
+        if (!grown) return NULL;
+        list->tokens = grown;
+        list->capacity = capacity;
     }
-    return false;
-}
-
-static bool is_instruction(const char* str) {
-    if (strcmp(str, ".word") == 0) return true;
-    if (strcmp(str, ".ascii") == 0) return true;
-    if (strcmp(str, ".asciz") == 0) return true;
-    for (int i = 0; instruction_names[i] != NULL; i++) {
-        if (strcmp(str, instruction_names[i]) == 0) {
-            return true;
-        }
-    }
-    return false;
-}
-
-static Token* create_token(TokenType type, const char* value, int line, int column) {
-    Token* token = malloc(sizeof(Token));
-    if (!token) return NULL;
 
+    Token* token = &list->tokens[list->count++];
     token->type = type;
+    token->reserved = 0;
+    token->file = list->file;
+    token->offset = (uint32_t)(start - list->source);
+    token->length = (uint32_t)len;
+    token->value.immediate = 0;
     token->line = line;
-    token->column = column;
-
-    // Initialize the appropriate union member based on token type
-    switch (type) {
-        case TOKEN_REGISTER:
-            token->value.reg_num = atoi(value + 1);  // Skip 'r'
-            break;
-        case TOKEN_IMMEDIATE:
-            token->value.immediate = atoi(value);
-            break;
-        case TOKEN_INSTRUCTION:
-        case TOKEN_WORD_DIRECTIVE:
-        case TOKEN_ASCII_DIRECTIVE:
-        case TOKEN_ASCIZ_DIRECTIVE:
-            token->value.inst_type = get_instruction_type(value);
-            break;
-        case TOKEN_LABEL:
-        case TOKEN_LABEL_REFERENCE:
-        case TOKEN_STRING_LITERAL:
-            token->value.str = strdup(value);
-            break;
-        default:
-            token->value.str = NULL;
-    }
     return token;
 }
 
-static bool is_hex_digit(char c) {
-    return isdigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+static int hex_digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
 }
 
-static int parse_hex(const char* str) {
-    int value = 0;
-    while (*str) {
-        value = value * 16;
-        if (isdigit(*str)) {
-            value += *str - '0';
-        } else if (*str >= 'a' && *str <= 'f') {
-            value += *str - 'a' + 10;
-        } else if (*str >= 'A' && *str <= 'F') {
-            value += *str - 'A' + 10;
-        }
-        str++;
+// Returns the length of the escape sequence starting at the backslash in
+// str, or 0 if it is not a recognised escape.
+static size_t escape_length(const char* str, const char* end) {
+    if (end - str < 2) return 0;
+    switch (str[1]) {
+        case 'n': case 't': case 'r': case '\\': case '"': case '0':
+            return 2;
+        default:
+            return 0;
     }
-    return value & 0xFFFF;  // Ensure 16-bit value
 }
 
-static char parse_escape_sequence(const char** p, int* column) {
-    (*p)++;  // Skip the backslash
-    (*column)++;
-    
-    switch (**p) {
-        case 'n':  (*p)++; (*column)++; return '\n';
-        case 't':  (*p)++; (*column)++; return '\t';
-        case 'r':  (*p)++; (*column)++; return '\r';
-        case '\\': (*p)++; (*column)++; return '\\';
-        case '\"': (*p)++; (*column)++; return '\"';
-        case '0':  (*p)++; (*column)++; return '\0';
-        default:
-            fprintf(stderr, "Error: Unknown escape sequence '\\%c' at line %d\n", **p, *column);
-            return '\\';  // Return backslash as fallback
+// Decodes one character of a string literal body and advances *p past it.
+// The lexer has already validated the escape sequences.
+char lexer_string_char(const char** p) {
+    const char* s = *p;
+    if (*s != '\\') {
+        *p = s + 1;
+        return *s;
+    }
+
+    *p = s + 2;
+    switch (s[1]) {
+        case 'n':  return '\n';
+        case 't':  return '\t';
+        case 'r':  return '\r';
+        case '\\': return '\\';
+        case '"':  return '"';
+        case '0':  return '\0';
+        default:   return s[1];
     }
 }
 
-void debug_print_tokens(Token* tokens) {
-    printf("\nTokens:\n");
-    printf("=======\n");
-    
-    for (int i = 0; tokens[i].type != TOKEN_EOF; i++) {
-        Token* token = &tokens[i];
-        printf("%3d: %-12s ", i, token_type_names[token->type]);
-        
+static int token_column(const char* source, uint32_t offset) {
+    const char* p = source + offset;
+    while (p > source && p[-1] != '\n') p--;
+    return (int)(source + offset - p) + 1;
+}
+
+void debug_print_tokens(TokenList* list) {
+    trace_printf("\nTokens:\n");
+    trace_printf("=======\n");
+
+    for (size_t i = 0; i < list->count; i++) {
+        Token* token = &list->tokens[i];
+        trace_printf("%3zu: %-12s ", i, token_type_names[token->type]);
+
         // Print the appropriate value based on token type
         switch (token->type) {
             case TOKEN_REGISTER:
-                printf("r%d", token->value.reg_num);
+                trace_printf("r%d", token->value.reg_num);
                 break;
             case TOKEN_IMMEDIATE:
-                printf("%d", token->value.immediate);
-                break;
-            case TOKEN_INSTRUCTION:
-            case TOKEN_WORD_DIRECTIVE:
-            case TOKEN_ASCII_DIRECTIVE:
-            case TOKEN_ASCIZ_DIRECTIVE:
-                printf("%s", 
-                    token->value.inst_type == INST_ADD ? "add" :
-                    token->value.inst_type == INST_SUB ? "sub" :
-                    token->value.inst_type == INST_MUL ? "mul" :
-                    token->value.inst_type == INST_DIV ? "div" :
-                    token->value.inst_type == INST_JALR ? "jalr" :
-                    token->value.inst_type == INST_SW ? "sw" :
-                    token->value.inst_type == INST_LW ? "lw" :
-                    token->value.inst_type == INST_LHI ? "lhi" :
-                    token->value.inst_type == INST_LLI ? "lli" :
-                    token->value.inst_type == INST_BNE ? "bne" :
-                    token->value.inst_type == INST_BEQ ? "beq" :
-                    token->value.inst_type == INST_BLT ? "blt" :
-                    token->value.inst_type == INST_WORD ? ".word" :
-                    token->value.inst_type == INST_ASCII ? ".ascii" :
-                    token->value.inst_type == INST_ASCIZ ? ".asciz" : "???");
-                break;
-            case TOKEN_LABEL:
-            case TOKEN_LABEL_REFERENCE:
-            case TOKEN_LABEL_HI:
-            case TOKEN_LABEL_LO:
-            case TOKEN_STRING_LITERAL:
-                printf("'%s'", token->value.str);
+                trace_printf("%d", token->value.immediate);
                 break;
             default:
-                printf("'%s'", token->value.str ? token->value.str : "");
+                trace_printf("'%.*s'", (int)token->length, list->source + token->offset);
         }
-        
-        printf(" at line %d, col %d\n", token->line, token->column);
+
+        trace_printf(" at line %d, col %d\n", token->line, token_column(list->source, token->offset));
     }
-    printf("=======\n\n");
+    trace_printf("=======\n\n");
 }
 
-Token* lexer_init(const char* input) {
-    Token* tokens = malloc(sizeof(Token) * MAX_TOKENS);
-    if (!tokens) return NULL;
+TokenList* lexer_init(Assembler* as, int file, const char* input, size_t length) {
+    const char* note = assembler_file_note(as, file);
+    if (length > UINT32_MAX) {
+        assembler_report(as, "Error: Input too large (%zu bytes)%s\n", length, note);
+        return NULL;
+    }
+
+    TokenList* list = mem_alloc(sizeof(TokenList));
+    if (!list) {
+        assembler_report(as, "Error: Out of memory\n");
+        return NULL;
+    }
+    list->source = input;
+    list->file = (uint16_t)file;
+    list->preprocess = false;
+    list->count = 0;
+    list->capacity = length / 8 > INITIAL_TOKEN_CAPACITY ? length / 8 : INITIAL_TOKEN_CAPACITY;
+    list->tokens = mem_alloc(list->capacity * sizeof(Token));
+    if (!list->tokens) {
+        assembler_report(as, "Error: Out of memory\n");
+        mem_free(list);
+        return NULL;
+    }
+
+    scan_init();
 
-    int token_count = 0;
     int line = 1;
-    int column = 1;
+    const char* line_start = input;
     const char* p = input;
+    const char* end = input + length;
 
-    while (*p && token_count < MAX_TOKENS - 1) {
-        // Skip whitespace
-        while (*p && isspace(*p)) {
-            if (*p == '\n') {
-                line++;
-                column = 1;
-            } else {
-                column++;
-            }
-            p++;
-        }
-        if (!*p) break;
+    while (p < end) {
+        // Skip whitespace, counting the newlines crossed
+        p = scan_whitespace(p, end, &line, &line_start);
+        if (p >= end) break;
 
-        // Handle comments
+        // Handle comments; the newline is left for the whitespace scan
         if (*p == '#') {
-            while (*p && *p != '\n') {
-                p++;
-                column++;
-            }
+            p = scan_line_end(p, end);
             continue;
         }
 
-        // Handle string literals
+        // Handle string literals; the token covers the text between the quotes
         if (*p == '"') {
-            p++;  // Skip opening quote
-            column++;
-            char* str = malloc(256);  // Temporary buffer for unescaped string
-            int str_len = 0;
-            
-            while (*p && *p != '"') {
-                if (*p == '\n') {
-                    fprintf(stderr, "Error: Unterminated string literal at line %d\n", line);
-                    free(str);
-                    lexer_free(tokens);
-                    return NULL;
-                }
-                
+            const char* start = ++p;
+            while (p < end && *p != '"') {
+                if (*p == '\n') break;
                 if (*p == '\\') {
-                    str[str_len++] = parse_escape_sequence(&p, &column);
+                    size_t n = escape_length(p, end);
+                    if (n == 0) {
+                        assembler_report(as, "Error: Unknown escape sequence '\\%c' at line %d, column %d%s\n",
+                                p + 1 < end ? p[1] : ' ', line, (int)(p - line_start) + 1, note);
+                        lexer_free(list);
+                        return NULL;
+                    }
+                    p += n;
                 } else {
-                    str[str_len++] = *p;
                     p++;
-                    column++;
-                }
-                
-                if (str_len >= 255) {  // Leave room for null terminator
-                    fprintf(stderr, "Error: String literal too long at line %d\n", line);
-                    free(str);
-                    lexer_free(tokens);
-                    return NULL;
                 }
             }
-            
-            if (!*p) {
-                fprintf(stderr, "Error: Unterminated string literal at line %d\n", line);
-                free(str);
-                lexer_free(tokens);
+
+            if (p >= end || *p != '"') {
+                assembler_report(as, "Error: Unterminated string literal at line %d%s\n", line, note);
+                lexer_free(list);
                 return NULL;
             }
-            
-            str[str_len] = '\0';
-            tokens[token_count++] = *create_token(TOKEN_STRING_LITERAL, str, line, column - str_len - 1);
-            free(str);
+
+            if (!push_token(list, TOKEN_STRING_LITERAL, start, p - start, line)) goto fail;
             p++;  // Skip closing quote
-            column++;
             continue;
         }
 
-        // Handle labels (any word ending with ':')
-        if (isalpha(*p) || *p == '_') {
+        // Handle identifiers, instructions and labels
+        if (isalpha((unsigned char)*p) || *p == '_' || *p == '.' || *p == '%') {
             const char* start = p;
-            while (*p && (isalnum(*p) || *p == '_')) {
-                p++;
-                column++;
-            }
-            
-            // Check if this is a label definition (ends with ':')
-            if (*p == ':') {
-                int len = p - start;
-                char* label = malloc(len + 1);
-                strncpy(label, start, len);
-                label[len] = '\0';
-                tokens[token_count++] = *create_token(TOKEN_LABEL, label, line, column - len);
-                free(label);
-                p++; // Skip the colon
-                column++;
-                
-                // Skip any whitespace after the label
-                while (*p && isspace(*p)) {
-                    if (*p == '\n') {
-                        line++;
-                        column = 1;
-                    } else {
-                        column++;
-                    }
-                    p++;
-                }
+            p = scan_identifier(p, end);
+            size_t len = p - start;
+
+            // Label definition: a plain word (no '.' or '%') followed by ':'
+            if (p < end && *p == ':' && !memchr(start, '.', len) && !memchr(start, '%', len)) {
+                Token* token = push_token(list, TOKEN_LABEL, start, len, line);
+                if (!token) goto fail;
+                token->value.symbol_id = symbol_table_intern(&as->symbols, start, len);
+                if (token->value.symbol_id < 0) goto fail;
+                p++;  // Skip the colon
                 continue;
             }
-            
-            // If not a label definition, rewind and handle as identifier/instruction
-            p = start;
-            column = column - (p - start);
-        }
 
-        // Handle identifiers and instructions
-        if (isalpha(*p) || *p == '_' || *p == '.' || *p == '%') {
-            const char* start = p;
-            while (*p && (isalnum(*p) || *p == '_' || *p == '.' || *p == '%')) {
-                p++;
-                column++;
-            }
-            int len = p - start;
-            char* ident = malloc(len + 1);
-            strncpy(ident, start, len);
-            ident[len] = '\0';
-
-            TokenType type;
-            if (strcmp(ident, ".word") == 0) {
-                type = TOKEN_WORD_DIRECTIVE;
-            } else if (strcmp(ident, ".ascii") == 0) {
-                type = TOKEN_ASCII_DIRECTIVE;
-            } else if (strcmp(ident, ".asciz") == 0) {
-                type = TOKEN_ASCIZ_DIRECTIVE;
-            } else if (strcmp(ident, "%hi") == 0) {
-                type = TOKEN_LABEL_HI;
-            } else if (strcmp(ident, "%lo") == 0) {
-                type = TOKEN_LABEL_LO;
-            } else if (is_instruction(ident)) {
-                type = TOKEN_INSTRUCTION;
-            } else if (is_register(ident)) {
-                type = TOKEN_REGISTER;
-            } else {
+            const Keyword* keyword = keyword_lookup(start, len);
+            if (!keyword) {
                 // This is a label reference (used in branch instructions)
-                type = TOKEN_LABEL_REFERENCE;
+                Token* token = push_token(list, TOKEN_LABEL_REFERENCE, start, len, line);
+                if (!token) goto fail;
+                token->value.symbol_id = symbol_table_intern(&as->symbols, start, len);
+                if (token->value.symbol_id < 0) goto fail;
+                continue;
             }
 
-            tokens[token_count++] = *create_token(type, ident, line, column - len);
-            free(ident);
+            Token* token = push_token(list, keyword->type, start, len, line);
+            if (!token) goto fail;
+            if (keyword->type >= TOKEN_INCLUDE_DIRECTIVE) list->preprocess = true;
+            if (keyword->type == TOKEN_REGISTER) {
+                token->value.reg_num = keyword->value;
+            } else {
+                token->value.inst_type = keyword->value;
+            }
             continue;
         }
 
-        // Handle immediate values (decimal and hexadecimal)
-        if (isdigit(*p) || *p == '-') {
+        // Handle immediate values (decimal and hexadecimal), scanned in place
+        if (isdigit((unsigned char)*p) || *p == '-') {
             const char* start = p;
-            int value = 0;
+            bool negative = false;
+            uint32_t value = 0;
 
             if (*p == '-') {
+                negative = true;
                 p++;
-                column++;
             }
-
+            if (p >= end || !isdigit((unsigned char)*p)) {
+                assembler_report(as, "Error: Expected digits after '-' at line %d, column %d%s\n",
+                        line, (int)(start - line_start) + 1, note);
+                lexer_free(list);
+                return NULL;
+            }
 
             // Check for hexadecimal format (0x...)
-            if (*p == '0' && (*(p + 1) == 'x' || *(p + 1) == 'X')) {
+            if (end - p > 1 && *p == '0' && (p[1] == 'x' || p[1] == 'X')) {
                 p += 2;  // Skip '0x'
-                column += 2;
-                start = p;  // Reset start to after '0x'
-
-                // Parse hex digits
-                while (*p && is_hex_digit(*p)) {
+                int digit;
+                while (p < end && (digit = hex_digit_value(*p)) >= 0) {
+                    value = (value << 4) | (uint32_t)digit;
                     p++;
-                    column++;
-                }
-                int len = p - start;
-                if (len > 0) {
-                    char* hex_str = malloc(len + 1);
-                    strncpy(hex_str, start, len);
-                    hex_str[len] = '\0';
-                    value = parse_hex(hex_str);
-                    free(hex_str);
                 }
             } else {
-                // Parse decimal digits
-                while (*p && isdigit(*p)) {
+                while (p < end && isdigit((unsigned char)*p)) {
+                    value = value * 10 + (uint32_t)(*p - '0');
                     p++;
-                    column++;
                 }
-                int len = p - start;
-                char* num = malloc(len + 1);
-                strncpy(num, start, len);
-                num[len] = '\0';
-                value = atoi(num);
-                free(num);
             }
+            if (negative) value = 0u - value;
 
-            printf("Immediate parsed: %d\n", value);
-
-            // Clamp values
-            value = (value) & 0xFFFF;  // For hex, always unsigned
+            TRACE(TRACE_LEXER, TRACE_VERBOSE, "lexer: immediate %d at line %d\n",
+                  (int)(int16_t)(value & 0xFFFF), line);
 
+            Token* token = push_token(list, TOKEN_IMMEDIATE, start, p - start, line);
+            if (!token) goto fail;
+            token->value.immediate = (int16_t)(value & 0xFFFF);  // Clamp to 16 bits
+            continue;
+        }
 
-            // Convert the value to a string for debugging
-            char value_str[32];
-            snprintf(value_str, sizeof(value_str), "%d", value);
-            tokens[token_count++] = *create_token(TOKEN_IMMEDIATE, value_str, line, column - (p - start));
+        // Handle macro parameter references; the token covers the name
+        if (*p == '\\' && p + 1 < end &&
+            (isalpha((unsigned char)p[1]) || p[1] == '_')) {
+            const char* start = ++p;
+            p = scan_identifier(p, end);
+            if (!push_token(list, TOKEN_MACRO_PARAM, start, p - start, line)) goto fail;
+            list->preprocess = true;
             continue;
         }
 
         // Handle special characters
+        TokenType type;
         switch (*p) {
-            case ',':
-                tokens[token_count++] = *create_token(TOKEN_COMMA, ",", line, column);
-                break;
-            case '(':
-                tokens[token_count++] = *create_token(TOKEN_LPAREN, "(", line, column);
-                break;
-            case ')':
-                tokens[token_count++] = *create_token(TOKEN_RPAREN, ")", line, column);
-                break;
+            case ',': type = TOKEN_COMMA; break;
+            case '(': type = TOKEN_LPAREN; break;
+            case ')': type = TOKEN_RPAREN; break;
             default:
-                fprintf(stderr, "Error: Unexpected character '%c' at line %d, column %d\n",
-                        *p, line, column);
-                lexer_free(tokens);
+                assembler_report(as, "Error: Unexpected character '%c' at line %d, column %d%s\n",
+                        *p, line, (int)(p - line_start) + 1, note);
+                lexer_free(list);
                 return NULL;
         }
+        if (!push_token(list, type, p, 1, line)) goto fail;
         p++;
-        column++;
     }
 
-    // Add EOF token
-    tokens[token_count] = *create_token(TOKEN_EOF, "", line, column);
-    
-    // Print debug information
-    debug_print_tokens(tokens);
-    
-    return tokens;
+    // Add EOF token; push_token always leaves room for it
+    Token* eof = &list->tokens[list->count];
+    eof->type = TOKEN_EOF;
+    eof->reserved = 0;
+    eof->file = (uint16_t)file;
+    eof->offset = (uint32_t)length;
+    eof->length = 0;
+    eof->value.immediate = 0;
+    eof->line = line;
+
+    TRACE(TRACE_LEXER, TRACE_INFO, "lexer: %zu tokens, %d lines, %zu bytes\n",
+          list->count, line, length);
+    if (TRACE_ENABLED(TRACE_LEXER, TRACE_DEBUG)) debug_print_tokens(list);
+
+    return list;
+
+fail:
+    assembler_report(as, "Error: Out of memory at line %d%s\n", line, note);
+    lexer_free(list);
+    return NULL;
 }
 
-void lexer_free(Token* tokens) {
-    if (!tokens) return;
-    for (int i = 0; tokens[i].type != TOKEN_EOF; i++) {
-        // Only free string values
-        if (tokens[i].type == TOKEN_LABEL ||
-            tokens[i].type == TOKEN_LABEL_REFERENCE ||
-            tokens[i].type == TOKEN_STRING_LITERAL) {
-            free(tokens[i].value.str);
-        }
-    }
-    free(tokens);
-} 
\ No newline at end of file
+void lexer_free(TokenList* list) {
+    if (!list) return;
+    mem_free(list->tokens);
+    mem_free(list);
+}
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+#define MAX_IMAGE_SIZE 65536  // 2^16 words of address space
+
+// Links relocatable objects into a flat image. Sections with the same name
+// are merged in command-line order, and the merged sections are laid out
+// from address 0 in order of first appearance, so the first object's .text
+// comes first. Global symbols go into the assembler's symbol table; local
+// symbols only ever resolve relocations of their own object.
+typedef struct {
+    const char* name;
+    uint32_t size;         // Words
+    uint32_t base;         // Address of the merged section
+    uint32_t cursor;       // Next free word while placing objects
+} MergedSection;
+
+typedef struct {
+    Assembler* as;
+    ObjectFile* objects;
+    char* const* inputs;
+    size_t count;
+    uint32_t** bases;      // Per object, the address of each of its sections
+    MergedSection* merged;
+    size_t merged_count;
+    uint16_t* image;
+    size_t image_size;
+} Linker;
+
+static const char* object_string(const ObjectFile* object, uint32_t offset) {
+    return object->strings + offset;
+}
+
+static bool lay_out(Linker* linker) {
+    size_t capacity = 0;
+    for (size_t i = 0; i < linker->count; i++) capacity += linker->objects[i].header->section_count;
+    linker->merged = mem_calloc(capacity ? capacity : 1, sizeof(MergedSection));
+    linker->bases = mem_calloc(linker->count, sizeof(uint32_t*));
+    if (!linker->merged || !linker->bases) return false;
+
+    // Collect section names in order of first appearance with their sizes
+    for (size_t i = 0; i < linker->count; i++) {
+        const ObjectFile* object = &linker->objects[i];
+        linker->bases[i] = mem_calloc(object->header->section_count + 1, sizeof(uint32_t));
+        if (!linker->bases[i]) return false;
+        for (size_t s = 0; s < object->header->section_count; s++) {
+            const char* name = object_string(object, object->sections[s].name);
+            size_t m = 0;
+            while (m < linker->merged_count && strcmp(linker->merged[m].name, name) != 0) m++;
+            if (m == linker->merged_count) linker->merged[linker->merged_count++].name = name;
+            linker->merged[m].size += object->sections[s].size;
+        }
+    }
+
+    uint32_t address = 0;
+    for (size_t m = 0; m < linker->merged_count; m++) {
+        linker->merged[m].base = address;
+        linker->merged[m].cursor = address;
+        address += linker->merged[m].size;
+    }
+    linker->image_size = address;
+
+    // Place each object's sections and copy their contents
+    linker->image = mem_calloc(address ? address : 1, sizeof(uint16_t));
+    if (!linker->image) return false;
+    if (address > MAX_IMAGE_SIZE) return true;  // Reported by the caller
+    for (size_t i = 0; i < linker->count; i++) {
+        const ObjectFile* object = &linker->objects[i];
+        const uint16_t* words = object->words;
+        for (size_t s = 0; s < object->header->section_count; s++) {
+            const char* name = object_string(object, object->sections[s].name);
+            size_t m = 0;
+            while (strcmp(linker->merged[m].name, name) != 0) m++;
+            uint32_t size = object->sections[s].size;
+            linker->bases[i][s] = linker->merged[m].cursor;
+            memcpy(linker->image + linker->merged[m].cursor, words, size * sizeof(uint16_t));
+            linker->merged[m].cursor += size;
+            words += size;
+        }
+    }
+    return true;
+}
+
+// Enters every defined global symbol at its final address
+static bool define_globals(Linker* linker) {
+    Assembler* as = linker->as;
+    bool ok = true;
+    for (size_t i = 0; i < linker->count; i++) {
+        const ObjectFile* object = &linker->objects[i];
+        for (size_t j = 0; j < object->header->symbol_count; j++) {
+            const ObjSymbol* symbol = &object->symbols[j];
+            if (symbol->binding != OBJ_GLOBAL || symbol->section < 0) continue;
+
+            const char* name = object_string(object, symbol->name);
+            int id = symbol_table_intern(&as->symbols, name, strlen(name));
+            if (id < 0) {
+                assembler_report(as, "Error: Out of memory\n");
+                return false;
+            }
+            uint16_t address = (uint16_t)(linker->bases[i][symbol->section] + symbol->value);
+            if (!symbol_table_define(&as->symbols, id, address)) {
+                assembler_report(as, "Error: Symbol '%s' redefined in '%s'\n", name,
+                                 linker->inputs[i]);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+static bool apply_relocations(Linker* linker) {
+    Assembler* as = linker->as;
+    bool ok = true;
+    for (size_t i = 0; i < linker->count; i++) {
+        const ObjectFile* object = &linker->objects[i];
+        for (size_t j = 0; j < object->header->reloc_count; j++) {
+            const ObjReloc* reloc = &object->relocs[j];
+            const ObjSymbol* symbol = &object->symbols[reloc->symbol];
+            const char* name = object_string(object, symbol->name);
+
+            uint16_t target;
+            if (symbol->section >= 0) {
+                target = (uint16_t)(linker->bases[i][symbol->section] + symbol->value);
+            } else {
+                int id = symbol_table_intern(&as->symbols, name, strlen(name));
+                if (id < 0) {
+                    assembler_report(as, "Error: Out of memory\n");
+                    return false;
+                }
+                const SymbolEntry* entry = symbol_table_entry(&as->symbols, id);
+                if (!entry->is_defined) {
+                    assembler_report(as, "Error: Undefined symbol '%s' in '%s'\n", name,
+                                     linker->inputs[i]);
+                    ok = false;
+                    continue;
+                }
+                target = entry->value;
+            }
+
+            uint16_t address = (uint16_t)(linker->bases[i][reloc->section] + reloc->offset);
+            uint16_t bits;
+            if (!codegen_resolve(reloc->kind, address, target, &bits)) {
+                assembler_report(as, "Error: Branch to '%s' out of range at 0x%04X in '%s'\n",
+                                 name, address, linker->inputs[i]);
+                ok = false;
+                continue;
+            }
+            linker->image[address] |= bits;
+            TRACE(TRACE_SYMBOLS, TRACE_VERBOSE, "link: %s at 0x%04X -> 0x%04X\n",
+                  name, address, target);
+        }
+    }
+    return ok;
+}
+
+static bool write_image(Assembler* as, const char* filename, const uint16_t* image, size_t size) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        assembler_report(as, "Error: Could not open file '%s' for writing\n", filename);
+        return false;
+    }
+    bool ok = fwrite(image, sizeof(uint16_t), size, file) == size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) assembler_report(as, "Error: Could not write file '%s'\n", filename);
+    return ok;
+}
+
+// Links the objects named by inputs into the image file output
+bool link_objects(Assembler* as, char* const* inputs, size_t count, const char* output) {
+    Stats* previous = stats_attach(&as->stats);
+    Linker linker = { 0 };
+    linker.as = as;
+    linker.inputs = inputs;
+    linker.count = count;
+    bool ok = symbol_table_init(&as->symbols);
+    if (ok) linker.objects = mem_calloc(count ? count : 1, sizeof(ObjectFile));
+    if (!ok || !linker.objects) {
+        assembler_report(as, "Error: Out of memory\n");
+        ok = false;
+        goto done;
+    }
+
+    stats_begin(&as->stats, PHASE_READ);
+    for (size_t i = 0; i < count; i++) {
+        if (!object_read(as, inputs[i], &linker.objects[i])) ok = false;
+        else as->stats.bytes_read += linker.objects[i].size;
+    }
+    stats_end(&as->stats, PHASE_READ);
+    if (!ok) goto done;
+
+    stats_begin(&as->stats, PHASE_LINK);
+    if (!lay_out(&linker)) {
+        assembler_report(as, "Error: Out of memory\n");
+        ok = false;
+    } else if (linker.image_size > MAX_IMAGE_SIZE) {
+        assembler_report(as, "Error: Linked program exceeds %d words (%zu)\n",
+                         MAX_IMAGE_SIZE, linker.image_size);
+        ok = false;
+    } else {
+        // Both passes run to the end so every problem is reported at once
+        ok = define_globals(&linker);
+        ok = apply_relocations(&linker) && ok;
+    }
+    stats_end(&as->stats, PHASE_LINK);
+    as->stats.words = linker.image_size;
+    TRACE(TRACE_SYMBOLS, TRACE_INFO, "link: %zu objects, %zu sections, %zu words\n",
+          count, linker.merged_count, linker.image_size);
+    if (TRACE_ENABLED(TRACE_SYMBOLS, TRACE_DEBUG)) debug_print_symbol_table(&as->symbols);
+
+    if (ok) {
+        stats_begin(&as->stats, PHASE_WRITE);
+        ok = write_image(as, output, linker.image, linker.image_size);
+        stats_end(&as->stats, PHASE_WRITE);
+    }
+
+done:
+    for (size_t i = 0; linker.bases && i < count; i++) mem_free(linker.bases[i]);
+    for (size_t i = 0; linker.objects && i < count; i++) object_free(&linker.objects[i]);
+    mem_free(linker.bases);
+    mem_free(linker.merged);
+    mem_free(linker.image);
+    mem_free(linker.objects);
+    as->stats.symbol_lookups = as->symbols.lookups;
+    as->stats.symbol_probes = as->symbols.probes;
+    as->stats.symbol_collisions = as->symbols.collisions;
+    stats_attach(previous);
+    return ok;
+}
@@ -1,87 +1,244 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <time.h>
 #include "asm.h"
 
-#define MAX_FILE_SIZE 4096
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options] <input.asm|-> <output.bin>\n", program);
+    fprintf(stderr, "       %s [options] --batch <input.asm>...\n", program);
+    fprintf(stderr, "       %s [options] --manifest=FILE\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -c                 Emit a relocatable object for beag-ld instead of an image\n");
+    fprintf(stderr, "  -I DIR             Search DIR for .include files\n");
+    fprintf(stderr, "  -O                 Run the peephole optimizer\n");
+    fprintf(stderr, "  --depfile[=FILE]   Write a make dependency file (default: output with .d)\n");
+    fprintf(stderr, "  --layout=PROFILE   Lay out code by a profile saved with beag-sim --record\n");
+    fprintf(stderr, "  --map[=FILE]       Write an image map for beag-sim (default: output with .map)\n");
+    fprintf(stderr, "  --cost[=json]      Print the static cost of the image's blocks, functions and loops\n");
+    fprintf(stderr, "  --latency=FILE     Cycles per opcode for --cost, as 'mnemonic cycles' lines\n");
+    fprintf(stderr, "  --batch            Assemble every input to <input>.bin (or .o), in parallel\n");
+    fprintf(stderr, "  --manifest=FILE    Batch-assemble the 'input [output]' lines of FILE\n");
+    fprintf(stderr, "  --out-dir=DIR      Write batch outputs to DIR\n");
+    fprintf(stderr, "  -j, --jobs=N       Batch worker threads (default: one per CPU)\n");
+    fprintf(stderr, "  --cache-dir=DIR    Reuse images of unchanged sources cached in DIR\n");
+    fprintf(stderr, "  --trace=SPEC       Trace categories, e.g. 'lexer,codegen:verbose' or 'all'\n");
+    fprintf(stderr, "                     (lexer, parser, symbols, codegen; info, debug, verbose)\n");
+    fprintf(stderr, "  --trace-file=PATH  Write trace output to PATH instead of stderr\n");
+    fprintf(stderr, "  --stats[=json]     Print phase timings and counters to stdout\n");
+    fprintf(stderr, "Registers: r6 is overwritten by call, long j and relaxed branches;\n");
+    fprintf(stderr, "           r7 holds the return address of call\n");
+}
 
-static char* read_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Could not open file '%s'\n", filename);
-        return NULL;
-    }
+enum {
+    OPT_TRACE = 256,
+    OPT_TRACE_FILE,
+    OPT_STATS,
+    OPT_BATCH,
+    OPT_MANIFEST,
+    OPT_OUT_DIR,
+    OPT_CACHE_DIR,
+    OPT_DEPFILE,
+    OPT_MAP,
+    OPT_LAYOUT,
+    OPT_COST,
+    OPT_LATENCY
+};
 
-    char* buffer = malloc(MAX_FILE_SIZE);
-    if (!buffer) {
-        fclose(file);
-        return NULL;
-    }
-
-    size_t size = fread(buffer, 1, MAX_FILE_SIZE - 1, file);
-    buffer[size] = '\0';
-    fclose(file);
-    return buffer;
+static double elapsed_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
 }
 
-static void write_file(const char* filename, uint16_t* code, size_t size) {
-    FILE* file = fopen(filename, "wb");
-    if (!file) {
-        fprintf(stderr, "Error: Could not open file '%s' for writing\n", filename);
-        return;
-    }
+// Assembles every job across threads, then prints diagnostics per file
+static int run_batch(BatchJob* jobs, size_t count, int threads, const AsmOptions* options,
+                     bool show_stats, bool stats_json) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = batch_run(jobs, count, threads, options);
+    double elapsed = elapsed_since(&start);
+    batch_report(jobs, count, stderr);
 
-    fwrite(code, sizeof(uint16_t), size, file);
-    fclose(file);
+    if (show_stats) {
+        Stats total = { 0 };
+        size_t failed = 0;
+        for (size_t i = 0; i < count; i++) {
+            stats_merge(&total, &jobs[i].stats);
+            failed += !jobs[i].ok;
+        }
+        stats_report(&total, stdout, stats_json);
+        if (!stats_json) {
+            printf("Batch:      %zu files, %zu failed, %d threads, %.3f ms wall (%.0f files/s)\n",
+                   count, failed, threads, elapsed * 1e3, elapsed > 0 ? count / elapsed : 0);
+        }
+    }
+    return ok ? 0 : 1;
 }
 
 int main(int argc, char** argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input.asm> <output.bin>\n", argv[0]);
+    static const struct option options[] = {
+        { "trace",      required_argument, NULL, OPT_TRACE },
+        { "trace-file", required_argument, NULL, OPT_TRACE_FILE },
+        { "stats",      optional_argument, NULL, OPT_STATS },
+        { "batch",      no_argument,       NULL, OPT_BATCH },
+        { "manifest",   required_argument, NULL, OPT_MANIFEST },
+        { "out-dir",    required_argument, NULL, OPT_OUT_DIR },
+        { "jobs",       required_argument, NULL, 'j' },
+        { "cache-dir",  required_argument, NULL, OPT_CACHE_DIR },
+        { "depfile",    optional_argument, NULL, OPT_DEPFILE },
+        { "map",        optional_argument, NULL, OPT_MAP },
+        { "layout",     required_argument, NULL, OPT_LAYOUT },
+        { "cost",       optional_argument, NULL, OPT_COST },
+        { "latency",    required_argument, NULL, OPT_LATENCY },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    bool show_stats = false;
+    bool stats_json = false;
+    bool cost_json = false;
+    uint16_t latencies[INST_WORD];
+    bool batch = false;
+    const char* manifest = NULL;
+    const char* out_dir = NULL;
+    int threads = batch_default_threads();
+    AsmOptions asm_options = { 0 };
+    char** include_dirs = mem_alloc((size_t)argc * sizeof(char*));
+    if (!include_dirs) {
+        fprintf(stderr, "Error: Out of memory\n");
         return 1;
     }
+    asm_options.include_dirs = include_dirs;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "cI:Ohj:", options, NULL)) != -1) {
+        switch (opt) {
+            case OPT_TRACE:
+                if (!trace_configure(optarg)) return 1;
+                break;
+            case OPT_TRACE_FILE:
+                if (!trace_open(optarg)) return 1;
+                break;
+            case OPT_STATS:
+                show_stats = true;
+                if (optarg && strcmp(optarg, "json") == 0) {
+                    stats_json = true;
+                } else if (optarg && strcmp(optarg, "text") != 0) {
+                    fprintf(stderr, "Error: Unknown stats format '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_BATCH:
+                batch = true;
+                break;
+            case OPT_MANIFEST:
+                batch = true;
+                manifest = optarg;
+                break;
+            case OPT_CACHE_DIR:
+                asm_options.cache_dir = optarg;
+                break;
+            case OPT_OUT_DIR:
+                out_dir = optarg;
+                break;
+            case 'c':
+                asm_options.relocatable = true;
+                break;
+            case 'I':
+                include_dirs[asm_options.include_dir_count++] = optarg;
+                break;
+            case 'O':
+                asm_options.optimize = true;
+                break;
+            case OPT_DEPFILE:
+                asm_options.depfile = true;
+                asm_options.depfile_name = optarg;
+                break;
+            case OPT_MAP:
+                asm_options.map = true;
+                asm_options.map_name = optarg;
+                break;
+            case OPT_LAYOUT:
+                asm_options.layout_profile = optarg;
+                break;
+            case OPT_COST:
+                asm_options.cost = true;
+                if (optarg && strcmp(optarg, "json") == 0) {
+                    cost_json = true;
+                } else if (optarg && strcmp(optarg, "text") != 0) {
+                    fprintf(stderr, "Error: Unknown cost format '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_LATENCY:
+                if (!cost_read_latencies(optarg, latencies)) return 1;
+                asm_options.latencies = latencies;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                if (threads < 1) {
+                    fprintf(stderr, "Error: Invalid job count '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
 
-    // Read input file
-    char* input = read_file(argv[1]);
-    if (!input) return 1;
-
-    // Initialize symbol table
-    symbol_table_init();
-
-    // Lexical analysis
-    Token* tokens = lexer_init(input);
-    if (!tokens) {
-        free(input);
+    if (batch && asm_options.depfile_name) {
+        fprintf(stderr, "Error: --depfile=FILE cannot name one file for a whole batch\n");
         return 1;
     }
-
-    // Parsing
-    Instruction* instructions = parser_parse(tokens);
-    if (!instructions) {
-        lexer_free(tokens);
-        free(input);
+    if (batch && asm_options.map_name) {
+        fprintf(stderr, "Error: --map=FILE cannot name one file for a whole batch\n");
         return 1;
     }
-
-    // Code generation
-    size_t code_size;
-    uint16_t* code = codegen_generate(instructions, &code_size);
-    if (!code) {
-        parser_free(instructions);
-        lexer_free(tokens);
-        free(input);
+    if (batch && asm_options.cost) {
+        fprintf(stderr, "Error: --cost reports on one image, not a whole batch\n");
+        return 1;
+    }
+    if (asm_options.relocatable &&
+        (asm_options.map || asm_options.layout_profile || asm_options.cost)) {
+        fprintf(stderr, "Error: --%s works on images, not objects\n",
+                asm_options.map ? "map" : asm_options.layout_profile ? "layout" : "cost");
         return 1;
     }
 
-    // Write output file
-    write_file(argv[2], code, code_size);
+    if (batch) {
+        BatchJob* jobs = NULL;
+        size_t count = 0, capacity = 0;
+        const char* extension = asm_options.relocatable ? ".o" : ".bin";
+        bool ok = !manifest ||
+                  batch_load_manifest(manifest, out_dir, extension, &jobs, &count, &capacity);
+        for (int i = optind; ok && i < argc; i++) {
+            ok = batch_add_job(&jobs, &count, &capacity, argv[i], NULL, out_dir, extension);
+            if (!ok) fprintf(stderr, "Error: Out of memory\n");
+        }
+        int status = ok ? run_batch(jobs, count, threads, &asm_options, show_stats, stats_json) : 1;
+        batch_free(jobs, count);
+        mem_free(include_dirs);
+        trace_close();
+        return status;
+    }
 
-    // Cleanup
-    free(code);
-    parser_free(instructions);
-    lexer_free(tokens);
-    free(input);
-    symbol_table_free();
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
 
-    return 0;
-} 
\ No newline at end of file
+    Assembler as;
+    assembler_init(&as, &asm_options, false);
+    int status = assembler_run_file(&as, argv[optind], argv[optind + 1]) ? 0 : 1;
+    if (status == 0 && asm_options.cost) cost_report(&as.cost, &as.map, stdout, cost_json);
+    assembler_free(&as);
+    mem_free(include_dirs);
+    trace_close();
+    if (show_stats) stats_report(&as.stats, stdout, stats_json);
+    return status;
+}
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+// Image maps: where each word of an image came from. The assembler writes
+// one next to an image with --map, and beag-sim reads it to put labels and
+// source lines on a profile. A map is a text file:
+//
+//   beag-map 2
+//   size <words>
+//   file <index> <path>          one per source file, main input first
+//   label <address> <name>       in address order
+//   line <address> <file> <line> where the source line changes
+//   data <address> <words>       words of .word and string directives
+//
+// Addresses are hexadecimal. A line record covers the words from its
+// address up to the next record's.
+
+#define MAP_VERSION 2
+
+static char* copy_string(const char* text, size_t length) {
+    char* copy = mem_alloc(length + 1);
+    if (!copy) return NULL;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static bool map_add_file(ImageMap* map, const char* name, size_t length) {
+    char** files = mem_realloc(map->files, (map->file_count + 1) * sizeof(char*));
+    if (!files) return false;
+    map->files = files;
+    map->files[map->file_count] = copy_string(name, length);
+    if (!map->files[map->file_count]) return false;
+    map->file_count++;
+    return true;
+}
+
+static bool map_add_label(ImageMap* map, size_t* capacity, uint16_t address,
+                          const char* name, size_t length) {
+    if (map->label_count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        MapLabel* labels = mem_realloc(map->labels, grown * sizeof(MapLabel));
+        if (!labels) return false;
+        map->labels = labels;
+        *capacity = grown;
+    }
+    MapLabel* label = &map->labels[map->label_count];
+    label->address = address;
+    label->name = copy_string(name, length);
+    if (!label->name) return false;
+    map->label_count++;
+    return true;
+}
+
+// Appends a line record. A record at the address of the previous one
+// replaces it: that line emitted no words (a label on a line of its own).
+static bool map_add_line(ImageMap* map, size_t* capacity, uint16_t address, uint32_t file,
+                         int line) {
+    if (map->line_count > 0 && map->lines[map->line_count - 1].address == address) {
+        map->line_count--;
+    }
+    if (map->line_count > 0 && map->lines[map->line_count - 1].file == file &&
+        map->lines[map->line_count - 1].line == line) {
+        return true;
+    }
+    if (map->line_count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 256;
+        MapLine* lines = mem_realloc(map->lines, grown * sizeof(MapLine));
+        if (!lines) return false;
+        map->lines = lines;
+        *capacity = grown;
+    }
+    map->lines[map->line_count].address = address;
+    map->lines[map->line_count].file = file;
+    map->lines[map->line_count].line = line;
+    map->line_count++;
+    return true;
+}
+
+// Appends a data range, merged with the previous one if it ends at address
+static bool map_add_data(ImageMap* map, size_t* capacity, uint16_t address, uint32_t size) {
+    if (map->data_count > 0) {
+        MapRange* last = &map->data[map->data_count - 1];
+        if (last->address + last->size == address) {
+            last->size += size;
+            return true;
+        }
+    }
+    if (map->data_count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 16;
+        MapRange* data = mem_realloc(map->data, grown * sizeof(MapRange));
+        if (!data) return false;
+        map->data = data;
+        *capacity = grown;
+    }
+    map->data[map->data_count].address = address;
+    map->data[map->data_count].size = size;
+    map->data_count++;
+    return true;
+}
+
+static bool is_data(uint8_t op) {
+    return op == INST_WORD || op == INST_ASCII || op == INST_ASCIZ;
+}
+
+// Builds the map of an image from its program and the address the code
+// generator gave each entry (addresses[program->count] is the image size)
+bool map_build(Assembler* as, const Program* program, const uint32_t* addresses,
+               ImageMap* map) {
+    map_free(map);
+    map->size = addresses[program->count];
+    size_t label_capacity = 0, line_capacity = 0, data_capacity = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < as->file_count; i++) {
+        const char* name = as->files[i].name ? as->files[i].name : "-";
+        ok = map_add_file(map, name, strlen(name));
+    }
+    for (size_t i = 0; ok && i < program->count; i++) {
+        if (program->op[i] != INST_LABEL) continue;
+        const SymbolEntry* symbol = symbol_table_entry(&as->symbols, program->imm[i]);
+        ok = map_add_label(map, &label_capacity, (uint16_t)addresses[i], symbol->name,
+                           symbol->length);
+    }
+    for (size_t i = 0; ok && i < program->line_count; i++) {
+        const LineEntry* entry = &program->lines[i];
+        if (addresses[entry->index] >= map->size) break;  // Trailing labels and blank lines
+        ok = map_add_line(map, &line_capacity, (uint16_t)addresses[entry->index], entry->file,
+                          entry->line);
+    }
+    for (size_t i = 0; ok && i < program->count; i++) {
+        uint32_t size = addresses[i + 1] - addresses[i];
+        if (!is_data(program->op[i]) || size == 0) continue;
+        ok = map_add_data(map, &data_capacity, (uint16_t)addresses[i], size);
+    }
+    if (!ok) {
+        assembler_report(as, "Error: Out of memory\n");
+        map_free(map);
+    }
+    return ok;
+}
+
+bool map_write(const ImageMap* map, const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (!file) return false;
+    fprintf(file, "beag-map %d\nsize %u\n", MAP_VERSION, map->size);
+    for (size_t i = 0; i < map->file_count; i++) {
+        fprintf(file, "file %zu %s\n", i, map->files[i]);
+    }
+    for (size_t i = 0; i < map->label_count; i++) {
+        fprintf(file, "label 0x%04X %s\n", map->labels[i].address, map->labels[i].name);
+    }
+    for (size_t i = 0; i < map->line_count; i++) {
+        const MapLine* line = &map->lines[i];
+        fprintf(file, "line 0x%04X %u %d\n", line->address, line->file, line->line);
+    }
+    for (size_t i = 0; i < map->data_count; i++) {
+        fprintf(file, "data 0x%04X %u\n", map->data[i].address, map->data[i].size);
+    }
+    return fclose(file) == 0;
+}
+
+// Reads a map written by map_write(). Errors are reported on stderr.
+bool map_read(const char* filename, ImageMap* map) {
+    memset(map, 0, sizeof(*map));
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open map '%s'\n", filename);
+        return false;
+    }
+
+    char* text = NULL;
+    size_t text_capacity = 0;
+    size_t label_capacity = 0, line_capacity = 0, data_capacity = 0;
+    int line_number = 0;
+    bool ok = true, memory = true;
+    ssize_t length;
+    while (ok && (length = getline(&text, &text_capacity, file)) >= 0) {
+        line_number++;
+        if (length > 0 && text[length - 1] == '\n') text[--length] = '\0';
+        unsigned address, index, version, size;
+        int line, offset = 0;
+        if (line_number == 1) {
+            ok = sscanf(text, "beag-map %u%n", &version, &offset) == 1 && !text[offset] &&
+                 version == MAP_VERSION;
+        } else if (sscanf(text, "size %u%n", &size, &offset) == 1 && !text[offset]) {
+            ok = size <= SIM_MEMORY_WORDS;
+            map->size = size;
+        } else if (sscanf(text, "file %u %n", &index, &offset) == 1 && offset > 0) {
+            ok = index == map->file_count &&
+                 (memory = map_add_file(map, text + offset, strlen(text + offset)));
+        } else if (sscanf(text, "label %x %n", &address, &offset) == 1 && offset > 0) {
+            ok = address < SIM_MEMORY_WORDS && text[offset] &&
+                 (memory = map_add_label(map, &label_capacity, (uint16_t)address, text + offset,
+                                         strlen(text + offset)));
+        } else if (sscanf(text, "line %x %u %d%n", &address, &index, &line, &offset) == 3 &&
+                   !text[offset]) {
+            ok = address < SIM_MEMORY_WORDS && index < map->file_count &&
+                 (memory = map_add_line(map, &line_capacity, (uint16_t)address, index, line));
+        } else if (sscanf(text, "data %x %u%n", &address, &size, &offset) == 2 && !text[offset]) {
+            ok = address < SIM_MEMORY_WORDS && size > 0 && size <= SIM_MEMORY_WORDS - address &&
+                 (memory = map_add_data(map, &data_capacity, (uint16_t)address, size));
+        } else {
+            ok = false;
+        }
+    }
+    free(text);
+    fclose(file);
+    if (line_number == 0) ok = false;
+    if (!ok) {
+        if (memory) {
+            fprintf(stderr, "Error: Invalid map '%s' at line %d\n", filename, line_number);
+        } else {
+            fprintf(stderr, "Error: Out of memory\n");
+        }
+        map_free(map);
+    }
+    return ok;
+}
+
+// Binary search for the last record at or before address; the records of
+// a map are in address order. Returns NULL before the first one.
+const MapLabel* map_label_at(const ImageMap* map, uint16_t address) {
+    size_t lo = 0, hi = map->label_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map->labels[mid].address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? &map->labels[lo - 1] : NULL;
+}
+
+const MapLine* map_line_at(const ImageMap* map, uint16_t address) {
+    if (address >= map->size) return NULL;
+    size_t lo = 0, hi = map->line_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map->lines[mid].address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? &map->lines[lo - 1] : NULL;
+}
+
+void map_free(ImageMap* map) {
+    for (size_t i = 0; i < map->file_count; i++) mem_free(map->files[i]);
+    for (size_t i = 0; i < map->label_count; i++) mem_free(map->labels[i].name);
+    mem_free(map->files);
+    mem_free(map->labels);
+    mem_free(map->lines);
+    mem_free(map->data);
+    memset(map, 0, sizeof(*map));
+}
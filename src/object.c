@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+// Relocatable objects. Every table is a fixed-size record array, so the
+// layout follows from the header counts alone: object_init() and
+// object_read() both just point the tables into one buffer.
+
+#define ALIGN4(n) (((n) + 3) & ~(size_t)3)
+
+// Byte size of an object with the given header counts
+static size_t object_layout(const ObjHeader* header) {
+    return sizeof(ObjHeader) +
+           header->section_count * sizeof(ObjSection) +
+           header->symbol_count * sizeof(ObjSymbol) +
+           header->reloc_count * sizeof(ObjReloc) +
+           header->string_size +
+           header->word_count * sizeof(uint16_t);
+}
+
+static void object_attach(ObjectFile* object) {
+    char* p = object->data;
+    object->header = (ObjHeader*)p;
+    p += sizeof(ObjHeader);
+    object->sections = (ObjSection*)p;
+    p += object->header->section_count * sizeof(ObjSection);
+    object->symbols = (ObjSymbol*)p;
+    p += object->header->symbol_count * sizeof(ObjSymbol);
+    object->relocs = (ObjReloc*)p;
+    p += object->header->reloc_count * sizeof(ObjReloc);
+    object->strings = p;
+    p += object->header->string_size;
+    object->words = (uint16_t*)p;
+}
+
+// Allocates a zeroed object with room for the given tables; strings is the
+// string table size before padding
+bool object_init(ObjectFile* object, size_t sections, size_t symbols, size_t relocs,
+                 size_t strings, size_t words) {
+    memset(object, 0, sizeof(*object));
+    ObjHeader header = { OBJ_MAGIC, OBJ_VERSION, (uint16_t)sections, (uint32_t)symbols,
+                         (uint32_t)relocs, (uint32_t)ALIGN4(strings), (uint32_t)words };
+    object->size = object_layout(&header);
+    object->data = mem_calloc(1, object->size);
+    if (!object->data) return false;
+    memcpy(object->data, &header, sizeof(header));
+    object_attach(object);
+    return true;
+}
+
+// Checks that every index and offset in the tables stays inside the object
+static const char* object_validate(const ObjectFile* object) {
+    const ObjHeader* header = object->header;
+    if (header->string_size == 0 || object->strings[header->string_size - 1] != '\0') {
+        return "bad string table";
+    }
+
+    size_t words = 0;
+    for (size_t i = 0; i < header->section_count; i++) {
+        if (object->sections[i].name >= header->string_size) return "bad section name";
+        words += object->sections[i].size;
+    }
+    if (words != header->word_count) return "section sizes do not match contents";
+
+    for (size_t i = 0; i < header->symbol_count; i++) {
+        const ObjSymbol* symbol = &object->symbols[i];
+        if (symbol->name >= header->string_size) return "bad symbol name";
+        if (symbol->section >= (int)header->section_count || symbol->section < -1) {
+            return "bad symbol section";
+        }
+        if (symbol->binding > OBJ_GLOBAL) return "bad symbol binding";
+    }
+
+    for (size_t i = 0; i < header->reloc_count; i++) {
+        const ObjReloc* reloc = &object->relocs[i];
+        if (reloc->section >= header->section_count ||
+            reloc->offset >= object->sections[reloc->section].size) {
+            return "bad relocation offset";
+        }
+        if (reloc->symbol >= header->symbol_count) return "bad relocation symbol";
+        if (reloc->kind > FIXUP_WORD16) return "bad relocation kind";
+    }
+    return NULL;
+}
+
+bool object_read(Assembler* as, const char* filename, ObjectFile* object) {
+    memset(object, 0, sizeof(*object));
+    SourceFile source;
+    if (!source_open(as, &source, filename)) return false;
+
+    // Copied out of the mapping so the tables are aligned and writable
+    const char* problem = NULL;
+    ObjHeader header;
+    if (source.length < sizeof(header)) {
+        problem = "truncated header";
+    } else {
+        memcpy(&header, source.data, sizeof(header));
+        if (header.magic != OBJ_MAGIC) {
+            problem = "not a BEAG object";
+        } else if (header.version != OBJ_VERSION) {
+            problem = "unsupported object version";
+        } else if (object_layout(&header) != source.length) {
+            problem = "size does not match header";
+        }
+    }
+
+    if (!problem) {
+        object->size = source.length;
+        object->data = mem_alloc(source.length);
+        if (!object->data) {
+            assembler_report(as, "Error: Out of memory reading '%s'\n", filename);
+            source_close(&source);
+            return false;
+        }
+        memcpy(object->data, source.data, source.length);
+        object_attach(object);
+        problem = object_validate(object);
+    }
+    source_close(&source);
+
+    if (problem) {
+        assembler_report(as, "Error: Invalid object '%s': %s\n", filename, problem);
+        object_free(object);
+        return false;
+    }
+    return true;
+}
+
+void object_free(ObjectFile* object) {
+    mem_free(object->data);
+    memset(object, 0, sizeof(*object));
+}
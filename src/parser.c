@@ -3,324 +3,490 @@
 #include <string.h>
 #include "asm.h"
 
-#define MAX_INSTRUCTIONS 1024
+// Each statement is parsed into a temporary Instruction and appended to the
+// compact program IR, so only one Instruction is alive at a time.
+typedef struct {
+    Assembler* as;
+    Token* current;
+    Program* program;
+    bool had_error;
+} Parser;
+
+static void parse_error_at(Parser* parser, int file, int line, const char* message) {
+    assembler_report(parser->as, "Error at line %d%s: %s\n", line,
+                     assembler_file_note(parser->as, file), message);
+    parser->had_error = true;
+}
+
+static void parse_error(Parser* parser, const char* message) {
+    parse_error_at(parser, parser->current->file, parser->current->line, message);
+}
 
-static Instruction* instructions = NULL;
-static int instruction_count = 0;
-static Token* current_token = NULL;
+static void emit(Parser* parser, const Instruction* inst) {
+    uint16_t regs = 0;
+    uint8_t kind = OP_NONE;
+    int32_t imm = 0;
+
+    for (int i = 0; i < inst->operand_count; i++) {
+        const Operand* operand = &inst->operands[i];
+        switch (operand->type) {
+            case OP_REGISTER:
+                regs |= (uint16_t)((operand->value.reg_num & 0xF) << (4 * i));
+                break;
+            case OP_IMMEDIATE:
+                kind = OP_IMMEDIATE;
+                imm = operand->value.immediate;
+                break;
+            default:
+                kind = operand->type;
+                imm = operand->value.symbol_id;
+                break;
+        }
+    }
 
-static void parse_error(const char* message) {
-    fprintf(stderr, "Error at line %d: %s\n", current_token->line, message);
+    if (!program_append(parser->program, inst->type, kind, regs, imm, inst->file, inst->line)) {
+        parse_error_at(parser, inst->file, inst->line, "Out of memory");
+    }
 }
 
-static void advance(void) {
-    current_token++;
+static void advance(Parser* parser) {
+    parser->current++;
 }
 
-static bool match(TokenType type) {
-    if (current_token->type == type) {
-        advance();
+static bool match(Parser* parser, TokenType type) {
+    if (parser->current->type == type) {
+        advance(parser);
         return true;
     }
     return false;
 }
 
-InstructionType get_instruction_type(const char* name) {
-    if (strcmp(name, "add") == 0) return INST_ADD;
-    if (strcmp(name, "sub") == 0) return INST_SUB;
-    if (strcmp(name, "mul") == 0) return INST_MUL;
-    if (strcmp(name, "div") == 0) return INST_DIV;
-    if (strcmp(name, "jalr") == 0) return INST_JALR;
-    if (strcmp(name, "sw") == 0) return INST_SW;
-    if (strcmp(name, "lw") == 0) return INST_LW;
-    if (strcmp(name, "lhi") == 0) return INST_LHI;
-    if (strcmp(name, "lli") == 0) return INST_LLI;
-    if (strcmp(name, "bne") == 0) return INST_BNE;
-    if (strcmp(name, "beq") == 0) return INST_BEQ;
-    if (strcmp(name, "blt") == 0) return INST_BLT;
-    if (strcmp(name, ".word") == 0) return INST_WORD;
-    return INST_EOP;
-}
-
-static void parse_register(Operand* operand) {
-    if (current_token->type != TOKEN_REGISTER) {
-        parse_error("Expected register");
+static void parse_register(Parser* parser, Operand* operand) {
+    if (parser->current->type != TOKEN_REGISTER) {
+        parse_error(parser, "Expected register");
         return;
     }
     operand->type = OP_REGISTER;
-    operand->value.reg_num = current_token->value.reg_num;
-    advance();
+    operand->value.reg_num = parser->current->value.reg_num;
+    advance(parser);
 }
 
-static void parse_immediate(Operand* operand) {
-    if (current_token->type == TOKEN_IMMEDIATE) {
+static void parse_immediate(Parser* parser, Operand* operand) {
+    if (parser->current->type == TOKEN_IMMEDIATE) {
         operand->type = OP_IMMEDIATE;
-        operand->value.immediate = current_token->value.immediate;
-        advance();
-    } else if (current_token->type == TOKEN_LABEL_HI || 
-               current_token->type == TOKEN_LABEL_LO) {
-        TokenType modifier = current_token->type;
-        advance();  // Skip %hi or %lo
+        operand->value.immediate = parser->current->value.immediate;
+        advance(parser);
+    } else if (parser->current->type == TOKEN_LABEL_HI || 
+               parser->current->type == TOKEN_LABEL_LO) {
+        TokenType modifier = parser->current->type;
+        advance(parser);  // Skip %hi or %lo
         
-        if (current_token->type != TOKEN_LPAREN) {
-            parse_error("Expected '(' after %hi or %lo");
+        if (parser->current->type != TOKEN_LPAREN) {
+            parse_error(parser, "Expected '(' after %hi or %lo");
             return;
         }
-        advance();  // Skip '('
+        advance(parser);  // Skip '('
         
-        if (current_token->type != TOKEN_LABEL_REFERENCE) {
-            parse_error("Expected label after '('");
+        if (parser->current->type != TOKEN_LABEL_REFERENCE) {
+            parse_error(parser, "Expected label after '('");
             return;
         }
         
-        // Get the label value from symbol table
-        uint16_t label_value = symbol_table_get(current_token->value.str);
-        if (label_value == 0xFFFF) {
-            parse_error("Undefined label");
-            return;
-        }
-        
-        operand->type = OP_IMMEDIATE;
-        if (modifier == TOKEN_LABEL_HI) {
-            operand->value.immediate = (label_value >> 8) & 0xFF;  // High 8 bits
-        } else {
-            operand->value.immediate = label_value & 0xFF;  // Low 8 bits
-        }
-        advance();  // Skip label
+        // Resolved by the code generator, which allows forward references
+        operand->type = modifier == TOKEN_LABEL_HI ? OP_LABEL_HI : OP_LABEL_LO;
+        operand->value.symbol_id = parser->current->value.symbol_id;
+        advance(parser);  // Skip label
         
-        if (current_token->type != TOKEN_RPAREN) {
-            parse_error("Expected ')' after label");
+        if (parser->current->type != TOKEN_RPAREN) {
+            parse_error(parser, "Expected ')' after label");
             return;
         }
-        advance();  // Skip ')'
+        advance(parser);  // Skip ')'
     } else {
-        parse_error("Expected immediate value or label modifier");
+        parse_error(parser, "Expected immediate value or label modifier");
     }
 }
 
-static void parse_label(Operand* operand) {
-    if (current_token->type != TOKEN_LABEL_REFERENCE) {
-        parse_error("Expected label reference");
+static void parse_label(Parser* parser, Operand* operand) {
+    if (parser->current->type != TOKEN_LABEL_REFERENCE) {
+        parse_error(parser, "Expected label reference");
         return;
     }
     operand->type = OP_LABEL;
-    operand->value.label = strdup(current_token->value.str);
-    advance();
+    operand->value.symbol_id = parser->current->value.symbol_id;
+    advance(parser);
 }
 
-static void parse_operands(Instruction* inst) {
+static void parse_operands(Parser* parser, Instruction* inst) {
     inst->operand_count = 0;
     
     // Parse first operand
-    if (current_token->type == TOKEN_REGISTER) {
-        parse_register(&inst->operands[inst->operand_count++]);
-    } else if (current_token->type == TOKEN_IMMEDIATE ||
-               current_token->type == TOKEN_LABEL_HI ||
-               current_token->type == TOKEN_LABEL_LO) {
-        parse_immediate(&inst->operands[inst->operand_count++]);
-    } else if (current_token->type == TOKEN_LABEL_REFERENCE) {
-        parse_label(&inst->operands[inst->operand_count++]);
+    if (parser->current->type == TOKEN_REGISTER) {
+        parse_register(parser, &inst->operands[inst->operand_count++]);
+    } else if (parser->current->type == TOKEN_IMMEDIATE ||
+               parser->current->type == TOKEN_LABEL_HI ||
+               parser->current->type == TOKEN_LABEL_LO) {
+        parse_immediate(parser, &inst->operands[inst->operand_count++]);
+    } else if (parser->current->type == TOKEN_LABEL_REFERENCE) {
+        parse_label(parser, &inst->operands[inst->operand_count++]);
     }
 
     // Parse additional operands
-    while (match(TOKEN_COMMA) && inst->operand_count < 3) {
-        if (current_token->type == TOKEN_REGISTER) {
-            parse_register(&inst->operands[inst->operand_count++]);
-        } else if (current_token->type == TOKEN_IMMEDIATE ||
-                   current_token->type == TOKEN_LABEL_HI ||
-                   current_token->type == TOKEN_LABEL_LO) {
-            parse_immediate(&inst->operands[inst->operand_count++]);
-        } else if (current_token->type == TOKEN_LABEL_REFERENCE) {
-            parse_label(&inst->operands[inst->operand_count++]);
+    while (match(parser, TOKEN_COMMA) && inst->operand_count < 3) {
+        if (parser->current->type == TOKEN_REGISTER) {
+            parse_register(parser, &inst->operands[inst->operand_count++]);
+        } else if (parser->current->type == TOKEN_IMMEDIATE ||
+                   parser->current->type == TOKEN_LABEL_HI ||
+                   parser->current->type == TOKEN_LABEL_LO) {
+            parse_immediate(parser, &inst->operands[inst->operand_count++]);
+        } else if (parser->current->type == TOKEN_LABEL_REFERENCE) {
+            parse_label(parser, &inst->operands[inst->operand_count++]);
         } else {
-            parse_error("Expected register, immediate, or label");
+            parse_error(parser, "Expected register, immediate, or label");
             break;
         }
     }
 }
 
-static void parse_instruction(void) {
-    if (current_token->type != TOKEN_INSTRUCTION) {
-        parse_error("Expected instruction");
-        return;
+// Checks the parsed operands against the instruction's encoding format
+static bool check_operands(Parser* parser, const Instruction* inst) {
+    const IsaFormat* format = &isa_formats[inst->type];
+    char message[128];
+
+    if (inst->operand_count != format->operand_count) {
+        snprintf(message, sizeof(message), "'%s' expects %d operands, got %d",
+                 format->mnemonic, format->operand_count, inst->operand_count);
+        parse_error_at(parser, inst->file, inst->line, message);
+        return false;
     }
 
-    Instruction* inst = &instructions[instruction_count++];
-    inst->type = current_token->value.inst_type;
-    inst->line = current_token->line;
-    advance();
+    for (int i = 0; i < inst->operand_count; i++) {
+        OperandType type = inst->operands[i].type;
+        bool ok;
+        const char* expected;
+        switch (format->operands[i].kind) {
+            case ISA_REG:
+                ok = type == OP_REGISTER;
+                expected = "a register";
+                break;
+            case ISA_IMM:
+                ok = type == OP_IMMEDIATE || type == OP_LABEL_HI || type == OP_LABEL_LO;
+                expected = "an immediate, %hi or %lo";
+                break;
+            default:
+                ok = type == OP_LABEL || type == OP_IMMEDIATE;
+                expected = "a label or offset";
+                break;
+        }
+        if (!ok) {
+            snprintf(message, sizeof(message), "Operand %d of '%s' must be %s",
+                     i + 1, format->mnemonic, expected);
+            parse_error_at(parser, inst->file, inst->line, message);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Operand signatures of the pseudo-instructions: r is a register, l a label
+// and v an immediate or a label
+static const struct {
+    const char* mnemonic;
+    const char* operands;
+} pseudo_formats[] = {
+    [INST_LA - INST_LA]   = { "la",   "rl" },
+    [INST_J - INST_LA]    = { "j",    "l" },
+    [INST_CALL - INST_LA] = { "call", "l" },
+    [INST_LI - INST_LA]   = { "li",   "rv" },
+    [INST_MOV - INST_LA]  = { "mov",  "rr" },
+    [INST_RET - INST_LA]  = { "ret",  "" },
+    [INST_NOP - INST_LA]  = { "nop",  "" },
+};
+
+static bool check_pseudo_operands(Parser* parser, const Instruction* inst) {
+    const char* mnemonic = pseudo_formats[inst->type - INST_LA].mnemonic;
+    const char* signature = pseudo_formats[inst->type - INST_LA].operands;
+    char message[128];
+
+    if (inst->operand_count != (int)strlen(signature)) {
+        snprintf(message, sizeof(message), "'%s' expects %d operands, got %d",
+                 mnemonic, (int)strlen(signature), inst->operand_count);
+        parse_error_at(parser, inst->file, inst->line, message);
+        return false;
+    }
+
+    for (int i = 0; i < inst->operand_count; i++) {
+        OperandType type = inst->operands[i].type;
+        bool ok;
+        const char* expected;
+        switch (signature[i]) {
+            case 'r':
+                ok = type == OP_REGISTER;
+                expected = "a register";
+                break;
+            case 'l':
+                ok = type == OP_LABEL;
+                expected = "a label";
+                break;
+            default:
+                ok = type == OP_IMMEDIATE || type == OP_LABEL;
+                expected = "an immediate or a label";
+                break;
+        }
+        if (!ok) {
+            snprintf(message, sizeof(message), "Operand %d of '%s' must be %s",
+                     i + 1, mnemonic, expected);
+            parse_error_at(parser, inst->file, inst->line, message);
+            return false;
+        }
+    }
+    return true;
+}
 
-    parse_operands(inst);
+// Appends one real instruction in place of a pseudo-instruction
+static void emit_entry(Parser* parser, const Instruction* pseudo, InstructionType type,
+                       uint8_t kind, uint16_t regs, int32_t imm) {
+    if (!program_append(parser->program, type, kind, regs, imm, pseudo->file, pseudo->line)) {
+        parse_error_at(parser, pseudo->file, pseudo->line, "Out of memory");
+    }
 }
 
-static void parse_label_definition(void) {
-    if (current_token->type != TOKEN_LABEL) {
-        parse_error("Expected label definition");
+#define PACK_REGS(rd, rs1, rs2) ((uint16_t)((rd) | (rs1) << 4 | (rs2) << 8))
+
+// Rewrites li, mov, ret and nop to their shortest real sequences. la, j and
+// call go into the IR as they are: how long they end up depends on where
+// their labels land, which only the code generator knows.
+static void parse_pseudo(Parser* parser, Instruction* inst) {
+    if (!check_pseudo_operands(parser, inst)) return;
+    const Operand* operands = inst->operands;
+
+    switch (inst->type) {
+        case INST_LI: {
+            if (operands[1].type == OP_LABEL) {
+                inst->type = INST_LA;
+                emit(parser, inst);
+                break;
+            }
+            // lli sign-extends, so a value in [-128, 127] needs nothing else;
+            // otherwise lhi replaces the high byte
+            uint8_t rd = operands[0].value.reg_num;
+            int value = operands[1].value.immediate;
+            emit_entry(parser, inst, INST_LLI, OP_IMMEDIATE, rd, value & 0xFF);
+            if (value < -128 || value > 127) {
+                emit_entry(parser, inst, INST_LHI, OP_IMMEDIATE, rd, (value >> 8) & 0xFF);
+            }
+            break;
+        }
+        case INST_MOV: {
+            uint8_t rd = operands[0].value.reg_num;
+            uint8_t rs = operands[1].value.reg_num;
+            if (rd != rs) emit_entry(parser, inst, INST_ADD, OP_NONE, PACK_REGS(rd, rs, 0), 0);
+            break;
+        }
+        case INST_RET:
+            emit_entry(parser, inst, INST_JALR, OP_NONE, PACK_REGS(0, REG_LINK, 0), 0);
+            break;
+        case INST_NOP:
+            emit_entry(parser, inst, INST_ADD, OP_NONE, PACK_REGS(0, 0, 0), 0);
+            break;
+        default:
+            emit(parser, inst);
+            break;
+    }
+}
+
+static void parse_instruction(Parser* parser) {
+    if (parser->current->type != TOKEN_INSTRUCTION) {
+        parse_error(parser, "Expected instruction");
+        return;
+    }
+
+    Instruction inst;
+    inst.type = parser->current->value.inst_type;
+    inst.file = parser->current->file;
+    inst.line = parser->current->line;
+    advance(parser);
+
+    parse_operands(parser, &inst);
+    if (inst.type >= INST_LA) {
+        parse_pseudo(parser, &inst);
+    } else if (check_operands(parser, &inst)) {
+        emit(parser, &inst);
+    }
+}
+
+static void parse_label_definition(Parser* parser) {
+    if (parser->current->type != TOKEN_LABEL) {
+        parse_error(parser, "Expected label definition");
         return;
     }
 
-    // Add label to symbol table with current instruction count
-    symbol_table_add(current_token->value.str, instruction_count);
-    advance();
+    // The code generator binds the label to the address of the next word
+    if (!program_append(parser->program, INST_LABEL, OP_LABEL, 0, parser->current->value.symbol_id,
+                        parser->current->file, parser->current->line)) {
+        parse_error(parser, "Out of memory");
+    }
+    advance(parser);
 }
 
-static void parse_word_directive(void) {
-    if (current_token->type != TOKEN_WORD_DIRECTIVE) {
-        parse_error("Expected .word directive");
+static void parse_word_directive(Parser* parser) {
+    if (parser->current->type != TOKEN_WORD_DIRECTIVE) {
+        parse_error(parser, "Expected .word directive");
         return;
     }
 
-    Instruction* inst = &instructions[instruction_count++];
-    inst->type = current_token->value.inst_type;
-    inst->line = current_token->line;
-    advance();
+    Instruction inst;
+    inst.type = parser->current->value.inst_type;
+    inst.file = parser->current->file;
+    inst.line = parser->current->line;
+    advance(parser);
 
     // Parse the word value (number or label)
-    if (current_token->type == TOKEN_IMMEDIATE) {
-        parse_immediate(&inst->operands[0]);
-        inst->operand_count = 1;
-    } else if (current_token->type == TOKEN_LABEL_REFERENCE) {
-        parse_label(&inst->operands[0]);
-        inst->operand_count = 1;
+    if (parser->current->type == TOKEN_IMMEDIATE) {
+        parse_immediate(parser, &inst.operands[0]);
+        inst.operand_count = 1;
+    } else if (parser->current->type == TOKEN_LABEL_REFERENCE) {
+        parse_label(parser, &inst.operands[0]);
+        inst.operand_count = 1;
     } else {
-        parse_error("Expected number or label after .word");
+        parse_error(parser, "Expected number or label after .word");
+        return;
     }
+    emit(parser, &inst);
 }
 
-static void parse_ascii_directive(void) {
-    if (current_token->type != TOKEN_ASCII_DIRECTIVE && 
-        current_token->type != TOKEN_ASCIZ_DIRECTIVE) {
-        parse_error("Expected .ascii or .asciz directive");
+static void parse_ascii_directive(Parser* parser) {
+    if (parser->current->type != TOKEN_ASCII_DIRECTIVE && 
+        parser->current->type != TOKEN_ASCIZ_DIRECTIVE) {
+        parse_error(parser, "Expected .ascii or .asciz directive");
         return;
     }
 
-    bool is_asciz = (current_token->type == TOKEN_ASCIZ_DIRECTIVE);
-    advance();  // Skip directive
+    bool is_asciz = (parser->current->type == TOKEN_ASCIZ_DIRECTIVE);
+    advance(parser);  // Skip directive
 
-    if (current_token->type != TOKEN_STRING_LITERAL) {
-        parse_error("Expected string literal after directive");
+    if (parser->current->type != TOKEN_STRING_LITERAL) {
+        parse_error(parser, "Expected string literal after directive");
         return;
     }
 
-    // For each character in the string, create a .word instruction
-    const char* str = current_token->value.str;
-    for (int i = 0; str[i] != '\0'; i++) {
-        Instruction* inst = &instructions[instruction_count++];
-        inst->type = INST_WORD;
-        inst->line = current_token->line;
-        inst->operand_count = 1;
-        inst->operands[0].type = OP_IMMEDIATE;
-        inst->operands[0].value.immediate = (unsigned char)str[i];
+    // For each character in the string, emit a .word
+    Instruction inst;
+    inst.type = INST_WORD;
+    inst.file = parser->current->file;
+    inst.line = parser->current->line;
+    inst.operand_count = 1;
+    inst.operands[0].type = OP_IMMEDIATE;
+
+    const char* str = parser->as->files[parser->current->file].source.data +
+                      parser->current->offset;
+    const char* end = str + parser->current->length;
+    while (str < end) {
+        inst.operands[0].value.immediate = (unsigned char)lexer_string_char(&str);
+        emit(parser, &inst);
     }
 
     // Add null terminator for .asciz
     if (is_asciz) {
-        Instruction* inst = &instructions[instruction_count++];
-        inst->type = INST_WORD;
-        inst->line = current_token->line;
-        inst->operand_count = 1;
-        inst->operands[0].type = OP_IMMEDIATE;
-        inst->operands[0].value.immediate = 0;
+        inst.operands[0].value.immediate = 0;
+        emit(parser, &inst);
     }
 
-    advance();  // Skip string literal
+    advance(parser);  // Skip string literal
+}
+
+// .global name[, name]...: the names are exported from the object; the
+// directive has no effect on a flat image
+static void parse_global_directive(Parser* parser) {
+    advance(parser);  // Skip directive
+    do {
+        if (parser->current->type != TOKEN_LABEL_REFERENCE) {
+            parse_error(parser, "Expected symbol name after .global");
+            return;
+        }
+        symbol_table_export(&parser->as->symbols, parser->current->value.symbol_id);
+        advance(parser);
+    } while (match(parser, TOKEN_COMMA));
 }
 
-Instruction* parser_parse(Token* tokens) {
-    instructions = malloc(sizeof(Instruction) * MAX_INSTRUCTIONS);
-    if (!instructions) return NULL;
-
-    instruction_count = 0;
-    current_token = tokens;
-
-    while (current_token->type != TOKEN_EOF && instruction_count < MAX_INSTRUCTIONS) {
-        if (current_token->type == TOKEN_LABEL) {
-            parse_label_definition();
-        } else if (current_token->type == TOKEN_INSTRUCTION) {
-            parse_instruction();
-        } else if (current_token->type == TOKEN_WORD_DIRECTIVE) {
-            parse_word_directive();
-        } else if (current_token->type == TOKEN_ASCII_DIRECTIVE || 
-                   current_token->type == TOKEN_ASCIZ_DIRECTIVE) {
-            parse_ascii_directive();
+bool parser_parse(Assembler* as, TokenList* tokens, Program* program) {
+    Parser state = { as, tokens->tokens, program, false };
+    Parser* parser = &state;
+
+    while (parser->current->type != TOKEN_EOF) {
+        if (parser->current->type == TOKEN_LABEL) {
+            parse_label_definition(parser);
+        } else if (parser->current->type == TOKEN_INSTRUCTION) {
+            parse_instruction(parser);
+        } else if (parser->current->type == TOKEN_WORD_DIRECTIVE) {
+            parse_word_directive(parser);
+        } else if (parser->current->type == TOKEN_ASCII_DIRECTIVE || 
+                   parser->current->type == TOKEN_ASCIZ_DIRECTIVE) {
+            parse_ascii_directive(parser);
+        } else if (parser->current->type == TOKEN_GLOBAL_DIRECTIVE) {
+            parse_global_directive(parser);
         } else {
-            parse_error("Unexpected token");
+            parse_error(parser, "Unexpected token");
             break;
         }
     }
 
-    // Add end of program marker
-    instructions[instruction_count].type = INST_EOP;
-    instructions[instruction_count].operand_count = 0;
-    instructions[instruction_count].line = current_token->line;
-
-    // Print debug information
-    debug_print_instructions(instructions);
-    debug_print_symbol_table();
+    TRACE(TRACE_PARSER, TRACE_INFO, "parser: %zu IR entries\n", program->count);
+    if (TRACE_ENABLED(TRACE_PARSER, TRACE_DEBUG)) debug_print_instructions(&as->symbols, program);
 
-    return instructions;
+    return !parser->had_error;
 }
 
-void parser_free(Instruction* instructions) {
-    if (!instructions) return;
-    
-    // Free any label strings in operands
-    for (int i = 0; instructions[i].type != INST_EOP; i++) {
-        for (int j = 0; j < instructions[i].operand_count; j++) {
-            if (instructions[i].operands[j].type == OP_LABEL) {
-                free(instructions[i].operands[j].value.label);
-            }
+void debug_print_instructions(const SymbolTable* symbols, const Program* program) {
+    trace_printf("\nParsed Instructions:\n");
+    trace_printf("===================\n");
+
+    int address = 0;
+    for (size_t i = 0; i < program->count; i++) {
+        uint8_t type = program->op[i];
+        if (type == INST_LABEL) {
+            trace_printf("     %s:\n", symbol_table_entry(symbols, program->imm[i])->name);
+            continue;
         }
-    }
-    
-    free(instructions);
-}
 
-void debug_print_instructions(Instruction* instructions) {
-    printf("\nParsed Instructions:\n");
-    printf("===================\n");
-    
-    for (int i = 0; instructions[i].type != INST_EOP; i++) {
-        Instruction* inst = &instructions[i];
-        printf("%3d: %-8s ", i, 
-               inst->type == INST_ADD ? "add" :
-               inst->type == INST_SUB ? "sub" :
-               inst->type == INST_MUL ? "mul" :
-               inst->type == INST_DIV ? "div" :
-               inst->type == INST_JALR ? "jalr" :
-               inst->type == INST_SW ? "sw" :
-               inst->type == INST_LW ? "lw" :
-               inst->type == INST_LHI ? "lhi" :
-               inst->type == INST_LLI ? "lli" :
-               inst->type == INST_BNE ? "bne" :
-               inst->type == INST_BEQ ? "beq" :
-               inst->type == INST_BLT ? "blt" :
-               inst->type == INST_WORD ? ".word" : "???");
-
-        // Print operands
-        for (int j = 0; j < inst->operand_count; j++) {
-            if (j > 0) printf(", ");
-            switch (inst->operands[j].type) {
-                case OP_REGISTER:
-                    printf("r%d", inst->operands[j].value.reg_num);
-                    break;
-                case OP_IMMEDIATE:
-                    printf("%d (0x%04X)", 
-                           inst->operands[j].value.immediate,
-                           (int16_t)inst->operands[j].value.immediate);
-                    break;
-                case OP_LABEL:
-                    printf("%s", inst->operands[j].value.label);
-                    break;
-            }
+        bool pseudo = type >= INST_LA;
+        trace_printf("%3d: %-8s ", address++,
+                     pseudo ? pseudo_formats[type - INST_LA].mnemonic :
+                     type < INST_EOP ? isa_formats[type].mnemonic : "???");
+
+        // Print operands: registers first, then the immediate or label
+        int reg_count = pseudo ? (int)strspn(pseudo_formats[type - INST_LA].operands, "r") : 0;
+        while (!pseudo && reg_count < 3 && isa_formats[type].operands[reg_count].kind == ISA_REG) {
+            reg_count++;
+        }
+        for (int j = 0; j < reg_count; j++) {
+            if (j > 0) trace_printf(", ");
+            trace_printf("r%d", IR_REG(program->regs[i], j));
+        }
+        if (program->kind[i] != OP_NONE && reg_count > 0) trace_printf(", ");
+        switch (program->kind[i]) {
+            case OP_IMMEDIATE:
+                trace_printf("%d (0x%04X)", program->imm[i], (uint16_t)program->imm[i]);
+                break;
+            case OP_LABEL:
+                trace_printf("%s", symbol_table_entry(symbols, program->imm[i])->name);
+                break;
+            case OP_LABEL_HI:
+            case OP_LABEL_LO:
+                trace_printf("%s(%s)", program->kind[i] == OP_LABEL_HI ? "%hi" : "%lo",
+                       symbol_table_entry(symbols, program->imm[i])->name);
+                break;
+            default:
+                break;
         }
 
         // Print instruction format type
-        printf(" [%s] (line %d)\n",
-               inst->type == INST_WORD ? "Word" :
-               inst->type <= INST_DIV ? "R-type" :
-               inst->type <= INST_LW ? "M-type" : "I-type",
-               inst->line);
+        trace_printf(" [%s] (line %d)\n",
+               pseudo ? "Pseudo" :
+               type == INST_WORD ? "Word" :
+               type <= INST_DIV ? "R-type" :
+               type <= INST_LW ? "M-type" : "I-type",
+               program_line(program, i));
     }
-    printf("===================\n\n");
-} 
\ No newline at end of file
+    trace_printf("===================\n\n");
+}
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+#define MAX_PASSES 8   // Passes over the IR before giving up on a fixed point
+#define MAX_HOPS 8     // Jumps a branch chain is followed through
+
+// Peephole optimizer over the IR, run between parsing and code generation
+// when asked for (-O). Each pass walks the IR once, trying the rules of
+// the table below on every instruction in order; a rule either deletes the
+// instruction, rewrites it in place, or leaves it. Passes repeat until one
+// changes nothing, then deleted entries are dropped from the IR.
+//
+// Rules that delete rely on what is known about the registers: constants
+// and copies, tracked forward through straight-line code. A label may be
+// reached from anywhere, so everything is forgotten at labels, and after
+// anything that leaves the block or lets other code run. Labels themselves
+// are never deleted. Deleting moves every later instruction, so programs
+// that may use a numeric address (see program_numeric_addresses()) only get
+// the rules that rewrite in place.
+//
+// Savings are estimated statically: a word removed saves the cycle it took
+// to execute, and a jump skipped in a chain saves one cycle per taken
+// branch.
+typedef struct {
+    Assembler* as;
+    Program* program;
+    uint8_t* removed;       // Per IR entry
+    int32_t* definition;    // IR entry of each symbol's first definition, or -1
+    bool may_delete;
+    bool known[8];          // Register holds constant[r]
+    uint16_t constant[8];
+    uint8_t copy[8];        // Leader of the registers known to hold the same value
+} Peephole;
+
+typedef struct {
+    const char* name;
+    bool deletes;
+    bool (*apply)(Peephole* opt, size_t index);
+} PeepholeRuleInfo;
+
+static bool zero_dest(Peephole* opt, size_t index);
+static bool redundant_load(Peephole* opt, size_t index);
+static bool redundant_move(Peephole* opt, size_t index);
+static bool branch_chain(Peephole* opt, size_t index);
+static bool branch_next(Peephole* opt, size_t index);
+
+static const PeepholeRuleInfo rules[PEEPHOLE_RULE_COUNT] = {
+    [PEEPHOLE_ZERO_DEST]       = { "zero-dest",       true,  zero_dest },
+    [PEEPHOLE_REDUNDANT_LOAD]  = { "redundant-load",  true,  redundant_load },
+    [PEEPHOLE_REDUNDANT_MOVE]  = { "redundant-move",  true,  redundant_move },
+    [PEEPHOLE_BRANCH_CHAIN]    = { "branch-chain",    false, branch_chain },
+    [PEEPHOLE_BRANCH_NEXT]     = { "branch-next",     true,  branch_next },
+};
+
+const char* peephole_rule_name(PeepholeRule rule) {
+    return rules[rule].name;
+}
+
+static bool is_branch(uint8_t op) {
+    return op == INST_BEQ || op == INST_BNE || op == INST_BLT;
+}
+
+static void record(Peephole* opt, PeepholeRule rule, size_t index, unsigned words,
+                   unsigned cycles) {
+    Stats* stats = &opt->as->stats;
+    stats->peephole_hits[rule]++;
+    stats->peephole_words[rule] += words;
+    stats->peephole_cycles[rule] += cycles;
+    TRACE(TRACE_CODEGEN, TRACE_VERBOSE, "peephole: %s at line %d%s\n", rules[rule].name,
+          program_line(opt->program, index),
+          assembler_file_note(opt->as, program_file(opt->program, index)));
+}
+
+static bool delete(Peephole* opt, PeepholeRule rule, size_t index) {
+    opt->removed[index] = 1;
+    record(opt, rule, index, 1, 1);
+    return true;
+}
+
+// Register knowledge
+
+static void forget_all(Peephole* opt) {
+    for (int r = 0; r < 8; r++) {
+        opt->known[r] = false;
+        opt->copy[r] = (uint8_t)r;
+    }
+    opt->known[0] = true;  // r0 is hardwired to zero
+    opt->constant[0] = 0;
+}
+
+// Forgets the value of r; registers that were copies of it stay copies of
+// each other
+static void forget(Peephole* opt, int r) {
+    int leader = -1;
+    for (int s = 0; s < 8; s++) {
+        if (s == r || opt->copy[s] != r) continue;
+        if (leader < 0) leader = s;
+        opt->copy[s] = (uint8_t)leader;
+    }
+    opt->copy[r] = (uint8_t)r;
+    opt->known[r] = false;
+}
+
+static void set_constant(Peephole* opt, int r, uint16_t value) {
+    forget(opt, r);
+    opt->known[r] = true;
+    opt->constant[r] = value;
+}
+
+static bool same_value(const Peephole* opt, int a, int b) {
+    return opt->copy[a] == opt->copy[b] ||
+           (opt->known[a] && opt->known[b] && opt->constant[a] == opt->constant[b]);
+}
+
+// Updates the register knowledge for an instruction that stays
+static void execute(Peephole* opt, size_t index) {
+    const Program* program = opt->program;
+    uint8_t op = program->op[index];
+    uint16_t regs = program->regs[index];
+    int rd = IR_REG(regs, 0), a = IR_REG(regs, 1), b = IR_REG(regs, 2);
+
+    switch (op) {
+        case INST_ADD:
+        case INST_SUB:
+        case INST_MUL:
+        case INST_DIV: {
+            if (rd == 0) break;
+            int source = op == INST_SUB ? (b == 0 ? a : -1)
+                       : op == INST_ADD ? (b == 0 ? a : a == 0 ? b : -1) : -1;
+            if (source >= 0) {
+                bool known = opt->known[source];
+                uint16_t value = opt->constant[source];
+                forget(opt, rd);
+                opt->known[rd] = known;
+                opt->constant[rd] = value;
+                opt->copy[rd] = opt->copy[source];
+            } else if (op != INST_DIV && opt->known[a] && opt->known[b]) {
+                uint16_t x = opt->constant[a], y = opt->constant[b];
+                set_constant(opt, rd, (uint16_t)(op == INST_ADD ? x + y
+                                                 : op == INST_SUB ? x - y : x * y));
+            } else {
+                forget(opt, rd);
+            }
+            break;
+        }
+        case INST_LLI:
+            if (rd == 0) break;
+            if (program->kind[index] == OP_IMMEDIATE) {
+                set_constant(opt, rd, (uint16_t)(int8_t)program->imm[index]);
+            } else {
+                forget(opt, rd);
+            }
+            break;
+        case INST_LHI:
+            if (rd == 0) break;
+            if (program->kind[index] == OP_IMMEDIATE && opt->known[rd]) {
+                set_constant(opt, rd, (uint16_t)((opt->constant[rd] & 0xFF) |
+                                                 (program->imm[index] & 0xFF) << 8));
+            } else {
+                forget(opt, rd);
+            }
+            break;
+        case INST_LW:
+        case INST_LA:
+            if (rd != 0) forget(opt, rd);
+            break;
+        case INST_SW:
+            break;
+        case INST_BEQ:
+        case INST_BNE:
+        case INST_BLT:
+            if (op == INST_BEQ && rd == 0) {
+                forget_all(opt);  // Always taken
+            } else if (program->kind[index] == OP_LABEL) {
+                forget(opt, REG_TEMP);  // A relaxed branch loads its target there
+            }
+            break;
+        default:
+            // Jumps, calls, and data that is not meant to be executed
+            forget_all(opt);
+            break;
+    }
+}
+
+// The first instruction at or after index, skipping labels and deleted
+// entries; program->count if there is none
+static size_t next_instruction(const Peephole* opt, size_t index) {
+    const Program* program = opt->program;
+    while (index < program->count &&
+           (opt->removed[index] || program->op[index] == INST_LABEL)) {
+        index++;
+    }
+    return index;
+}
+
+// Whether the instruction at index always jumps to a label
+static bool is_jump(const Program* program, size_t index) {
+    if (index >= program->count || program->kind[index] != OP_LABEL) return false;
+    uint8_t op = program->op[index];
+    return op == INST_J || (op == INST_BEQ && IR_REG(program->regs[index], 0) == 0);
+}
+
+// Rules. Each returns true if it deleted the instruction.
+
+static bool zero_dest(Peephole* opt, size_t index) {
+    const Program* program = opt->program;
+    uint8_t op = program->op[index];
+    // div is kept for its divide-by-zero behavior, lw for the memory read
+    bool writes_only = op == INST_ADD || op == INST_SUB || op == INST_MUL ||
+                       op == INST_LLI || op == INST_LHI;
+    return writes_only && IR_REG(program->regs[index], 0) == 0 &&
+           delete(opt, PEEPHOLE_ZERO_DEST, index);
+}
+
+static bool redundant_load(Peephole* opt, size_t index) {
+    const Program* program = opt->program;
+    uint8_t op = program->op[index];
+    int rd = IR_REG(program->regs[index], 0);
+    if ((op != INST_LLI && op != INST_LHI) || program->kind[index] != OP_IMMEDIATE ||
+        !opt->known[rd]) {
+        return false;
+    }
+    uint16_t value = op == INST_LLI
+        ? (uint16_t)(int8_t)program->imm[index]
+        : (uint16_t)((opt->constant[rd] & 0xFF) | (program->imm[index] & 0xFF) << 8);
+    return value == opt->constant[rd] && delete(opt, PEEPHOLE_REDUNDANT_LOAD, index);
+}
+
+static bool redundant_move(Peephole* opt, size_t index) {
+    const Program* program = opt->program;
+    uint8_t op = program->op[index];
+    uint16_t regs = program->regs[index];
+    int rd = IR_REG(regs, 0), a = IR_REG(regs, 1), b = IR_REG(regs, 2);
+    int source = -1;
+    if (op == INST_ADD) source = b == 0 ? a : a == 0 ? b : -1;
+    if (op == INST_SUB && b == 0) source = a;
+    return source >= 0 && same_value(opt, rd, source) &&
+           delete(opt, PEEPHOLE_REDUNDANT_MOVE, index);
+}
+
+static bool branch_chain(Peephole* opt, size_t index) {
+    Program* program = opt->program;
+    if (program->kind[index] != OP_LABEL ||
+        (!is_branch(program->op[index]) && program->op[index] != INST_J)) {
+        return false;
+    }
+
+    // Follow jumps to jumps; a chain that loops back is left alone
+    int32_t target = program->imm[index];
+    unsigned hops = 0;
+    for (;;) {
+        if (opt->definition[target] < 0) break;
+        size_t next = next_instruction(opt, (size_t)opt->definition[target]);
+        if (!is_jump(program, next)) break;
+        if (next == index || program->imm[next] == program->imm[index] || ++hops > MAX_HOPS) {
+            return false;
+        }
+        target = program->imm[next];
+    }
+    if (hops == 0) return false;
+    program->imm[index] = target;
+    record(opt, PEEPHOLE_BRANCH_CHAIN, index, 0, hops);
+    return false;
+}
+
+static bool branch_next(Peephole* opt, size_t index) {
+    const Program* program = opt->program;
+    uint8_t op = program->op[index];
+    if ((!is_branch(op) && op != INST_J) || program->kind[index] != OP_LABEL) return false;
+    int32_t definition = opt->definition[program->imm[index]];
+    if (definition <= (int32_t)index) return false;
+    for (size_t i = index + 1; i < (size_t)definition; i++) {
+        if (!opt->removed[i] && program->op[i] != INST_LABEL) return false;
+    }
+    return delete(opt, PEEPHOLE_BRANCH_NEXT, index);
+}
+
+static bool run_pass(Peephole* opt) {
+    const Program* program = opt->program;
+    bool changed = false;
+    forget_all(opt);
+    for (size_t i = 0; i < program->count; i++) {
+        if (opt->removed[i]) continue;
+        if (program->op[i] == INST_LABEL) {
+            forget_all(opt);
+            continue;
+        }
+
+        bool deleted = false;
+        for (int r = 0; r < PEEPHOLE_RULE_COUNT && !deleted; r++) {
+            if (rules[r].deletes && !opt->may_delete) continue;
+            int32_t before = program->imm[i];
+            deleted = rules[r].apply(opt, i);
+            changed = changed || deleted || program->imm[i] != before;
+        }
+        if (!deleted) execute(opt, i);
+    }
+    return changed;
+}
+
+// Optimizes program in place. Returns false only if out of memory.
+bool peephole_optimize(Assembler* as, Program* program) {
+    Peephole opt = { 0 };
+    opt.as = as;
+    opt.program = program;
+    size_t symbol_count = as->symbols.count ? (size_t)as->symbols.count : 1;
+    opt.removed = mem_calloc(program->count ? program->count : 1, 1);
+    opt.definition = mem_alloc(symbol_count * sizeof(int32_t));
+    if (!opt.removed || !opt.definition) {
+        assembler_report(as, "Error: Out of memory\n");
+        mem_free(opt.removed);
+        mem_free(opt.definition);
+        return false;
+    }
+
+    // The first definition of a label is the one code generation uses
+    for (size_t i = 0; i < symbol_count; i++) opt.definition[i] = -1;
+    for (size_t i = 0; i < program->count; i++) {
+        uint8_t op = program->op[i];
+        if (op == INST_LABEL && opt.definition[program->imm[i]] < 0) {
+            opt.definition[program->imm[i]] = (int32_t)i;
+        }
+    }
+    opt.may_delete = !program_numeric_addresses(program);
+    if (!opt.may_delete) {
+        TRACE(TRACE_CODEGEN, TRACE_INFO, "peephole: numeric addresses, not deleting\n");
+    }
+
+    int passes = 0;
+    bool changed = true;
+    while (changed && passes < MAX_PASSES) {
+        changed = run_pass(&opt);
+        passes++;
+    }
+
+    size_t before = program->count;
+    program_remove(program, opt.removed);
+    TRACE(TRACE_CODEGEN, TRACE_INFO, "peephole: %d passes, %zu of %zu entries removed\n",
+          passes, before - program->count, before);
+    mem_free(opt.removed);
+    mem_free(opt.definition);
+    return true;
+}
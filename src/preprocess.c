@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "asm.h"
+
+// Preprocessor: expands .include, .macro, .rept and .irp into one flat token
+// list for the parser. It works on tokens only; nothing is ever re-lexed.
+// Each included file is mapped and lexed once and its tokens are replayed
+// on every further inclusion. A macro body is copied out as a token range
+// when it is defined, and expanding it walks that range, substituting
+// \param tokens with the argument tokens of the invocation.
+//
+// Statements are told apart by line: the arguments of a macro invocation,
+// the parameters of .macro and the values of .irp are the tokens on the
+// rest of that line. Tokens keep the file and line they were lexed at, so
+// diagnostics inside a macro point at its definition.
+//
+// Sources without preprocessor tokens skip all of this: their token list
+// goes to the parser unchanged.
+
+#define MAX_NESTING 64     // Includes and expansions, guards against recursion
+#define MAX_PATH 4096
+
+typedef struct {
+    Token* tokens;         // Parameter names, then the body; NULL if undefined
+    size_t param_count;
+    size_t body_length;
+} Macro;
+
+// Parameters bound during an expansion: names[i] stands for the argument
+// tokens values[starts[i], starts[i + 1]). Macro bodies get a fresh scope;
+// .irp bodies see the enclosing one too.
+typedef struct Scope {
+    const struct Scope* parent;
+    const Token* names;
+    size_t count;
+    const Token* values;
+    const size_t* starts;
+} Scope;
+
+typedef struct {
+    Token* tokens;
+    size_t count;
+    size_t capacity;
+} TokenBuffer;
+
+typedef struct {
+    Assembler* as;
+    TokenList* out;
+    Macro* macros;         // Indexed by the symbol ID of the macro name
+    size_t macro_capacity;
+    int depth;
+    bool failed;
+} Preprocessor;
+
+static void process(Preprocessor* pp, const Token* begin, const Token* end, const Scope* scope);
+
+static void pp_error(Preprocessor* pp, const Token* token, const char* message) {
+    assembler_report(pp->as, "Error at line %d%s: %s\n", token->line,
+                     assembler_file_note(pp->as, token->file), message);
+    pp->failed = true;
+}
+
+static const char* token_text(const Preprocessor* pp, const Token* token) {
+    return pp->as->files[token->file].source.data + token->offset;
+}
+
+static bool same_text(const Preprocessor* pp, const Token* a, const Token* b) {
+    return a->length == b->length && memcmp(token_text(pp, a), token_text(pp, b), a->length) == 0;
+}
+
+static bool buffer_push(TokenBuffer* buffer, const Token* tokens, size_t count) {
+    if (buffer->count + count > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 64;
+        while (capacity < buffer->count + count) capacity *= 2;
+        Token* grown = mem_realloc(buffer->tokens, capacity * sizeof(Token));
+        if (!grown) return false;
+        buffer->tokens = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->tokens + buffer->count, tokens, count * sizeof(Token));
+    buffer->count += count;
+    return true;
+}
+
+// Appends tokens to the output, keeping a free slot for the EOF token
+static void emit(Preprocessor* pp, const Token* tokens, size_t count) {
+    TokenList* out = pp->out;
+    if (out->count + count + 1 > out->capacity) {
+        size_t capacity = out->capacity * 2;
+        while (capacity < out->count + count + 1) capacity *= 2;
+        Token* grown = mem_realloc(out->tokens, capacity * sizeof(Token));
+        if (!grown) {
+            pp_error(pp, tokens, "Out of memory");
+            return;
+        }
+        out->tokens = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->tokens + out->count, tokens, count * sizeof(Token));
+    out->count += count;
+}
+
+// Returns the first token after the line of p
+static const Token* line_end(const Token* p, const Token* end) {
+    const Token* q = p;
+    while (q < end && q->line == p->line && q->file == p->file) q++;
+    return q;
+}
+
+// Finds the directive closing the block opened at open, skipping nested
+// blocks; reports and returns NULL if there is none
+static const Token* block_end(Preprocessor* pp, const Token* open, const Token* end) {
+    bool macro = open->type == TOKEN_MACRO_DIRECTIVE;
+    int nesting = 0;
+    for (const Token* p = open + 1; p < end; p++) {
+        if (macro ? p->type == TOKEN_MACRO_DIRECTIVE
+                  : p->type == TOKEN_REPT_DIRECTIVE || p->type == TOKEN_IRP_DIRECTIVE) {
+            nesting++;
+        } else if (p->type == (macro ? TOKEN_ENDM_DIRECTIVE : TOKEN_ENDR_DIRECTIVE)) {
+            if (nesting-- == 0) return p;
+        }
+    }
+    pp_error(pp, open, macro ? "Missing .endm" : "Missing .endr");
+    return NULL;
+}
+
+// Finds the tokens a parameter reference stands for
+static bool lookup_param(Preprocessor* pp, const Scope* scope, const Token* param,
+                         const Token** values, size_t* count) {
+    for (; scope; scope = scope->parent) {
+        for (size_t i = 0; i < scope->count; i++) {
+            if (same_text(pp, &scope->names[i], param)) {
+                *values = scope->values + scope->starts[i];
+                *count = scope->starts[i + 1] - scope->starts[i];
+                return true;
+            }
+        }
+    }
+
+    char message[128];
+    snprintf(message, sizeof(message), "Unknown macro parameter '\\%.*s'",
+             (int)(param->length > 64 ? 64 : param->length), token_text(pp, param));
+    pp_error(pp, param, message);
+    return false;
+}
+
+// Collects comma-separated lists from the tokens [p, end), with parameter
+// references substituted. Commas inside parentheses do not separate, so
+// %hi(label) is one item. starts receives count + 1 offsets into values.
+// Errors are reported at the directive or invocation at.
+static bool collect_list(Preprocessor* pp, const Token* at, const Token* p, const Token* end,
+                         const Scope* scope, TokenBuffer* values, size_t** starts, size_t* count) {
+    size_t capacity = 8;
+    *starts = mem_alloc(capacity * sizeof(size_t));
+    *count = 0;
+    if (!*starts) goto oom;
+    (*starts)[0] = 0;
+    if (p == end) return true;
+
+    int depth = 0;
+    for (;; p++) {
+        if (p == end || (p->type == TOKEN_COMMA && depth == 0)) {
+            if (*count + 2 > capacity) {
+                capacity *= 2;
+                size_t* grown = mem_realloc(*starts, capacity * sizeof(size_t));
+                if (!grown) goto oom;
+                *starts = grown;
+            }
+            (*starts)[++*count] = values->count;
+            if (p == end) return true;
+            continue;
+        }
+
+        if (p->type == TOKEN_LPAREN) depth++;
+        if (p->type == TOKEN_RPAREN) depth--;
+        const Token* tokens = p;
+        size_t n = 1;
+        if (p->type == TOKEN_MACRO_PARAM && !lookup_param(pp, scope, p, &tokens, &n)) return false;
+        if (!buffer_push(values, tokens, n)) goto oom;
+    }
+
+oom:
+    pp_error(pp, at, "Out of memory");
+    return false;
+}
+
+// .macro name [param[, param]...] ... .endm
+static const Token* define_macro(Preprocessor* pp, const Token* p, const Token* end) {
+    const Token* header_end = line_end(p, end);
+    const Token* name = p + 1;
+    if (name == header_end || name->type != TOKEN_LABEL_REFERENCE) {
+        pp_error(pp, p, "Expected macro name after .macro");
+        return end;
+    }
+
+    // Parameters, with optional commas between them
+    size_t param_count = 0;
+    for (const Token* q = name + 1; q < header_end; q++) {
+        if (q->type == TOKEN_COMMA) continue;
+        if (q->type != TOKEN_LABEL_REFERENCE) {
+            pp_error(pp, q, "Expected parameter name in .macro");
+            return end;
+        }
+        param_count++;
+    }
+
+    const Token* close = block_end(pp, p, end);
+    if (!close) return end;
+
+    int id = name->value.symbol_id;
+    if ((size_t)id >= pp->macro_capacity) {
+        size_t capacity = pp->macro_capacity ? pp->macro_capacity : 64;
+        while (capacity <= (size_t)id) capacity *= 2;
+        Macro* grown = mem_realloc(pp->macros, capacity * sizeof(Macro));
+        if (!grown) {
+            pp_error(pp, p, "Out of memory");
+            return end;
+        }
+        memset(grown + pp->macro_capacity, 0, (capacity - pp->macro_capacity) * sizeof(Macro));
+        pp->macros = grown;
+        pp->macro_capacity = capacity;
+    }
+
+    Macro* macro = &pp->macros[id];
+    if (macro->tokens) {
+        pp_error(pp, name, "Macro redefined");
+        return end;
+    }
+    size_t body_length = (size_t)(close - header_end);
+    macro->tokens = mem_alloc((param_count + body_length + 1) * sizeof(Token));
+    if (!macro->tokens) {
+        pp_error(pp, p, "Out of memory");
+        return end;
+    }
+    Token* q = macro->tokens;
+    for (const Token* t = name + 1; t < header_end; t++) {
+        if (t->type != TOKEN_COMMA) *q++ = *t;
+    }
+    memcpy(q, header_end, body_length * sizeof(Token));
+    macro->param_count = param_count;
+    macro->body_length = body_length;
+
+    TRACE(TRACE_LEXER, TRACE_VERBOSE, "preprocess: macro %.*s, %zu parameters, %zu tokens\n",
+          (int)name->length, token_text(pp, name), param_count, body_length);
+    return close + 1;
+}
+
+static const Macro* find_macro(const Preprocessor* pp, const Token* token) {
+    size_t id = (size_t)token->value.symbol_id;
+    return id < pp->macro_capacity && pp->macros[id].tokens ? &pp->macros[id] : NULL;
+}
+
+static bool enter(Preprocessor* pp, const Token* at) {
+    if (pp->depth >= MAX_NESTING) {
+        pp_error(pp, at, "Includes or macro expansions nested too deeply");
+        return false;
+    }
+    pp->depth++;
+    return true;
+}
+
+static const Token* expand_macro(Preprocessor* pp, const Macro* macro, const Token* p,
+                                 const Token* end, const Scope* scope) {
+    const Token* args_end = line_end(p, end);
+    TokenBuffer values = { 0 };
+    size_t* starts = NULL;
+    size_t count = 0;
+    if (collect_list(pp, p, p + 1, args_end, scope, &values, &starts, &count)) {
+        if (count != macro->param_count) {
+            char message[160];
+            snprintf(message, sizeof(message), "Macro '%.*s' expects %zu arguments, got %zu",
+                     (int)(p->length > 64 ? 64 : p->length), token_text(pp, p),
+                     macro->param_count, count);
+            pp_error(pp, p, message);
+        } else if (enter(pp, p)) {
+            Scope inner = { NULL, macro->tokens, count, values.tokens, starts };
+            pp->as->stats.macro_expansions++;
+            const Token* body = macro->tokens + macro->param_count;
+            process(pp, body, body + macro->body_length, &inner);
+            pp->depth--;
+        }
+    }
+    mem_free(values.tokens);
+    mem_free(starts);
+    return args_end;
+}
+
+// .rept count ... .endr and .irp param, value... ... .endr
+static const Token* expand_repeat(Preprocessor* pp, const Token* p, const Token* end,
+                                  const Scope* scope) {
+    const Token* header_end = line_end(p, end);
+    const Token* close = block_end(pp, p, end);
+    if (!close) return end;
+    const Token* body = header_end;
+
+    if (p->type == TOKEN_REPT_DIRECTIVE) {
+        const Token* count = p + 1;
+        size_t n = (size_t)(header_end - count);
+        if (n == 1 && count->type == TOKEN_MACRO_PARAM &&
+            !lookup_param(pp, scope, count, &count, &n)) {
+            return end;
+        }
+        if (n != 1 || count->type != TOKEN_IMMEDIATE || count->value.immediate < 0) {
+            pp_error(pp, p, "Expected a non-negative count after .rept");
+            return end;
+        }
+        if (!enter(pp, p)) return end;
+        for (int i = 0; i < count->value.immediate && !pp->failed; i++) {
+            pp->as->stats.macro_expansions++;
+            process(pp, body, close, scope);
+        }
+        pp->depth--;
+        return close + 1;
+    }
+
+    const Token* param = p + 1;
+    if (param >= header_end || param->type != TOKEN_LABEL_REFERENCE ||
+        (param + 1 < header_end && param[1].type != TOKEN_COMMA)) {
+        pp_error(pp, p, "Expected parameter name after .irp");
+        return end;
+    }
+    TokenBuffer values = { 0 };
+    size_t* starts = NULL;
+    size_t count = 0;
+    const Token* list = param + 1 < header_end ? param + 2 : header_end;
+    if (collect_list(pp, p, list, header_end, scope, &values, &starts, &count) && enter(pp, p)) {
+        for (size_t i = 0; i < count && !pp->failed; i++) {
+            size_t item[2] = { 0, starts[i + 1] - starts[i] };
+            Scope inner = { scope, param, 1, values.tokens + starts[i], item };
+            pp->as->stats.macro_expansions++;
+            process(pp, body, close, &inner);
+        }
+        pp->depth--;
+    }
+    mem_free(values.tokens);
+    mem_free(starts);
+    return close + 1;
+}
+
+// Joins dir (up to its last '/') and name into path; false if too long
+static bool join_path(char* path, const char* dir, size_t dir_length, const char* name) {
+    int n = snprintf(path, MAX_PATH, "%.*s%s%s", (int)dir_length, dir,
+                     dir_length && dir[dir_length - 1] != '/' ? "/" : "", name);
+    return n >= 0 && n < MAX_PATH;
+}
+
+// Finds an already loaded file by name, or -1
+static int find_file(const Assembler* as, const char* path) {
+    for (size_t i = 1; i < as->file_count; i++) {
+        if (strcmp(as->files[i].name, path) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// Resolves an include name against the including file's directory, then
+// the include directories in order. Returns the index of the loaded file,
+// loading it if this is its first inclusion, or -1.
+static int load_include(Preprocessor* pp, const Token* at, const char* name) {
+    Assembler* as = pp->as;
+    char path[MAX_PATH];
+    bool found = false;
+    const char* includer = as->files[at->file].name;
+    if (name[0] == '/' || !includer || !strrchr(includer, '/')) {
+        found = join_path(path, "", 0, name) && (find_file(as, path) >= 0 || access(path, R_OK) == 0);
+    } else {
+        size_t dir_length = (size_t)(strrchr(includer, '/') - includer) + 1;
+        found = join_path(path, includer, dir_length, name) &&
+                (find_file(as, path) >= 0 || access(path, R_OK) == 0);
+    }
+    for (size_t i = 0; !found && name[0] != '/' && i < as->options.include_dir_count; i++) {
+        const char* dir = as->options.include_dirs[i];
+        found = join_path(path, dir, strlen(dir), name) &&
+                (find_file(as, path) >= 0 || access(path, R_OK) == 0);
+    }
+    if (!found) {
+        char message[MAX_PATH + 64];
+        snprintf(message, sizeof(message), "Cannot find include file '%s'", name);
+        pp_error(pp, at, message);
+        return -1;
+    }
+
+    int file = find_file(as, path);
+    if (file >= 0) return file;
+
+    file = assembler_add_file(as, path, NULL, 0);
+    if (file < 0) {
+        pp_error(pp, at, "Out of memory");
+        return -1;
+    }
+    AsmFile* entry = &as->files[file];
+    if (!source_open(as, &entry->source, path)) {
+        pp->failed = true;
+        return -1;
+    }
+    as->stats.include_files++;
+    as->stats.bytes_read += entry->source.length;
+    entry->tokens = lexer_init(as, file, entry->source.data, entry->source.length);
+    if (!entry->tokens) {
+        pp->failed = true;
+        return -1;
+    }
+    TRACE(TRACE_LEXER, TRACE_INFO, "preprocess: loaded %s, %zu tokens\n", path,
+          entry->tokens->count);
+    return file;
+}
+
+// .include "file"
+static const Token* include_file(Preprocessor* pp, const Token* p, const Token* end) {
+    const Token* name = p + 1;
+    if (name >= end || name->type != TOKEN_STRING_LITERAL || name->line != p->line) {
+        pp_error(pp, p, "Expected file name string after .include");
+        return end;
+    }
+
+    char path[MAX_PATH];
+    const char* s = token_text(pp, name);
+    const char* s_end = s + name->length;
+    size_t length = 0;
+    while (s < s_end && length + 1 < sizeof(path)) path[length++] = lexer_string_char(&s);
+    path[length] = '\0';
+
+    int file = load_include(pp, p, path);
+    if (file < 0 || !enter(pp, p)) return end;
+    const TokenList* tokens = pp->as->files[file].tokens;
+    process(pp, tokens->tokens, tokens->tokens + tokens->count, NULL);
+    pp->depth--;
+    return name + 1;
+}
+
+static void process(Preprocessor* pp, const Token* begin, const Token* end, const Scope* scope) {
+    const Token* p = begin;
+    while (p < end && !pp->failed) {
+        switch (p->type) {
+            case TOKEN_INCLUDE_DIRECTIVE:
+                p = include_file(pp, p, end);
+                break;
+            case TOKEN_MACRO_DIRECTIVE:
+                p = define_macro(pp, p, end);
+                break;
+            case TOKEN_REPT_DIRECTIVE:
+            case TOKEN_IRP_DIRECTIVE:
+                p = expand_repeat(pp, p, end, scope);
+                break;
+            case TOKEN_ENDM_DIRECTIVE:
+                pp_error(pp, p, ".endm without .macro");
+                return;
+            case TOKEN_ENDR_DIRECTIVE:
+                pp_error(pp, p, ".endr without .rept or .irp");
+                return;
+            case TOKEN_MACRO_PARAM: {
+                const Token* values;
+                size_t count;
+                if (lookup_param(pp, scope, p, &values, &count)) emit(pp, values, count);
+                p++;
+                break;
+            }
+            case TOKEN_LABEL_REFERENCE: {
+                // A macro name starting a statement invokes the macro
+                bool statement = p == begin || p[-1].line != p->line || p[-1].file != p->file ||
+                                 p[-1].type == TOKEN_LABEL;
+                const Macro* macro = statement ? find_macro(pp, p) : NULL;
+                if (macro) {
+                    p = expand_macro(pp, macro, p, end, scope);
+                } else {
+                    emit(pp, p++, 1);
+                }
+                break;
+            }
+            default:
+                emit(pp, p++, 1);
+                break;
+        }
+    }
+}
+
+// Expands the preprocessor directives of the main file's tokens. Returns
+// tokens itself if there are none, otherwise a new list to be released
+// with lexer_free(), or NULL after reporting an error.
+TokenList* preprocess(Assembler* as, TokenList* tokens) {
+    if (!tokens->preprocess) return tokens;
+
+    Preprocessor pp = { 0 };
+    pp.as = as;
+    pp.out = mem_alloc(sizeof(TokenList));
+    if (pp.out) {
+        *pp.out = *tokens;
+        pp.out->count = 0;
+        pp.out->capacity = tokens->count + 1;
+        pp.out->preprocess = false;
+        pp.out->tokens = mem_alloc(pp.out->capacity * sizeof(Token));
+    }
+    if (!pp.out || !pp.out->tokens) {
+        assembler_report(as, "Error: Out of memory\n");
+        lexer_free(pp.out);
+        return NULL;
+    }
+
+    process(&pp, tokens->tokens, tokens->tokens + tokens->count, NULL);
+    pp.out->tokens[pp.out->count] = tokens->tokens[tokens->count];  // EOF
+
+    for (size_t i = 0; i < pp.macro_capacity; i++) mem_free(pp.macros[i].tokens);
+    mem_free(pp.macros);
+    if (pp.failed) {
+        lexer_free(pp.out);
+        return NULL;
+    }
+
+    TRACE(TRACE_LEXER, TRACE_INFO, "preprocess: %zu tokens, %zu files, %llu expansions\n",
+          pp.out->count, as->file_count, (unsigned long long)as->stats.macro_expansions);
+    return pp.out;
+}
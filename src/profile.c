@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+// Execution profiles. sim_run() counts executions per address and taken
+// branches per address, and calls profile_call() for each jalr that saves
+// a return address. The report turns the counters into a flat profile and
+// a call graph per label and a listing of the source with the counts of
+// each line, using the image map the assembler wrote with --map. Without a
+// map the counters are listed per address.
+//
+// A profile is saved for beag-asm --layout as a text file:
+//
+//   beag-profile 1
+//   image <words> <hash>
+//   count <address> <executions> <taken>   for every address executed
+//   call <site> <target> <count>           for every call edge
+//
+// Addresses and the hash are hexadecimal.
+
+#define PROFILE_VERSION 1
+
+bool profile_init(Profile* profile) {
+    memset(profile, 0, sizeof(*profile));
+    profile->counts = mem_calloc(SIM_MEMORY_WORDS, sizeof(uint64_t));
+    profile->taken = mem_calloc(SIM_MEMORY_WORDS, sizeof(uint64_t));
+    profile->calls = mem_calloc(PROFILE_CALL_SLOTS, sizeof(ProfileCall));
+    if (!profile->counts || !profile->taken || !profile->calls) {
+        profile_free(profile);
+        return false;
+    }
+    return true;
+}
+
+static void add_call(Profile* profile, uint16_t site, uint16_t target, uint64_t count) {
+    uint32_t slot = (((uint32_t)site << 16 | target) * 0x9E3779B1u) >> 20;
+    for (uint32_t probes = 0; probes < PROFILE_CALL_SLOTS; probes++) {
+        ProfileCall* call = &profile->calls[slot];
+        if (call->count == 0) {
+            call->site = site;
+            call->target = target;
+        }
+        if (call->site == site && call->target == target) {
+            call->count += count;
+            return;
+        }
+        slot = (slot + 1) & (PROFILE_CALL_SLOTS - 1);
+    }
+    profile->lost_calls += count;
+}
+
+void profile_call(Profile* profile, uint16_t site, uint16_t target) {
+    add_call(profile, site, target, 1);
+}
+
+static bool is_branch(const Simulator* sim, uint32_t address) {
+    uint8_t op = sim->decoded[address].op;
+    return op == INST_BEQ || op == INST_BNE || op == INST_BLT;
+}
+
+// Row of the flat profile or the call graph. Labels are numbered from 1 in
+// map order; 0 stands for the code before the first label.
+typedef struct {
+    uint32_t label;
+    uint32_t callee;
+    uint64_t count;             // Instructions, or calls in the call graph
+    uint64_t taken;
+    uint64_t not_taken;
+    uint64_t calls;
+} ProfileRow;
+
+static int compare_rows(const void* a, const void* b) {
+    const ProfileRow* x = a;
+    const ProfileRow* y = b;
+    if (x->count != y->count) return x->count > y->count ? -1 : 1;
+    if (x->label != y->label) return x->label < y->label ? -1 : 1;
+    return x->callee < y->callee ? -1 : x->callee > y->callee;
+}
+
+static uint32_t label_number(const ImageMap* map, uint16_t address) {
+    const MapLabel* label = map_label_at(map, address);
+    return label ? (uint32_t)(label - map->labels) + 1 : 0;
+}
+
+static const char* label_name(const ImageMap* map, uint32_t number) {
+    return number ? map->labels[number - 1].name : "(start)";
+}
+
+static void report_flat(const Profile* profile, const Simulator* sim, const ImageMap* map,
+                        FILE* out) {
+    size_t count = map->label_count + 1;
+    ProfileRow* rows = mem_calloc(count, sizeof(ProfileRow));
+    if (!rows) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return;
+    }
+    for (size_t i = 0; i < count; i++) rows[i].label = (uint32_t)i;
+    for (uint32_t address = 0; address < SIM_MEMORY_WORDS; address++) {
+        uint64_t executed = profile->counts[address];
+        if (executed == 0) continue;
+        ProfileRow* row = &rows[label_number(map, (uint16_t)address)];
+        row->count += executed;
+        if (!is_branch(sim, address)) continue;
+        row->taken += profile->taken[address];
+        row->not_taken += executed - profile->taken[address];
+    }
+    for (size_t i = 0; i < PROFILE_CALL_SLOTS; i++) {
+        const ProfileCall* call = &profile->calls[i];
+        if (call->count) rows[label_number(map, call->target)].calls += call->count;
+    }
+    qsort(rows, count, sizeof(ProfileRow), compare_rows);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) total += rows[i].count;
+    fprintf(out, "Flat profile:\n");
+    fprintf(out, "  instructions       %%       taken   not taken       calls  label\n");
+    for (size_t i = 0; i < count; i++) {
+        const ProfileRow* row = &rows[i];
+        if (row->count == 0 && row->calls == 0) continue;
+        fprintf(out, "  %12llu  %5.1f%%  %10llu  %10llu  %10llu  %s\n",
+                (unsigned long long)row->count, total ? 100.0 * (double)row->count / (double)total : 0,
+                (unsigned long long)row->taken, (unsigned long long)row->not_taken,
+                (unsigned long long)row->calls, label_name(map, row->label));
+    }
+    mem_free(rows);
+}
+
+static void report_calls(const Profile* profile, const ImageMap* map, FILE* out) {
+    ProfileRow* rows = mem_alloc(PROFILE_CALL_SLOTS * sizeof(ProfileRow));
+    if (!rows) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return;
+    }
+
+    // Calls from anywhere in a label to anywhere in another count as one edge
+    size_t count = 0;
+    for (size_t i = 0; i < PROFILE_CALL_SLOTS; i++) {
+        const ProfileCall* call = &profile->calls[i];
+        if (!call->count) continue;
+        uint32_t caller = map ? label_number(map, call->site) : call->site;
+        uint32_t callee = map ? label_number(map, call->target) : call->target;
+        size_t k = 0;
+        while (k < count && (rows[k].label != caller || rows[k].callee != callee)) k++;
+        if (k == count) {
+            memset(&rows[count++], 0, sizeof(ProfileRow));
+            rows[k].label = caller;
+            rows[k].callee = callee;
+        }
+        rows[k].count += call->count;
+    }
+    qsort(rows, count, sizeof(ProfileRow), compare_rows);
+
+    fprintf(out, "Call graph:\n");
+    fprintf(out, "         calls  caller -> callee\n");
+    for (size_t i = 0; i < count; i++) {
+        if (map) {
+            fprintf(out, "  %12llu  %s -> %s\n", (unsigned long long)rows[i].count,
+                    label_name(map, rows[i].label), label_name(map, rows[i].callee));
+        } else {
+            fprintf(out, "  %12llu  0x%04X -> 0x%04X\n", (unsigned long long)rows[i].count,
+                    rows[i].label, rows[i].callee);
+        }
+    }
+    if (profile->lost_calls) {
+        fprintf(out, "  %12llu  calls not recorded: too many call sites\n",
+                (unsigned long long)profile->lost_calls);
+    }
+    mem_free(rows);
+}
+
+// Counters of one source line, summed over the words it emitted
+typedef struct {
+    uint64_t count;
+    uint64_t taken;
+    uint64_t not_taken;
+    bool code;
+    bool branch;
+} LineCounts;
+
+static void report_listing(const Profile* profile, const Simulator* sim, const ImageMap* map,
+                           uint32_t file_index, FILE* out) {
+    const char* name = map->files[file_index];
+    int last = 0;
+    for (size_t i = 0; i < map->line_count; i++) {
+        if (map->lines[i].file == file_index && map->lines[i].line > last) {
+            last = map->lines[i].line;
+        }
+    }
+    if (last == 0) return;  // Nothing emitted from this file
+
+    LineCounts* lines = mem_calloc((size_t)last + 1, sizeof(LineCounts));
+    if (!lines) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return;
+    }
+    for (size_t i = 0; i < map->line_count; i++) {
+        const MapLine* record = &map->lines[i];
+        if (record->file != file_index || record->line < 1) continue;
+        uint32_t end = i + 1 < map->line_count ? map->lines[i + 1].address : map->size;
+        LineCounts* line = &lines[record->line];
+        line->code = true;
+        for (uint32_t address = record->address; address < end; address++) {
+            uint64_t executed = profile->counts[address];
+            line->count += executed;
+            if (!is_branch(sim, address)) continue;
+            line->branch = true;
+            line->taken += profile->taken[address];
+            line->not_taken += executed - profile->taken[address];
+        }
+    }
+
+    fprintf(out, "Listing of %s:\n", name);
+    FILE* source = fopen(name, "r");
+    if (!source) {
+        fprintf(out, "  (source not available)\n");
+        mem_free(lines);
+        return;
+    }
+    fprintf(out, "         count       taken   not taken   line  source\n");
+    char* text = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    for (int number = 1; (length = getline(&text, &capacity, source)) >= 0; number++) {
+        if (length > 0 && text[length - 1] == '\n') text[--length] = '\0';
+        const LineCounts* line = number <= last ? &lines[number] : NULL;
+        if (line && line->code) {
+            fprintf(out, "  %12llu", (unsigned long long)line->count);
+        } else {
+            fprintf(out, "  %12s", "");
+        }
+        if (line && line->branch) {
+            fprintf(out, "  %10llu  %10llu", (unsigned long long)line->taken,
+                    (unsigned long long)line->not_taken);
+        } else {
+            fprintf(out, "  %10s  %10s", "", "");
+        }
+        fprintf(out, "  %5d  %s\n", number, text);
+    }
+    free(text);
+    fclose(source);
+    mem_free(lines);
+}
+
+// Writes the report of the runs counted in profile. map may be NULL.
+void profile_report(const Profile* profile, const Simulator* sim, const ImageMap* map, FILE* out) {
+    uint64_t total = 0, branches = 0, taken = 0, calls = profile->lost_calls;
+    for (uint32_t address = 0; address < SIM_MEMORY_WORDS; address++) {
+        total += profile->counts[address];
+        if (!is_branch(sim, address)) continue;
+        branches += profile->counts[address];
+        taken += profile->taken[address];
+    }
+    for (size_t i = 0; i < PROFILE_CALL_SLOTS; i++) calls += profile->calls[i].count;
+    fprintf(out, "Profile: %llu instructions, %llu of %llu branches taken, %llu calls\n",
+            (unsigned long long)total, (unsigned long long)taken, (unsigned long long)branches,
+            (unsigned long long)calls);
+
+    if (map) {
+        report_flat(profile, sim, map, out);
+    } else {
+        fprintf(out, "Flat profile:\n");
+        fprintf(out, "  instructions       taken   not taken  address\n");
+        for (uint32_t address = 0; address < SIM_MEMORY_WORDS; address++) {
+            uint64_t executed = profile->counts[address];
+            if (executed == 0) continue;
+            uint64_t branch_taken = is_branch(sim, address) ? profile->taken[address] : 0;
+            uint64_t not_taken = is_branch(sim, address) ? executed - branch_taken : 0;
+            fprintf(out, "  %12llu  %10llu  %10llu  0x%04X\n", (unsigned long long)executed,
+                    (unsigned long long)branch_taken, (unsigned long long)not_taken, address);
+        }
+    }
+    report_calls(profile, map, out);
+    for (size_t i = 0; map && i < map->file_count; i++) {
+        report_listing(profile, sim, map, (uint32_t)i, out);
+    }
+}
+
+bool profile_write(const Profile* profile, const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (!file) return false;
+    fprintf(file, "beag-profile %d\nimage %u %016llx\n", PROFILE_VERSION, profile->image_size,
+            (unsigned long long)profile->image_hash);
+    for (uint32_t address = 0; address < SIM_MEMORY_WORDS; address++) {
+        if (profile->counts[address] == 0) continue;
+        fprintf(file, "count 0x%04X %llu %llu\n", address,
+                (unsigned long long)profile->counts[address],
+                (unsigned long long)profile->taken[address]);
+    }
+    for (size_t i = 0; i < PROFILE_CALL_SLOTS; i++) {
+        const ProfileCall* call = &profile->calls[i];
+        if (call->count == 0) continue;
+        fprintf(file, "call 0x%04X 0x%04X %llu\n", call->site, call->target,
+                (unsigned long long)call->count);
+    }
+    return fclose(file) == 0;
+}
+
+// Reads a profile written by profile_write() into a new profile
+bool profile_read(Assembler* as, const char* filename, Profile* profile) {
+    if (!profile_init(profile)) {
+        assembler_report(as, "Error: Out of memory\n");
+        return false;
+    }
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        assembler_report(as, "Error: Could not open profile '%s'\n", filename);
+        profile_free(profile);
+        return false;
+    }
+
+    char* text = NULL;
+    size_t capacity = 0;
+    int line_number = 0;
+    bool ok = true;
+    while (ok && getline(&text, &capacity, file) >= 0) {
+        line_number++;
+        unsigned version, address, target;
+        unsigned long long a, b;
+        int offset = 0;
+        if (line_number == 1) {
+            ok = sscanf(text, "beag-profile %u %n", &version, &offset) == 1 && !text[offset] &&
+                 version == PROFILE_VERSION;
+        } else if (sscanf(text, "image %u %llx %n", &address, &a, &offset) == 2 && !text[offset]) {
+            ok = address <= SIM_MEMORY_WORDS;
+            profile->image_size = address;
+            profile->image_hash = a;
+        } else if (sscanf(text, "count %x %llu %llu %n", &address, &a, &b, &offset) == 3 &&
+                   !text[offset]) {
+            ok = address < SIM_MEMORY_WORDS && b <= a;
+            if (ok) {
+                profile->counts[address] = a;
+                profile->taken[address] = b;
+            }
+        } else if (sscanf(text, "call %x %x %llu %n", &address, &target, &a, &offset) == 3 &&
+                   !text[offset]) {
+            ok = address < SIM_MEMORY_WORDS && target < SIM_MEMORY_WORDS && a > 0;
+            if (ok) add_call(profile, (uint16_t)address, (uint16_t)target, a);
+        } else {
+            ok = false;
+        }
+    }
+    free(text);
+    fclose(file);
+    if (line_number == 0) ok = false;
+    if (!ok) {
+        assembler_report(as, "Error: Invalid profile '%s' at line %d\n", filename, line_number);
+        profile_free(profile);
+    }
+    return ok;
+}
+
+void profile_free(Profile* profile) {
+    mem_free(profile->counts);
+    mem_free(profile->taken);
+    mem_free(profile->calls);
+    memset(profile, 0, sizeof(*profile));
+}
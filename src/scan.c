@@ -0,0 +1,175 @@
+#include <string.h>
+#include <pthread.h>
+#include "asm.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Byte-class scanners for the lexer's hot loops. Each has a scalar version
+// and, on x86, SSE2 and AVX2 versions that classify 16 or 32 bytes per step;
+// scan_init() picks the widest one the CPU supports. Comment bodies are
+// skipped with memchr, which the C library already vectorizes.
+
+static bool is_space_byte(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+static bool is_ident_byte(unsigned char c) {
+    return (unsigned char)((c | 0x20) - 'a') < 26 || (unsigned char)(c - '0') < 10 ||
+           c == '_' || c == '.' || c == '%';
+}
+
+static const char* skip_space_scalar(const char* p, const char* end, int* line,
+                                     const char** line_start) {
+    while (p < end && is_space_byte(*p)) {
+        if (*p == '\n') {
+            (*line)++;
+            *line_start = p + 1;
+        }
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_ident_scalar(const char* p, const char* end) {
+    while (p < end && is_ident_byte(*p)) p++;
+    return p;
+}
+
+#ifdef SCAN_X86
+
+// Bit i of the result is set if byte i of the block is whitespace
+static inline unsigned space_mask_sse2(__m128i block) {
+    // '\t'..'\r' as (c - '\t') <= 4 unsigned, via min
+    __m128i t = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+    __m128i space = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(ctrl, space));
+}
+
+static inline unsigned ident_mask_sse2(__m128i block) {
+    __m128i lower = _mm_sub_epi8(_mm_or_si128(block, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(lower, _mm_set1_epi8(25)), lower);
+    __m128i d = _mm_sub_epi8(block, _mm_set1_epi8('0'));
+    __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i punct = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('_')),
+                    _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('.')),
+                                 _mm_cmpeq_epi8(block, _mm_set1_epi8('%'))));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), punct));
+}
+
+static const char* skip_space_sse2(const char* p, const char* end, int* line,
+                                   const char** line_start) {
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        unsigned stop = ~space_mask_sse2(block) & 0xFFFF;
+        unsigned newlines = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+        unsigned covered = stop ? (1u << __builtin_ctz(stop)) - 1 : 0xFFFF;
+        newlines &= covered;
+        if (newlines) {
+            *line += __builtin_popcount(newlines);
+            *line_start = p + (31 - __builtin_clz(newlines)) + 1;
+        }
+        if (stop) return p + __builtin_ctz(stop);
+        p += 16;
+    }
+    return skip_space_scalar(p, end, line, line_start);
+}
+
+static const char* skip_ident_sse2(const char* p, const char* end) {
+    while (end - p >= 16) {
+        unsigned stop = ~ident_mask_sse2(_mm_loadu_si128((const __m128i*)p)) & 0xFFFF;
+        if (stop) return p + __builtin_ctz(stop);
+        p += 16;
+    }
+    return skip_ident_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned space_mask_avx2(__m256i block) {
+    __m256i t = _mm256_sub_epi8(block, _mm256_set1_epi8('\t'));
+    __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t);
+    __m256i space = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' '));
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(ctrl, space));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned ident_mask_avx2(__m256i block) {
+    __m256i lower = _mm256_sub_epi8(_mm256_or_si256(block, _mm256_set1_epi8(0x20)),
+                                    _mm256_set1_epi8('a'));
+    __m256i alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(lower, _mm256_set1_epi8(25)), lower);
+    __m256i d = _mm256_sub_epi8(block, _mm256_set1_epi8('0'));
+    __m256i digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    __m256i punct = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('_')),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('.')),
+                                    _mm256_cmpeq_epi8(block, _mm256_set1_epi8('%'))));
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(alpha, digit), punct));
+}
+
+__attribute__((target("avx2")))
+static const char* skip_space_avx2(const char* p, const char* end, int* line,
+                                   const char** line_start) {
+    while (end - p >= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        unsigned stop = ~space_mask_avx2(block);
+        unsigned newlines = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n')));
+        if (stop) newlines &= (1u << __builtin_ctz(stop)) - 1;
+        if (newlines) {
+            *line += __builtin_popcount(newlines);
+            *line_start = p + (31 - __builtin_clz(newlines)) + 1;
+        }
+        if (stop) return p + __builtin_ctz(stop);
+        p += 32;
+    }
+    return skip_space_sse2(p, end, line, line_start);
+}
+
+__attribute__((target("avx2")))
+static const char* skip_ident_avx2(const char* p, const char* end) {
+    while (end - p >= 32) {
+        unsigned stop = ~ident_mask_avx2(_mm256_loadu_si256((const __m256i*)p));
+        if (stop) return p + __builtin_ctz(stop);
+        p += 32;
+    }
+    return skip_ident_sse2(p, end);
+}
+
+#endif // SCAN_X86
+
+static const char* (*skip_space_impl)(const char*, const char*, int*, const char**) =
+    skip_space_scalar;
+static const char* (*skip_ident_impl)(const char*, const char*) = skip_ident_scalar;
+
+static void select_scanners(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        skip_space_impl = skip_space_avx2;
+        skip_ident_impl = skip_ident_avx2;
+    } else {
+        skip_space_impl = skip_space_sse2;
+        skip_ident_impl = skip_ident_sse2;
+    }
+#endif
+}
+
+void scan_init(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, select_scanners);
+}
+
+const char* scan_whitespace(const char* p, const char* end, int* line, const char** line_start) {
+    return skip_space_impl(p, end, line, line_start);
+}
+
+const char* scan_identifier(const char* p, const char* end) {
+    return skip_ident_impl(p, end);
+}
+
+const char* scan_line_end(const char* p, const char* end) {
+    const char* newline = memchr(p, '\n', end - p);
+    return newline ? newline : end;
+}
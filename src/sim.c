@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+// Instruction-set simulator for the images the assembler writes. The image
+// is loaded at address 0 and every word of memory is decoded up front into
+// a slot holding the handler address and the operands, so the run loop is
+// threaded code: each handler ends by jumping straight to the handler of
+// the next instruction (GCC's labels as values). Decoding uses the encoding
+// tables the code generator encodes with, so the two cannot disagree.
+//
+// A program stops when it jumps to itself (the usual "done: beq r0, done"),
+// when it runs past the end of the image, or on an error. Memory past the
+// image is data only: stores there are not decoded.
+//
+// With a profile attached every slot dispatches to a counting handler that
+// goes on to the real one, so a run without a profile pays nothing for it
+// but a test at taken branches and calls.
+
+static const char* status_names[] = {
+    [SIM_RUNNING]        = "running",
+    [SIM_HALTED]         = "halted",
+    [SIM_END]            = "ran past the end of the image",
+    [SIM_STEP_LIMIT]     = "step limit reached",
+    [SIM_DIVIDE_BY_ZERO] = "division by zero",
+    [SIM_ILLEGAL]        = "illegal instruction",
+};
+
+const char* sim_status_name(SimStatus status) {
+    return status_names[status];
+}
+
+bool sim_init(Simulator* sim) {
+    memset(sim, 0, sizeof(*sim));
+    sim->memory = mem_calloc(SIM_MEMORY_WORDS, sizeof(uint16_t));
+    sim->decoded = mem_alloc(SIM_MEMORY_WORDS * sizeof(SimInsn));
+    if (!sim->memory || !sim->decoded) {
+        sim_free(sim);
+        return false;
+    }
+
+    memset(sim->opcodes, INST_WORD, sizeof(sim->opcodes));
+    for (int op = INST_ADD; op < INST_WORD; op++) {
+        if (isa_formats[op].mnemonic) sim->opcodes[isa_formats[op].opcode_bits >> 12] = (uint8_t)op;
+    }
+    return true;
+}
+
+// Decodes the word at address into its slot
+void sim_decode(Simulator* sim, uint16_t address) {
+    SimInsn* insn = &sim->decoded[address];
+    memset(insn, 0, sizeof(*insn));
+    if (address >= sim->image_size) {
+        insn->op = INST_EOP;
+        return;
+    }
+
+    uint16_t word = sim->memory[address];
+    uint8_t op = sim->opcodes[word >> 12];
+    insn->op = op;
+    if (op == INST_WORD) return;
+
+    const IsaFormat* format = &isa_formats[op];
+    uint8_t* regs[3] = { &insn->a, &insn->b, &insn->c };
+    int reg = 0;
+    for (int k = 0; k < format->operand_count; k++) {
+        const IsaField* field = &format->operands[k];
+        uint16_t value = (uint16_t)((word >> field->shift) & field->mask);
+        if (field->kind == ISA_REG) {
+            *regs[reg++] = (uint8_t)value;
+        } else {
+            insn->imm = (int16_t)(int8_t)value;  // Immediates and offsets are imm8
+        }
+    }
+
+    // Results written to r0 go to a register nothing reads
+    bool writes_first = op != INST_SW && op != INST_BEQ && op != INST_BNE && op != INST_BLT;
+    if (writes_first && insn->a == 0) insn->a = SIM_SINK;
+}
+
+// Copies size words of image to address 0 and decodes all of memory
+void sim_load(Simulator* sim, const uint16_t* image, size_t size) {
+    if (size > SIM_MEMORY_WORDS) size = SIM_MEMORY_WORDS;
+    memset(sim->memory, 0, SIM_MEMORY_WORDS * sizeof(uint16_t));
+    memcpy(sim->memory, image, size * sizeof(uint16_t));
+    memset(sim->regs, 0, sizeof(sim->regs));
+    sim->image_size = (uint32_t)size;
+    sim->pc = 0;
+    sim->steps = 0;
+    sim->status = SIM_RUNNING;
+    for (uint32_t address = 0; address < SIM_MEMORY_WORDS; address++) {
+        sim_decode(sim, (uint16_t)address);
+    }
+}
+
+// Runs from the current PC until the program stops; the reason is kept in
+// sim->status. The step limit is checked at control transfers only, so a
+// run may overshoot it by one straight-line stretch.
+SimStatus sim_run(Simulator* sim) {
+    static const void* const handlers[INST_EOP + 1] = {
+        [INST_ADD] = &&op_add,   [INST_SUB] = &&op_sub,   [INST_MUL] = &&op_mul,
+        [INST_DIV] = &&op_div,   [INST_JALR] = &&op_jalr, [INST_SW] = &&op_sw,
+        [INST_LW] = &&op_lw,     [INST_LHI] = &&op_lhi,   [INST_LLI] = &&op_lli,
+        [INST_BNE] = &&op_bne,   [INST_BEQ] = &&op_beq,   [INST_BLT] = &&op_blt,
+        [INST_WORD] = &&op_illegal, [INST_ASCII] = &&op_illegal, [INST_ASCIZ] = &&op_illegal,
+        [INST_EOP] = &&op_end,
+    };
+
+    Profile* profile = sim->profile;
+    uint64_t* counts = profile ? profile->counts : NULL;
+    uint64_t* taken_counts = profile ? profile->taken : NULL;
+#define HANDLER(op) (profile ? &&op_count : handlers[op])
+
+    SimInsn* decoded = sim->decoded;
+    for (uint32_t address = 0; address < SIM_MEMORY_WORDS; address++) {
+        decoded[address].handler = HANDLER(decoded[address].op);
+    }
+
+    uint16_t* regs = sim->regs;
+    uint16_t* memory = sim->memory;
+    uint64_t steps = sim->steps;
+    uint64_t limit = sim->step_limit ? sim->step_limit : UINT64_MAX;
+    uint16_t pc = sim->pc;
+    const SimInsn* insn;
+    SimStatus status;
+
+#define DISPATCH() do { insn = &decoded[pc]; steps++; goto *insn->handler; } while (0)
+#define NEXT() do { pc++; DISPATCH(); } while (0)
+#define BRANCH(taken) do {                                                   \
+        if (steps > limit) { status = SIM_STEP_LIMIT; goto stop; }           \
+        if (!(taken)) NEXT();                                                \
+        if (insn->imm == 0) { status = SIM_HALTED; goto stop; }              \
+        if (taken_counts) taken_counts[pc]++;                                \
+        pc = (uint16_t)(pc + insn->imm);                                     \
+        DISPATCH();                                                          \
+    } while (0)
+
+    DISPATCH();
+
+op_add:
+    regs[insn->a] = (uint16_t)(regs[insn->b] + regs[insn->c]);
+    NEXT();
+op_sub:
+    regs[insn->a] = (uint16_t)(regs[insn->b] - regs[insn->c]);
+    NEXT();
+op_mul:
+    regs[insn->a] = (uint16_t)(regs[insn->b] * regs[insn->c]);
+    NEXT();
+op_div: {
+    int32_t divisor = (int16_t)regs[insn->c];
+    if (divisor == 0) {
+        status = SIM_DIVIDE_BY_ZERO;
+        goto stop;
+    }
+    regs[insn->a] = (uint16_t)((int32_t)(int16_t)regs[insn->b] / divisor);
+    NEXT();
+}
+op_jalr: {
+    if (steps > limit) {
+        status = SIM_STEP_LIMIT;
+        goto stop;
+    }
+    uint16_t target = (uint16_t)(regs[insn->b] + regs[insn->c]);
+    if (target == pc) {
+        status = SIM_HALTED;
+        goto stop;
+    }
+    if (profile && insn->a != SIM_SINK) profile_call(profile, pc, target);
+    regs[insn->a] = (uint16_t)(pc + 1);
+    pc = target;
+    DISPATCH();
+}
+op_sw: {
+    uint16_t address = regs[insn->b];
+    memory[address] = regs[insn->a];
+    if (address < sim->image_size) {
+        sim_decode(sim, address);
+        decoded[address].handler = HANDLER(decoded[address].op);
+    }
+    NEXT();
+}
+op_lw:
+    regs[insn->a] = memory[regs[insn->b]];
+    NEXT();
+op_lhi:
+    regs[insn->a] = (uint16_t)(((uint16_t)insn->imm << 8) | (regs[insn->a] & 0xFF));
+    NEXT();
+op_lli:
+    regs[insn->a] = (uint16_t)insn->imm;
+    NEXT();
+op_bne:
+    BRANCH(regs[insn->a] != 0);
+op_beq:
+    BRANCH(regs[insn->a] == 0);
+op_blt:
+    BRANCH((int16_t)regs[insn->a] < 0);
+op_illegal:
+    status = SIM_ILLEGAL;
+    goto stop;
+op_end:
+    status = SIM_END;
+    goto stop;
+op_count:
+    counts[pc]++;
+    goto *handlers[insn->op];
+
+#undef HANDLER
+#undef BRANCH
+#undef NEXT
+#undef DISPATCH
+
+stop:
+    // The instruction that stopped the run did not execute
+    sim->steps = steps - 1;
+    if (counts) counts[pc]--;
+    sim->pc = pc;
+    sim->status = status;
+    return status;
+}
+
+void sim_free(Simulator* sim) {
+    mem_free(sim->memory);
+    mem_free(sim->decoded);
+    sim->memory = NULL;
+    sim->decoded = NULL;
+}
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "asm.h"
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options] <image.bin>\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --jit              Translate the program to x86-64 code instead of interpreting\n");
+    fprintf(stderr, "  --verify           Run both ways and check that the results are identical\n");
+    fprintf(stderr, "  --steps=N          Stop after about N instructions\n");
+    fprintf(stderr, "  --dump=ADDR[:N]    Print N words of memory from ADDR when the run ends\n");
+    fprintf(stderr, "  --stats            Print the instruction count and simulation speed\n");
+    fprintf(stderr, "  --profile[=FILE]   Count executions, branches and calls; report to stdout or FILE\n");
+    fprintf(stderr, "  --record=FILE      Also save the profile counters for beag-asm --layout\n");
+    fprintf(stderr, "  --map=FILE         Report the profile by label and source line (beag-asm --map)\n");
+}
+
+enum {
+    OPT_JIT = 256,
+    OPT_VERIFY,
+    OPT_STEPS,
+    OPT_DUMP,
+    OPT_STATS,
+    OPT_PROFILE,
+    OPT_MAP,
+    OPT_RECORD
+};
+
+// Reads an image written by beag-asm or beag-ld: raw 16-bit words
+static uint16_t* read_image(const char* filename, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open file '%s'\n", filename);
+        return NULL;
+    }
+    uint16_t* image = mem_alloc(SIM_MEMORY_WORDS * sizeof(uint16_t));
+    size_t words = image ? fread(image, sizeof(uint16_t), SIM_MEMORY_WORDS, file) : 0;
+    bool too_large = image && words == SIM_MEMORY_WORDS && fgetc(file) != EOF;
+    bool failed = !image || ferror(file);
+    fclose(file);
+    if (failed || too_large) {
+        fprintf(stderr, "Error: %s '%s'\n",
+                !image ? "Out of memory reading" : too_large ? "Image too large in" : "Could not read",
+                filename);
+        mem_free(image);
+        return NULL;
+    }
+    *size = words;
+    return image;
+}
+
+static double elapsed_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    static const struct option options[] = {
+        { "jit",    no_argument,       NULL, OPT_JIT },
+        { "verify", no_argument,       NULL, OPT_VERIFY },
+        { "steps",  required_argument, NULL, OPT_STEPS },
+        { "dump",   required_argument, NULL, OPT_DUMP },
+        { "stats",  no_argument,       NULL, OPT_STATS },
+        { "profile", optional_argument, NULL, OPT_PROFILE },
+        { "map",    required_argument, NULL, OPT_MAP },
+        { "record", required_argument, NULL, OPT_RECORD },
+        { "help",   no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    bool jit_mode = false;
+    bool verify = false;
+    uint64_t step_limit = 0;
+    bool dump = false;
+    unsigned long dump_address = 0, dump_count = 1;
+    bool show_stats = false;
+    bool profiling = false;
+    bool report = false;
+    const char* profile_name = NULL;
+    const char* map_name = NULL;
+    const char* record_name = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+            case OPT_JIT:
+                jit_mode = true;
+                break;
+            case OPT_VERIFY:
+                verify = true;
+                break;
+            case OPT_STEPS: {
+                char* end;
+                step_limit = strtoull(optarg, &end, 0);
+                if (*end || step_limit == 0) {
+                    fprintf(stderr, "Error: Invalid step count '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case OPT_DUMP: {
+                char* end;
+                dump = true;
+                dump_address = strtoul(optarg, &end, 0);
+                if (*end == ':') dump_count = strtoul(end + 1, &end, 0);
+                if (*end || dump_address >= SIM_MEMORY_WORDS || dump_count == 0 ||
+                    dump_count > SIM_MEMORY_WORDS - dump_address) {
+                    fprintf(stderr, "Error: Invalid memory range '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case OPT_STATS:
+                show_stats = true;
+                break;
+            case OPT_PROFILE:
+                profiling = report = true;
+                profile_name = optarg;
+                break;
+            case OPT_MAP:
+                map_name = optarg;
+                break;
+            case OPT_RECORD:
+                profiling = true;
+                record_name = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Only the interpreter counts
+    if (profiling && (jit_mode || verify)) {
+        fprintf(stderr, "Error: Profiling cannot be combined with --jit or --verify\n");
+        return 1;
+    }
+    if (map_name && !report) {
+        fprintf(stderr, "Error: --map is only used with --profile\n");
+        return 1;
+    }
+    ImageMap map = { 0 };
+    if (map_name && !map_read(map_name, &map)) return 1;
+
+    size_t size = 0;
+    uint16_t* image = read_image(argv[optind], &size);
+    if (!image) {
+        map_free(&map);
+        return 1;
+    }
+    if (map_name && map.size != size) {
+        fprintf(stderr, "Error: Map '%s' describes %u words, the image has %zu\n", map_name,
+                map.size, size);
+        map_free(&map);
+        mem_free(image);
+        return 1;
+    }
+    // --verify runs the translated program against a reference interpreter
+    bool use_jit = jit_mode || verify;
+    Simulator sim, reference;
+    Jit jit = { 0 };
+    Profile profile = { 0 };
+    bool ready = sim_init(&sim);
+    if (ready && verify && !sim_init(&reference)) {
+        sim_free(&sim);
+        ready = false;
+    }
+    if (ready && profiling && !profile_init(&profile)) {
+        sim_free(&sim);
+        ready = false;
+    }
+    if (!ready) {
+        fprintf(stderr, "Error: Out of memory\n");
+        map_free(&map);
+        mem_free(image);
+        return 1;
+    }
+    if (profiling) {
+        profile.image_size = (uint32_t)size;
+        profile.image_hash = cache_hash(image, size * sizeof(uint16_t), 0);
+        sim.profile = &profile;
+    }
+    if (use_jit && !jit_init(&jit)) {
+        fprintf(stderr, "Error: The x86-64 translator is not available on this host\n");
+        mem_free(image);
+        sim_free(&sim);
+        if (verify) sim_free(&reference);
+        return 1;
+    }
+    sim_load(&sim, image, size);
+    sim.step_limit = step_limit;
+    if (verify) {
+        sim_load(&reference, image, size);
+        reference.step_limit = step_limit;
+    }
+    mem_free(image);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    SimStatus status = use_jit ? jit_run(&jit, &sim) : sim_run(&sim);
+    double elapsed = elapsed_since(&start);
+
+    const char* mismatch = NULL;
+    if (verify) {
+        SimStatus expected = sim_run(&reference);
+        if (status != expected) mismatch = "status";
+        else if (sim.pc != reference.pc) mismatch = "pc";
+        else if (sim.steps != reference.steps) mismatch = "instruction count";
+        else if (memcmp(sim.regs, reference.regs, 8 * sizeof(uint16_t)) != 0) mismatch = "registers";
+        else if (memcmp(sim.memory, reference.memory, SIM_MEMORY_WORDS * sizeof(uint16_t)) != 0) {
+            mismatch = "memory";
+        }
+        if (mismatch) {
+            fprintf(stderr, "Error: Translated and interpreted runs differ in %s\n", mismatch);
+        }
+        sim_free(&reference);
+    }
+
+    // Halting and running off the end are how programs finish
+    bool ok = (status == SIM_HALTED || status == SIM_END) && !mismatch;
+    if (status != SIM_HALTED && status != SIM_END) {
+        fprintf(stderr, "Error: %s at 0x%04X\n", sim_status_name(status), sim.pc);
+    }
+    printf("%s at 0x%04X after %llu instructions\n", sim_status_name(status), sim.pc,
+           (unsigned long long)sim.steps);
+    for (int r = 0; r < 8; r++) {
+        printf("r%d = 0x%04X (%d)\n", r, sim.regs[r], (int16_t)sim.regs[r]);
+    }
+    for (unsigned long i = 0; dump && i < dump_count; i++) {
+        if (i % 8 == 0) printf("%s0x%04lX:", i ? "\n" : "", dump_address + i);
+        printf(" %04X", sim.memory[dump_address + i]);
+    }
+    if (dump) printf("\n");
+    if (show_stats) {
+        printf("Simulated:  %llu instructions in %.3f ms (%.1f M/s)\n",
+               (unsigned long long)sim.steps, elapsed * 1e3,
+               elapsed > 0 ? (double)sim.steps / elapsed * 1e-6 : 0);
+        if (use_jit) {
+            printf("Translated: %llu blocks, %llu chained jumps, %llu flushes\n",
+                   (unsigned long long)jit.translations, (unsigned long long)jit.chains,
+                   (unsigned long long)jit.flushes);
+        }
+    }
+    if (record_name && !profile_write(&profile, record_name)) {
+        fprintf(stderr, "Error: Could not write file '%s'\n", record_name);
+        ok = false;
+    }
+    if (report) {
+        FILE* out = profile_name ? fopen(profile_name, "w") : stdout;
+        if (out) {
+            profile_report(&profile, &sim, map_name ? &map : NULL, out);
+            if (out != stdout && fclose(out) != 0) out = NULL;
+        }
+        if (!out) {
+            fprintf(stderr, "Error: Could not write file '%s'\n", profile_name);
+            ok = false;
+        }
+    }
+    profile_free(&profile);
+    map_free(&map);
+    jit_free(&jit);
+    sim_free(&sim);
+    return ok ? 0 : 1;
+}
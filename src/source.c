@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "asm.h"
+
+#define READ_CHUNK_SIZE 65536  // Initial buffer size for non-mappable inputs
+
+static bool source_read_chunked(Assembler* as, SourceFile* source, int fd, const char* filename) {
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t length = 0;
+    char* buffer = mem_alloc(capacity);
+    if (!buffer) {
+        assembler_report(as, "Error: Out of memory reading '%s'\n", filename);
+        return false;
+    }
+
+    for (;;) {
+        if (length == capacity) {
+            capacity *= 2;
+            char* grown = mem_realloc(buffer, capacity);
+            if (!grown) {
+                assembler_report(as, "Error: Out of memory reading '%s'\n", filename);
+                mem_free(buffer);
+                return false;
+            }
+            buffer = grown;
+        }
+
+        ssize_t n = read(fd, buffer + length, capacity - length);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            assembler_report(as, "Error: Could not read file '%s': %s\n", filename, strerror(errno));
+            mem_free(buffer);
+            return false;
+        }
+        length += (size_t)n;
+    }
+
+    source->buffer = buffer;
+    source->data = buffer;
+    source->length = length;
+    return true;
+}
+
+bool source_open(Assembler* as, SourceFile* source, const char* filename) {
+    memset(source, 0, sizeof(*source));
+    source->data = "";
+
+    // "-" reads the program from standard input
+    bool is_stdin = strcmp(filename, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0) {
+        assembler_report(as, "Error: Could not open file '%s'\n", filename);
+        return false;
+    }
+
+    struct stat st;
+    bool ok;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            // Nothing to map; leave the empty view in place
+            ok = true;
+        } else {
+            void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+                source->mapping = mapping;
+                source->data = mapping;
+                source->length = (size_t)st.st_size;
+                ok = true;
+            } else {
+                ok = source_read_chunked(as, source, fd, filename);
+            }
+        }
+    } else {
+        // Pipes, terminals and other non-mappable inputs
+        ok = source_read_chunked(as, source, fd, filename);
+    }
+
+    if (!is_stdin) close(fd);
+    return ok;
+}
+
+void source_close(SourceFile* source) {
+    if (source->mapping) {
+        munmap(source->mapping, source->length);
+    }
+    mem_free(source->buffer);
+    memset(source, 0, sizeof(*source));
+}
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "asm.h"
+
+// Heap accounting goes to the Stats attached to the calling thread, so
+// concurrent assemblies each see their own allocations
+static _Thread_local Stats* mem_stats;
+
+static const char* phase_names[PHASE_COUNT] = {
+    [PHASE_READ]    = "read",
+    [PHASE_CACHE]   = "cache",
+    [PHASE_LEX]     = "lex",
+    [PHASE_EXPAND]  = "expand",
+    [PHASE_PARSE]   = "parse",
+    [PHASE_OPTIMIZE] = "optimize",
+    [PHASE_LAYOUT]  = "layout",
+    [PHASE_CODEGEN] = "codegen",
+    [PHASE_ANALYZE] = "analyze",
+    [PHASE_LINK]    = "link",
+    [PHASE_WRITE]   = "write",
+};
+
+static double clock_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// CPU time is per thread so phases of concurrent assemblies do not
+// absorb each other's work
+void stats_begin(Stats* stats, StatsPhase phase) {
+    stats->wall[phase] -= clock_seconds(CLOCK_MONOTONIC);
+    stats->cpu[phase] -= clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void stats_end(Stats* stats, StatsPhase phase) {
+    stats->wall[phase] += clock_seconds(CLOCK_MONOTONIC);
+    stats->cpu[phase] += clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+// Directs this thread's heap accounting to stats (or nowhere, if NULL) and
+// returns the previously attached Stats
+Stats* stats_attach(Stats* stats) {
+    Stats* previous = mem_stats;
+    mem_stats = stats;
+    return previous;
+}
+
+// Heap accounting. Every allocation carries a header recording its size so
+// frees and reallocations can keep the live byte count exact.
+typedef union {
+    size_t size;
+    max_align_t align;
+} AllocHeader;
+
+static void note_alloc(Stats* stats, size_t size) {
+    stats->heap_current += size;
+    if (stats->heap_current > stats->heap_peak) stats->heap_peak = stats->heap_current;
+}
+
+void* mem_alloc(size_t size) {
+    AllocHeader* header = malloc(sizeof(AllocHeader) + size);
+    if (!header) return NULL;
+    header->size = size;
+    if (mem_stats) {
+        mem_stats->allocations++;
+        note_alloc(mem_stats, size);
+    }
+    return header + 1;
+}
+
+void* mem_calloc(size_t count, size_t size) {
+    if (size && count > (SIZE_MAX - sizeof(AllocHeader)) / size) return NULL;
+    void* ptr = mem_alloc(count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void* mem_realloc(void* ptr, size_t size) {
+    if (!ptr) return mem_alloc(size);
+    AllocHeader* header = (AllocHeader*)ptr - 1;
+    size_t old_size = header->size;
+    header = realloc(header, sizeof(AllocHeader) + size);
+    if (!header) return NULL;
+    header->size = size;
+    if (mem_stats) {
+        mem_stats->reallocations++;
+        mem_stats->heap_current -= old_size;
+        note_alloc(mem_stats, size);
+    }
+    return header + 1;
+}
+
+void mem_free(void* ptr) {
+    if (!ptr) return;
+    AllocHeader* header = (AllocHeader*)ptr - 1;
+    if (mem_stats) {
+        mem_stats->heap_current -= header->size;
+        mem_stats->frees++;
+    }
+    free(header);
+}
+
+// Adds one assembly's statistics into a batch total. Times and counters
+// are summed; the heap peak is the largest of any one assembly.
+void stats_merge(Stats* total, const Stats* stats) {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        total->wall[i] += stats->wall[i];
+        total->cpu[i] += stats->cpu[i];
+    }
+    total->bytes_read += stats->bytes_read;
+    total->lines += stats->lines;
+    total->tokens += stats->tokens;
+    total->include_files += stats->include_files;
+    total->macro_expansions += stats->macro_expansions;
+    total->ir_entries += stats->ir_entries;
+    total->words += stats->words;
+    total->relaxed_branches += stats->relaxed_branches;
+    total->relaxed_words += stats->relaxed_words;
+    for (int i = 0; i < PEEPHOLE_RULE_COUNT; i++) {
+        total->peephole_hits[i] += stats->peephole_hits[i];
+        total->peephole_words[i] += stats->peephole_words[i];
+        total->peephole_cycles[i] += stats->peephole_cycles[i];
+    }
+    total->layout_blocks += stats->layout_blocks;
+    total->layout_moved += stats->layout_moved;
+    total->layout_jumps_added += stats->layout_jumps_added;
+    total->layout_jumps_removed += stats->layout_jumps_removed;
+    total->layout_inverted += stats->layout_inverted;
+    total->layout_taken_before += stats->layout_taken_before;
+    total->layout_taken_after += stats->layout_taken_after;
+    total->symbol_lookups += stats->symbol_lookups;
+    total->symbol_probes += stats->symbol_probes;
+    total->symbol_collisions += stats->symbol_collisions;
+    total->allocations += stats->allocations;
+    total->reallocations += stats->reallocations;
+    total->frees += stats->frees;
+    if (stats->heap_peak > total->heap_peak) total->heap_peak = stats->heap_peak;
+    total->cache_hits += stats->cache_hits;
+    total->cache_misses += stats->cache_misses;
+    total->cache_saved += stats->cache_saved;
+}
+
+static double rate(uint64_t count, double seconds) {
+    return seconds > 0 ? (double)count / seconds : 0;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+static void report_text(const Stats* stats, FILE* out) {
+    double wall = 0, cpu = 0;
+    fprintf(out, "Phase        wall ms     cpu ms\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(out, "%-8s  %10.3f %10.3f\n", phase_names[i], stats->wall[i] * 1e3, stats->cpu[i] * 1e3);
+        wall += stats->wall[i];
+        cpu += stats->cpu[i];
+    }
+    fprintf(out, "%-8s  %10.3f %10.3f\n", "total", wall * 1e3, cpu * 1e3);
+
+    fprintf(out, "\nInput:      %llu bytes, %llu lines\n",
+            (unsigned long long)stats->bytes_read, (unsigned long long)stats->lines);
+    fprintf(out, "Tokens:     %llu (%.0f/s)\n",
+            (unsigned long long)stats->tokens, rate(stats->tokens, stats->wall[PHASE_LEX]));
+    if (stats->include_files > 0 || stats->macro_expansions > 0) {
+        fprintf(out, "Expanded:   %llu included files, %llu macro and repeat bodies\n",
+                (unsigned long long)stats->include_files,
+                (unsigned long long)stats->macro_expansions);
+    }
+    fprintf(out, "IR entries: %llu (%.0f/s)\n",
+            (unsigned long long)stats->ir_entries, rate(stats->ir_entries, stats->wall[PHASE_PARSE]));
+    fprintf(out, "Words:      %llu (%.0f/s)\n",
+            (unsigned long long)stats->words, rate(stats->words, stats->wall[PHASE_CODEGEN]));
+    if (stats->relaxed_branches > 0) {
+        fprintf(out, "Relaxed:    %llu branches, %llu extra words\n",
+                (unsigned long long)stats->relaxed_branches,
+                (unsigned long long)stats->relaxed_words);
+    }
+    uint64_t hits = 0, words = 0, cycles = 0;
+    for (int i = 0; i < PEEPHOLE_RULE_COUNT; i++) {
+        hits += stats->peephole_hits[i];
+        words += stats->peephole_words[i];
+        cycles += stats->peephole_cycles[i];
+    }
+    if (hits > 0) {
+        fprintf(out, "Peephole:   %llu words, ~%llu cycles saved\n",
+                (unsigned long long)words, (unsigned long long)cycles);
+        for (int i = 0; i < PEEPHOLE_RULE_COUNT; i++) {
+            if (stats->peephole_hits[i] == 0) continue;
+            fprintf(out, "  %-16s %llu hits, %llu words, ~%llu cycles\n",
+                    peephole_rule_name((PeepholeRule)i),
+                    (unsigned long long)stats->peephole_hits[i],
+                    (unsigned long long)stats->peephole_words[i],
+                    (unsigned long long)stats->peephole_cycles[i]);
+        }
+    }
+    if (stats->layout_blocks > 0) {
+        fprintf(out, "Layout:     %llu of %llu blocks moved, %llu jumps added, %llu removed, "
+                "%llu branches inverted\n",
+                (unsigned long long)stats->layout_moved, (unsigned long long)stats->layout_blocks,
+                (unsigned long long)stats->layout_jumps_added,
+                (unsigned long long)stats->layout_jumps_removed,
+                (unsigned long long)stats->layout_inverted);
+        fprintf(out, "  taken block exits %llu -> %llu in the profile\n",
+                (unsigned long long)stats->layout_taken_before,
+                (unsigned long long)stats->layout_taken_after);
+    }
+    fprintf(out, "Symbols:    %llu lookups, %llu probes, %llu collisions\n",
+            (unsigned long long)stats->symbol_lookups, (unsigned long long)stats->symbol_probes,
+            (unsigned long long)stats->symbol_collisions);
+    fprintf(out, "Heap:       %zu bytes peak, %llu allocs, %llu reallocs, %llu frees\n",
+            stats->heap_peak, (unsigned long long)stats->allocations,
+            (unsigned long long)stats->reallocations, (unsigned long long)stats->frees);
+    fprintf(out, "Peak RSS:   %ld KiB\n", peak_rss_kb());
+    uint64_t lookups = stats->cache_hits + stats->cache_misses;
+    if (lookups > 0) {
+        fprintf(out, "Cache:      %llu hits, %llu misses (%.1f%% hit rate), %.3f ms saved\n",
+                (unsigned long long)stats->cache_hits, (unsigned long long)stats->cache_misses,
+                100.0 * (double)stats->cache_hits / (double)lookups, stats->cache_saved * 1e3);
+    }
+}
+
+static void report_json(const Stats* stats, FILE* out) {
+    fprintf(out, "{\n  \"phases\": {\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(out, "    \"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}%s\n", phase_names[i],
+                stats->wall[i] * 1e3, stats->cpu[i] * 1e3, i + 1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"bytes_read\": %llu,\n", (unsigned long long)stats->bytes_read);
+    fprintf(out, "  \"lines\": %llu,\n", (unsigned long long)stats->lines);
+    fprintf(out, "  \"tokens\": %llu,\n", (unsigned long long)stats->tokens);
+    fprintf(out, "  \"tokens_per_sec\": %.0f,\n", rate(stats->tokens, stats->wall[PHASE_LEX]));
+    fprintf(out, "  \"include_files\": %llu,\n", (unsigned long long)stats->include_files);
+    fprintf(out, "  \"macro_expansions\": %llu,\n", (unsigned long long)stats->macro_expansions);
+    fprintf(out, "  \"ir_entries\": %llu,\n", (unsigned long long)stats->ir_entries);
+    fprintf(out, "  \"ir_entries_per_sec\": %.0f,\n", rate(stats->ir_entries, stats->wall[PHASE_PARSE]));
+    fprintf(out, "  \"words\": %llu,\n", (unsigned long long)stats->words);
+    fprintf(out, "  \"words_per_sec\": %.0f,\n", rate(stats->words, stats->wall[PHASE_CODEGEN]));
+    fprintf(out, "  \"relaxed_branches\": %llu,\n", (unsigned long long)stats->relaxed_branches);
+    fprintf(out, "  \"relaxed_words\": %llu,\n", (unsigned long long)stats->relaxed_words);
+    fprintf(out, "  \"peephole\": {\n");
+    for (int i = 0; i < PEEPHOLE_RULE_COUNT; i++) {
+        fprintf(out, "    \"%s\": {\"hits\": %llu, \"words\": %llu, \"cycles\": %llu}%s\n",
+                peephole_rule_name((PeepholeRule)i), (unsigned long long)stats->peephole_hits[i],
+                (unsigned long long)stats->peephole_words[i],
+                (unsigned long long)stats->peephole_cycles[i], i + 1 < PEEPHOLE_RULE_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"layout\": {\"blocks\": %llu, \"moved\": %llu, \"jumps_added\": %llu, "
+            "\"jumps_removed\": %llu, \"inverted\": %llu, \"taken_before\": %llu, "
+            "\"taken_after\": %llu},\n",
+            (unsigned long long)stats->layout_blocks, (unsigned long long)stats->layout_moved,
+            (unsigned long long)stats->layout_jumps_added,
+            (unsigned long long)stats->layout_jumps_removed,
+            (unsigned long long)stats->layout_inverted,
+            (unsigned long long)stats->layout_taken_before,
+            (unsigned long long)stats->layout_taken_after);
+    fprintf(out, "  \"symbol_lookups\": %llu,\n", (unsigned long long)stats->symbol_lookups);
+    fprintf(out, "  \"symbol_probes\": %llu,\n", (unsigned long long)stats->symbol_probes);
+    fprintf(out, "  \"symbol_collisions\": %llu,\n", (unsigned long long)stats->symbol_collisions);
+    fprintf(out, "  \"heap_peak_bytes\": %zu,\n", stats->heap_peak);
+    fprintf(out, "  \"allocations\": %llu,\n", (unsigned long long)stats->allocations);
+    fprintf(out, "  \"reallocations\": %llu,\n", (unsigned long long)stats->reallocations);
+    fprintf(out, "  \"frees\": %llu,\n", (unsigned long long)stats->frees);
+    fprintf(out, "  \"cache_hits\": %llu,\n", (unsigned long long)stats->cache_hits);
+    fprintf(out, "  \"cache_misses\": %llu,\n", (unsigned long long)stats->cache_misses);
+    fprintf(out, "  \"cache_saved_ms\": %.3f,\n", stats->cache_saved * 1e3);
+    fprintf(out, "  \"peak_rss_kb\": %ld\n", peak_rss_kb());
+    fprintf(out, "}\n");
+}
+
+void stats_report(const Stats* stats, FILE* out, bool json) {
+    if (json) {
+        report_json(stats, out);
+    } else {
+        report_text(stats, out);
+    }
+}
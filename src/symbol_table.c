@@ -3,82 +3,167 @@
 #include <string.h>
 #include "asm.h"
 
-#define MAX_SYMBOLS 1024
+#define INITIAL_SLOTS 256  // Must be a power of two
+#define NAME_POOL_CHUNK 65536
 
-typedef struct {
-    SymbolEntry entries[MAX_SYMBOLS];
-    int count;
-} SymbolTable;
+static uint32_t hash_name(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-static SymbolTable symbol_table;
+// Copies a name into the pool and returns the NUL-terminated copy
+static char* pool_name(SymbolTable* table, const char* name, size_t length) {
+    NameChunk* chunk = table->names;
+    if (!chunk || chunk->size - chunk->used < length + 1) {
+        size_t size = length + 1 > NAME_POOL_CHUNK ? length + 1 : NAME_POOL_CHUNK;
+        chunk = mem_alloc(sizeof(NameChunk) + size);
+        if (!chunk) return NULL;
+        chunk->used = 0;
+        chunk->size = size;
+        chunk->next = table->names;
+        table->names = chunk;
+    }
 
-void symbol_table_init(void) {
-    symbol_table.count = 0;
+    char* copy = chunk->data + chunk->used;
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    chunk->used += length + 1;
+    return copy;
 }
 
-void symbol_table_add(const char* name, uint16_t value) {
-    // Check if symbol already exists
-    for (int i = 0; i < symbol_table.count; i++) {
-        if (strcmp(symbol_table.entries[i].name, name) == 0) {
-            // If symbol is already defined, this is an error
-            if (symbol_table.entries[i].is_defined) {
-                fprintf(stderr, "Error: Symbol '%s' redefined\n", name);
-                return;
-            }
-            // Update existing undefined symbol
-            symbol_table.entries[i].value = value;
-            symbol_table.entries[i].is_defined = true;
-            return;
-        }
-    }
+static bool grow_slots(SymbolTable* table) {
+    uint32_t slot_count = (table->slot_mask + 1) * 2;
+    SymbolSlot* slots = mem_calloc(slot_count, sizeof(SymbolSlot));
+    if (!slots) return false;
 
-    // Add new symbol
-    if (symbol_table.count >= MAX_SYMBOLS) {
-        fprintf(stderr, "Error: Symbol table full\n");
-        return;
+    // Reinsert using the stored hashes; names are never rehashed
+    uint32_t mask = slot_count - 1;
+    for (uint32_t i = 0; i <= table->slot_mask; i++) {
+        SymbolSlot slot = table->slots[i];
+        if (!slot.id) continue;
+        uint32_t j = slot.hash & mask;
+        while (slots[j].id) j = (j + 1) & mask;
+        slots[j] = slot;
     }
 
-    SymbolEntry* entry = &symbol_table.entries[symbol_table.count++];
-    entry->name = strdup(name);
-    entry->value = value;
-    entry->is_defined = true;
+    mem_free(table->slots);
+    table->slots = slots;
+    table->slot_mask = mask;
+    return true;
+}
+
+bool symbol_table_init(SymbolTable* table) {
+    memset(table, 0, sizeof(*table));
+    table->slots = mem_calloc(INITIAL_SLOTS, sizeof(SymbolSlot));
+    table->slot_mask = INITIAL_SLOTS - 1;
+    return table->slots != NULL;
 }
 
-uint16_t symbol_table_get(const char* name) {
-    for (int i = 0; i < symbol_table.count; i++) {
-        if (strcmp(symbol_table.entries[i].name, name) == 0) {
-            return symbol_table.entries[i].value;
+int symbol_table_intern(SymbolTable* table, const char* name, size_t length) {
+    uint32_t hash = hash_name(name, length);
+    uint32_t i = hash & table->slot_mask;
+    table->lookups++;
+
+    for (;;) {
+        SymbolSlot slot = table->slots[i];
+        if (!slot.id) break;
+        table->probes++;
+        if (slot.hash == hash) {
+            SymbolEntry* entry = &table->entries[slot.id - 1];
+            if (entry->length == length && memcmp(entry->name, name, length) == 0) {
+                return (int)slot.id - 1;
+            }
         }
+        table->collisions++;
+        i = (i + 1) & table->slot_mask;
     }
 
-    // Symbol not found, add as undefined
-    if (symbol_table.count >= MAX_SYMBOLS) {
-        fprintf(stderr, "Error: Symbol table full\n");
-        return 0xFFFF;
+    // Not found: add as an undefined symbol
+    char* copy = pool_name(table, name, length);
+    if (!copy) return -1;
+    if (table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 64;
+        SymbolEntry* entries = mem_realloc(table->entries, capacity * sizeof(SymbolEntry));
+        if (!entries) return -1;
+        table->entries = entries;
+        table->capacity = capacity;
     }
 
-    SymbolEntry* entry = &symbol_table.entries[symbol_table.count++];
-    entry->name = strdup(name);
+    int id = table->count++;
+    SymbolEntry* entry = &table->entries[id];
+    entry->name = copy;
+    entry->length = (uint32_t)length;
+    entry->hash = hash;
     entry->value = 0;
     entry->is_defined = false;
-    return 0xFFFF;
+    entry->is_global = false;
+    table->slots[i].hash = hash;
+    table->slots[i].id = (uint32_t)id + 1;
+
+    // Keep the load factor at or below one half
+    if ((uint32_t)table->count * 2 > table->slot_mask + 1 && !grow_slots(table)) return -1;
+    return id;
+}
+
+// Returns false if the symbol is already defined
+bool symbol_table_define(SymbolTable* table, int id, uint16_t value) {
+    SymbolEntry* entry = &table->entries[id];
+    if (entry->is_defined) return false;
+    entry->value = value;
+    entry->is_defined = true;
+    TRACE(TRACE_SYMBOLS, TRACE_VERBOSE, "symbols: %s = 0x%04X\n", entry->name, value);
+    return true;
+}
+
+// Marks the symbol global, i.e. visible to other objects at link time
+void symbol_table_export(SymbolTable* table, int id) {
+    table->entries[id].is_global = true;
+}
+
+uint16_t symbol_table_get_by_id(const SymbolTable* table, int id) {
+    SymbolEntry* entry = &table->entries[id];
+    return entry->is_defined ? entry->value : 0xFFFF;
 }
 
-void symbol_table_free(void) {
-    for (int i = 0; i < symbol_table.count; i++) {
-        free(symbol_table.entries[i].name);
+const SymbolEntry* symbol_table_entry(const SymbolTable* table, int id) {
+    return &table->entries[id];
+}
+
+bool symbol_table_add(SymbolTable* table, const char* name, size_t length, uint16_t value) {
+    int id = symbol_table_intern(table, name, length);
+    return id >= 0 && symbol_table_define(table, id, value);
+}
+
+uint16_t symbol_table_get(SymbolTable* table, const char* name, size_t length) {
+    int id = symbol_table_intern(table, name, length);
+    if (id < 0) return 0xFFFF;
+    return symbol_table_get_by_id(table, id);
+}
+
+void symbol_table_free(SymbolTable* table) {
+    while (table->names) {
+        NameChunk* next = table->names->next;
+        mem_free(table->names);
+        table->names = next;
     }
-    symbol_table.count = 0;
+    mem_free(table->entries);
+    mem_free(table->slots);
+    memset(table, 0, sizeof(*table));
 }
 
-void debug_print_symbol_table(void) {
-    printf("\nSymbol Table:\n");
-    printf("============\n");
-    for (int i = 0; i < symbol_table.count; i++) {
-        printf("%-20s -> %d (%s)\n", 
-               symbol_table.entries[i].name,
-               symbol_table.entries[i].value,
-               symbol_table.entries[i].is_defined ? "defined" : "undefined");
+void debug_print_symbol_table(const SymbolTable* table) {
+    trace_printf("\nSymbol Table:\n");
+    trace_printf("============\n");
+    for (int i = 0; i < table->count; i++) {
+        trace_printf("%-20s -> %d (%s%s)\n",
+               table->entries[i].name,
+               table->entries[i].value,
+               table->entries[i].is_defined ? "defined" : "undefined",
+               table->entries[i].is_global ? ", global" : "");
     }
-    printf("============\n\n");
-} 
\ No newline at end of file
+    trace_printf("============\n\n");
+}
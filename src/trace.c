@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "asm.h"
+
+#define TRACE_BUFFER_SIZE 65536
+
+// Trace output is formatted into one buffer and written to the sink in
+// large blocks, so tracing a big input costs a few write calls rather than
+// one per line. The buffer is shared by all threads and guarded by a lock,
+// which is only taken once a trace is known to be enabled.
+typedef struct {
+    FILE* sink;            // NULL means stderr
+    bool owns_sink;
+    size_t used;
+    char buffer[TRACE_BUFFER_SIZE];
+} TraceState;
+
+static TraceState trace_state;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint8_t trace_levels[TRACE_CATEGORY_COUNT];
+
+static const char* category_names[TRACE_CATEGORY_COUNT] = {
+    [TRACE_LEXER]   = "lexer",
+    [TRACE_PARSER]  = "parser",
+    [TRACE_SYMBOLS] = "symbols",
+    [TRACE_CODEGEN] = "codegen",
+};
+
+static const char* level_names[] = {
+    [TRACE_OFF]     = "off",
+    [TRACE_INFO]    = "info",
+    [TRACE_DEBUG]   = "debug",
+    [TRACE_VERBOSE] = "verbose",
+};
+
+static bool lookup_name(const char* const* names, int count, const char* str, size_t len, int* index) {
+    for (int i = 0; i < count; i++) {
+        if (strlen(names[i]) == len && memcmp(names[i], str, len) == 0) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses a comma-separated list of category[:level] items, where category
+// may be "all" and the level defaults to debug, e.g. "lexer,codegen:verbose"
+bool trace_configure(const char* spec) {
+    const char* p = spec;
+    while (*p) {
+        const char* item = p;
+        size_t len = strcspn(item, ",");
+        p += len;
+        if (*p == ',') p++;
+        if (len == 0) continue;
+
+        const char* colon = memchr(item, ':', len);
+        size_t name_len = colon ? (size_t)(colon - item) : len;
+        int level = TRACE_DEBUG;
+        if (colon && !lookup_name(level_names, TRACE_VERBOSE + 1, colon + 1,
+                                  len - name_len - 1, &level)) {
+            fprintf(stderr, "Error: Unknown trace level '%.*s'\n",
+                    (int)(len - name_len - 1), colon + 1);
+            return false;
+        }
+
+        int category;
+        if (name_len == 3 && memcmp(item, "all", 3) == 0) {
+            memset(trace_levels, level, sizeof(trace_levels));
+        } else if (lookup_name(category_names, TRACE_CATEGORY_COUNT, item, name_len, &category)) {
+            trace_levels[category] = (uint8_t)level;
+        } else {
+            fprintf(stderr, "Error: Unknown trace category '%.*s'\n", (int)name_len, item);
+            return false;
+        }
+    }
+
+#ifdef BEAG_NO_TRACE
+    fprintf(stderr, "Warning: Tracing was compiled out (BEAG_NO_TRACE)\n");
+#endif
+    return true;
+}
+
+bool trace_open(const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open trace file '%s'\n", filename);
+        return false;
+    }
+    trace_close();
+    trace_state.sink = file;
+    trace_state.owns_sink = true;
+    return true;
+}
+
+static void flush_locked(void) {
+    if (trace_state.used == 0) return;
+    fwrite(trace_state.buffer, 1, trace_state.used, trace_state.sink ? trace_state.sink : stderr);
+    trace_state.used = 0;
+}
+
+void trace_flush(void) {
+    pthread_mutex_lock(&trace_lock);
+    flush_locked();
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_printf(const char* format, ...) {
+    pthread_mutex_lock(&trace_lock);
+    va_list args;
+    va_start(args, format);
+    size_t room = TRACE_BUFFER_SIZE - trace_state.used;
+    int n = vsnprintf(trace_state.buffer + trace_state.used, room, format, args);
+    va_end(args);
+
+    if (n >= 0 && (size_t)n >= room) {
+        // Did not fit: flush and retry, writing directly if it never will
+        flush_locked();
+        va_start(args, format);
+        if ((size_t)n >= TRACE_BUFFER_SIZE) {
+            vfprintf(trace_state.sink ? trace_state.sink : stderr, format, args);
+        } else {
+            vsnprintf(trace_state.buffer, TRACE_BUFFER_SIZE, format, args);
+            trace_state.used = (size_t)n;
+        }
+        va_end(args);
+    } else if (n >= 0) {
+        trace_state.used += (size_t)n;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_close(void) {
+    trace_flush();
+    if (trace_state.owns_sink) fclose(trace_state.sink);
+    trace_state.sink = NULL;
+    trace_state.owns_sink = false;
+}
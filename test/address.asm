@@ -0,0 +1,12 @@
+# Numeric address test program for BEAG ISA
+# A load from a numeric address pins every word where it is: -O must not
+# delete the repeated load below, or the .word 42 would move
+
+    lli r1, 5
+    lli r1, 5          # kept
+    lli r2, 6
+    lw r3, r2          # the .word 42, by number
+done:
+    beq r0, done
+    .word 0
+    .word 42
@@ -0,0 +1,14 @@
+# Forward references test program for BEAG ISA
+# %hi/%lo, branches and .word may all refer to labels defined later
+
+lli r1, %lo(data)  # r1 = address of data
+lhi r1, %hi(data)
+lw r2, r1          # r2 = [data]
+beq r2, end        # forward branch
+.word end          # forward .word reference
+
+end:
+    beq r0, end
+
+data:
+    .word 0x1234
@@ -0,0 +1,24 @@
+# Profile-guided layout test program for BEAG ISA
+# A loop whose usual path branches over a long, rarely run slow path and
+# whose back edge comes from the far side of it: two long jumps per trip
+# in source order. Laid out by a profile, the loop is one short taken
+# branch per trip and only the cold paths jump far.
+
+    li r1, 64          # r1 = counter
+    li r4, 1
+    li r7, 16
+loop:
+    div r3, r1, r7     # r3 = r1 % 16
+    mul r3, r3, r7
+    sub r3, r1, r3
+    bne r3, fast       # usually taken
+slow:
+    .rept 130
+    add r5, r5, r4     # r5 = slow path work
+    .endr
+fast:
+    add r2, r2, r1     # r2 = sum of the counters
+    sub r1, r1, r4
+    bne r1, loop
+done:
+    beq r0, done
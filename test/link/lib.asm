@@ -0,0 +1,11 @@
+# Linker test, library module: placed after main.asm in the image
+
+.global helper, table
+helper:
+    add r3, r2, r2      # r3 = 2 * r2
+
+done:                   # local; does not clash with main.asm's done
+    beq r0, done
+
+table:
+    .word 21
@@ -0,0 +1,15 @@
+# Linker test, main module: branches to and loads the address of symbols
+# defined in lib.asm, and has a local label that lib.asm also defines
+
+.global start
+start:
+    lli r1, %lo(table)  # r1 = address of table (in lib.asm)
+    lhi r1, %hi(table)
+    lw r2, r1           # r2 = [table]
+    beq r2, done        # local branch
+    bne r2, helper      # branch into lib.asm
+
+done:
+    beq r0, done
+
+.word helper            # absolute address from lib.asm
@@ -0,0 +1,19 @@
+# Numeric load layout test program for BEAG ISA
+# A loop whose hot path jumps over a cold one, then a load of the last
+# word by number: --layout must not move the loop, or the word would move
+
+    li r1, 3           # r1 = counter
+    li r4, 1
+loop:
+    bne r1, hot        # usually taken
+cold:
+    add r5, r5, r4
+hot:
+    sub r1, r1, r4
+    bne r1, loop
+out:
+    lli r2, 9
+    lw r3, r2          # the .word 42, by number
+done:
+    beq r0, done
+    .word 42
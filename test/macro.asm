@@ -0,0 +1,30 @@
+# Preprocessor test program for BEAG ISA
+# .include, macros with parameters, nested invocation, .rept and .irp
+
+.include "macro.inc"
+
+load_word r1, data     # r1 = [data]
+load_address r2, table
+
+# Clear r3..r5
+.irp reg, r3, r4, r5
+    add \reg, r0, r0
+.endr
+
+# Sum the table into r3
+lli r6, 1
+.rept 3
+    lw r4, r2
+    add r3, r3, r4
+    add r2, r2, r6
+.endr
+
+end:
+    beq r0, end
+
+data:
+    .word 0x1234
+table:
+    .rept 3
+    .word 7
+    .endr
@@ -0,0 +1,14 @@
+# Numeric jump test program for BEAG ISA
+# A jump to a numeric address pins every word where it is: -O must not
+# delete the dead write below, and --layout must not move block b
+
+    add r0, r1, r2     # writes only r0
+    lli r6, 5
+    jalr r0, r6, r0    # to b, by number
+a:
+    lli r5, 1
+done:
+    beq r0, done
+b:
+    lli r5, 7
+    beq r0, done
@@ -0,0 +1,31 @@
+# Peephole optimizer test program for BEAG ISA
+# Assembled as is and with -O; test/opt holds the optimized image
+
+start:
+    li r1, 10
+    li r1, 10          # redundant-load: r1 already holds 10
+    add r2, r1, r0
+    add r3, r2, r0
+    add r1, r3, r0     # redundant-move: r1 == r3
+    mov r2, r2         # nothing, even without -O
+    add r0, r1, r2     # zero-dest
+    nop                # zero-dest
+    li r4, 0x1234
+    lhi r4, 0x12       # redundant-load: high byte unchanged
+    beq r1, next       # branch-next
+next:
+    li r1, 10          # kept: next is a label, so r1 is unknown here
+    bne r1, hop        # branch-chain: hop jumps to done
+    la r5, buffer      # a numeric address would stop deletion
+    sw r1, r5
+    lw r1, r5
+    beq r0, start
+hop:
+    j done
+done:
+    lli r6, 5
+    blt r6, done       # kept: a relaxed branch could clobber r6
+    lli r6, 5          # kept
+    jalr r0, r7, r0
+buffer:
+    .word 0
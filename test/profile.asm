@@ -0,0 +1,26 @@
+# Profiler test program for BEAG ISA
+# Sums the squares and cubes of 1..5 through calls, so a profile has a
+# loop, taken and fall-through branches and a call graph
+
+main:
+    li r1, 5           # r1 = counter
+    li r2, 0           # r2 = sum
+    li r4, 1
+loop:
+    call square
+    add r2, r2, r3
+    call cube
+    add r2, r2, r3
+    sub r1, r1, r4
+    bne r1, loop
+done:
+    beq r0, done
+
+square:
+    mul r3, r1, r1
+    ret
+
+cube:
+    mul r3, r1, r1
+    mul r3, r3, r1
+    ret
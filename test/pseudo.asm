@@ -0,0 +1,28 @@
+# Pseudo-instruction test program for BEAG ISA
+# Each expands to the shortest sequence for its value or label address
+
+start:
+    li r1, 5           # lli
+    li r2, -100        # lli, sign-extended
+    li r3, 0x1234      # lli + lhi
+    la r4, data        # lli: data is below 0x80
+    mov r5, r3         # add r5, r3, r0
+    mov r5, r5         # nothing
+    nop                # add r0, r0, r0
+    call func          # lli r6 + jalr r7, r6, r0
+    j start            # beq r0
+    j far              # lli r6 + lhi r6 + jalr r0, r6, r0
+
+func:
+    lw r1, r4
+    ret                # jalr r0, r7, r0
+
+data:
+    .word 0x00FF
+    .rept 200
+    .word 0
+    .endr
+
+far:
+    la r1, far         # lli + lhi
+    j start            # out of branch range, but start fits lli
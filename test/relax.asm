@@ -0,0 +1,18 @@
+# Branch relaxation test program for BEAG ISA
+# Branches whose labels are out of 8-bit range become long jumps
+
+start:
+    lli r1, 0
+    beq r1, far        # bne r1, +4; lli r6; lhi r6; jalr r0, r6, r0
+    bne r1, start      # in range, stays one word
+    lli r2, -1
+    blt r2, far        # blt r2, +2; beq r0, +4; lli r6; lhi r6; jalr r0, r6, r0
+
+    .rept 200
+    .word 0
+    .endr
+
+far:
+    lli r3, 1
+    bne r3, start      # beq r3, +3; lli r6; jalr r0, r6, r0: start fits lli
+    blt r3, far        # in range
@@ -0,0 +1,10 @@
+# Self-modifying code test program for BEAG ISA
+# The simulator must decode a word stored into the program before running it
+
+    lli r1, %lo(patch)
+    li r2, 0x9163      # lli r1, 0x63
+    sw r2, r1
+patch:
+    lli r1, 0          # replaced before it runs
+done:
+    beq r0, done
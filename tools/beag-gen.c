@@ -0,0 +1,253 @@
+// Generates synthetic BEAG assembly programs for benchmarking the assembler.
+//
+// The output mixes ALU, load/store, immediate and branch instructions with
+// .word/.ascii/.asciz data, label definitions and comments in proportions
+// set on the command line. The same seed always produces the same program.
+// Every branch target lies within the signed 8-bit offset range, and the
+// image stays within the 65536-word address space: if the requested line
+// count would overflow it, extra lines become comments.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <getopt.h>
+
+#define MAX_WORDS 65536
+#define MAX_BRANCH 100   // Leaves slack for data placed between branch and target
+#define RECENT_LABELS 64
+#define MAX_PENDING 256
+
+typedef struct {
+    long lines;
+    uint64_t seed;
+    double label_density;   // Labels per instruction line
+    double branch_mean;     // Mean branch distance in words
+    double data_ratio;      // Fraction of code lines that are data directives
+    double comment_ratio;   // Fraction of lines that are comment-only
+} GenOptions;
+
+typedef struct {
+    int id;
+    long address;
+} Label;
+
+static uint64_t rng_state;
+
+// xorshift64*: fast, and identical on every platform for a given seed
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static double rng_unit(void) {
+    return (double)(rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int rng_range(int n) {
+    return (int)(rng_unit() * n);
+}
+
+static bool chance(double p) {
+    return rng_unit() < p;
+}
+
+static const char* comment_words[] = {
+    "load", "the", "next", "value", "into", "register", "loop", "counter",
+    "address", "of", "buffer", "check", "result", "store", "back", "done",
+};
+
+static void emit_comment_text(int words) {
+    for (int i = 0; i < words; i++) {
+        printf(" %s", comment_words[rng_range(sizeof(comment_words) / sizeof(comment_words[0]))]);
+    }
+}
+
+static void emit_string(int length) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJ0123456789";
+    putchar('"');
+    for (int i = 0; i < length; i++) {
+        if (chance(0.05)) {
+            fputs("\\n", stdout);
+        } else {
+            putchar(alphabet[rng_range(sizeof(alphabet) - 1)]);
+        }
+    }
+    putchar('"');
+}
+
+static int random_reg(void) {
+    return rng_range(8);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --lines=N            Source lines to generate (default 10000)\n");
+    fprintf(stderr, "  --seed=N             Random seed (default 1)\n");
+    fprintf(stderr, "  --label-density=F    Labels per instruction line (default 0.1)\n");
+    fprintf(stderr, "  --branch-distance=F  Mean branch distance in words (default 24)\n");
+    fprintf(stderr, "  --data=F             Fraction of data directives (default 0.1)\n");
+    fprintf(stderr, "  --comments=F         Fraction of comment-only lines (default 0.3)\n");
+}
+
+static bool parse_options(int argc, char** argv, GenOptions* options) {
+    static const struct option long_options[] = {
+        { "lines",           required_argument, NULL, 'n' },
+        { "seed",            required_argument, NULL, 's' },
+        { "label-density",   required_argument, NULL, 'l' },
+        { "branch-distance", required_argument, NULL, 'b' },
+        { "data",            required_argument, NULL, 'd' },
+        { "comments",        required_argument, NULL, 'c' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:s:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': options->lines = atol(optarg); break;
+            case 's': options->seed = strtoull(optarg, NULL, 0); break;
+            case 'l': options->label_density = atof(optarg); break;
+            case 'b': options->branch_mean = atof(optarg); break;
+            case 'd': options->data_ratio = atof(optarg); break;
+            case 'c': options->comment_ratio = atof(optarg); break;
+            default: return false;
+        }
+    }
+    return optind == argc && options->lines > 0 && options->branch_mean >= 1;
+}
+
+int main(int argc, char** argv) {
+    GenOptions options = { 10000, 1, 0.1, 24, 0.1, 0.3 };
+    if (!parse_options(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    rng_state = options.seed ? options.seed : 1;
+
+    // Keep the expected word count inside the address space; data lines
+    // average about 8 words, code lines one
+    double words_per_line = (1 - options.comment_ratio) *
+                            ((1 - options.data_ratio) + options.data_ratio * 8);
+    double budget = MAX_WORDS * 0.9;
+    if (words_per_line * options.lines > budget) {
+        double code_lines = budget / ((1 - options.data_ratio) + options.data_ratio * 8);
+        options.comment_ratio = 1 - code_lines / options.lines;
+        fprintf(stderr, "beag-gen: raising comment ratio to %.3f to fit %d words\n",
+                options.comment_ratio, MAX_WORDS);
+    }
+
+    Label recent[RECENT_LABELS];   // Ring of recently defined labels
+    int recent_count = 0;
+    Label pending[MAX_PENDING];    // Forward branch targets not yet placed
+    int pending_count = 0;
+    int next_label = 0;
+    int data_label = -1;
+    long address = 0;
+
+    printf("# Generated by beag-gen --lines=%ld --seed=%llu\n", options.lines,
+           (unsigned long long)options.seed);
+    for (long line = 1; line < options.lines; line++) {
+        // Place forward targets that are due, one per line
+        if (pending_count > 0 && pending[0].address <= address) {
+            printf("f%d:\n", pending[0].id);
+            memmove(pending, pending + 1, --pending_count * sizeof(Label));
+            continue;
+        }
+
+        if (chance(options.comment_ratio) || address >= MAX_WORDS - 256) {
+            if (chance(0.2)) {
+                putchar('\n');
+            } else {
+                putchar('#');
+                emit_comment_text(2 + rng_range(10));
+                putchar('\n');
+            }
+            continue;
+        }
+
+        if (chance(options.label_density)) {
+            Label* label = &recent[recent_count++ % RECENT_LABELS];
+            label->id = next_label++;
+            label->address = address;
+            printf("L%d:\n", label->id);
+            continue;
+        }
+
+        fputs(chance(0.7) ? "    " : "\t", stdout);
+        if (chance(options.data_ratio)) {
+            int kind = rng_range(3);
+            if (kind == 0) {
+                if (data_label >= 0 && chance(0.3)) {
+                    printf(".word D%d", data_label);
+                } else {
+                    printf(".word 0x%04X", (unsigned)rng_range(65536));
+                }
+                address++;
+            } else {
+                data_label = next_label++;
+                int length = 1 + rng_range(15);
+                printf("D%d: %s", data_label, kind == 1 ? ".ascii " : ".asciz ");
+                emit_string(length);
+                address += length + (kind == 2);
+            }
+        } else {
+            int roll = rng_range(100);
+            if (roll < 35) {
+                static const char* alu[] = { "add", "sub", "mul", "div" };
+                printf("%s r%d, r%d, r%d", alu[rng_range(4)], random_reg(), random_reg(), random_reg());
+            } else if (roll < 55) {
+                printf("%s r%d, %d", chance(0.5) ? "lli" : "lhi", random_reg(), rng_range(256) - 128);
+            } else if (roll < 65 && data_label >= 0) {
+                printf("%s r%d, %%%s(D%d)", chance(0.5) ? "lli" : "lhi", random_reg(),
+                       chance(0.5) ? "lo" : "hi", data_label);
+            } else if (roll < 80) {
+                printf("%s r%d, r%d", chance(0.5) ? "lw" : "sw", random_reg(), random_reg());
+            } else if (roll < 83) {
+                printf("jalr r%d, r%d, r%d", random_reg(), random_reg(), random_reg());
+            } else {
+                static const char* branch[] = { "beq", "bne", "blt" };
+                int distance = 1 + (int)(-options.branch_mean * log(1 - rng_unit()));
+                if (distance > MAX_BRANCH) distance = MAX_BRANCH;
+                const Label* target = NULL;
+                if (recent_count > 0 && chance(0.5)) {
+                    // Backward: the oldest recent label still in range
+                    int count = recent_count < RECENT_LABELS ? recent_count : RECENT_LABELS;
+                    for (int i = count; i > 0 && !target; i--) {
+                        const Label* label = &recent[(recent_count - i) % RECENT_LABELS];
+                        if (address - label->address <= distance) target = label;
+                    }
+                }
+                if (target) {
+                    printf("%s r%d, L%d", branch[rng_range(3)], random_reg(), target->id);
+                } else if (pending_count < MAX_PENDING) {
+                    // Forward: schedule a target, keeping the list sorted
+                    Label label = { next_label++, address + distance };
+                    int i = pending_count++;
+                    while (i > 0 && pending[i - 1].address > label.address) {
+                        pending[i] = pending[i - 1];
+                        i--;
+                    }
+                    pending[i] = label;
+                    printf("%s r%d, f%d", branch[rng_range(3)], random_reg(), label.id);
+                } else {
+                    printf("add r0, r0, r0");
+                }
+            }
+            address++;
+        }
+
+        if (chance(0.25)) {
+            fputs("    #", stdout);
+            emit_comment_text(1 + rng_range(6));
+        }
+        putchar('\n');
+    }
+
+    // Place any forward targets still outstanding
+    for (int i = 0; i < pending_count; i++) printf("f%d:\n", pending[i].id);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# Times each assembler phase over generated programs of several sizes.
+#
+#   tools/bench.sh <beag-asm> <beag-gen> <work-dir> <lines>...
+#
+# Each input is assembled BENCH_RUNS times (default 5) with --stats=json and
+# the fastest wall time per phase is reported, along with throughput and the
+# memory high-water marks. Inputs are generated with a fixed seed, so numbers
+# are comparable between builds.
+
+set -e
+
+asm="$1"
+gen="$2"
+dir="$3"
+shift 3
+runs="${BENCH_RUNS:-5}"
+
+mkdir -p "$dir"
+
+# Extracts a numeric field from a --stats=json report
+field() {
+    awk -v key="\"$2\"" '{
+        for (i = 1; i <= NF; i++) {
+            if ($i == key ":") { v = $(i + 1); gsub(/[,}]/, "", v); print v; exit }
+        }
+    }' "$1"
+}
+
+# Extracts a phase's wall time from a --stats=json report
+phase() {
+    awk -v key="\"$2\":" '$1 == key { v = $3; gsub(/,/, "", v); print v; exit }' "$1"
+}
+
+printf "%9s %10s %9s %9s %9s %9s %9s %8s %10s %9s\n" \
+    lines bytes read lex parse codegen total "MB/s" "heap KiB" "rss KiB"
+
+for lines in "$@"; do
+    src="$dir/gen-$lines.asm"
+    [ -f "$src" ] || "$gen" --lines="$lines" > "$src"
+
+    best=""
+    for run in $(seq "$runs"); do
+        "$asm" --stats=json "$src" "$dir/out.bin" > "$dir/run.json"
+        total=$(awk '/wall_ms/ { v = $3; gsub(/,/, "", v); t += v } END { print t }' "$dir/run.json")
+        if [ -z "$best" ] || awk -v a="$total" -v b="$best" 'BEGIN { exit !(a < b) }'; then
+            best="$total"
+            cp "$dir/run.json" "$dir/best.json"
+        fi
+    done
+
+    json="$dir/best.json"
+    bytes=$(field "$json" bytes_read)
+    printf "%9s %10s %9s %9s %9s %9s %9.3f %8.1f %10d %9s\n" \
+        "$lines" "$bytes" \
+        "$(phase "$json" read)" "$(phase "$json" lex)" \
+        "$(phase "$json" parse)" "$(phase "$json" codegen)" "$best" \
+        "$(awk -v b="$bytes" -v t="$best" 'BEGIN { print (t > 0 ? b / t / 1000 : 0) }')" \
+        "$(( $(field "$json" heap_peak_bytes) / 1024 ))" \
+        "$(field "$json" peak_rss_kb)"
+done
+echo "(times in ms, best of $runs runs)"
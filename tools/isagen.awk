@@ -0,0 +1,90 @@
+# Generates the BEAG instruction format table from instructions-encoding.txt.
+#
+# Each paragraph of the input describes one instruction:
+#
+#   add <rd>,<rs1>,<rs2>:
+#   [15:12] = 0000 (opcode)
+#   [10:8] = rd
+#   ...
+#
+# and becomes one X-macro entry
+#
+#   X(ADD, "add", 'a', 'd', 'd', 0x0, 3, ISA_REG, 8, 0x7, ...)
+#
+# giving the InstructionType suffix, the mnemonic, the characters the
+# lexer's keyword hash uses (first, second, last), the opcode, the operand
+# count and a (kind, shift, mask) triple per operand in assembly order.
+# Operands named r* are registers, imm* immediates and off* PC-relative
+# branch offsets.
+
+function bin2num(s,    i, n) {
+    n = 0
+    for (i = 1; i <= length(s); i++) n = n * 2 + (substr(s, i, 1) == "1")
+    return n
+}
+
+function flush(    i, kind, line, upper) {
+    if (name == "") return
+    upper = toupper(name)
+    line = sprintf("    X(%s, \"%s\", '%s', '%s', '%s', 0x%X, %d", upper, name,
+                   substr(name, 1, 1), substr(name, 2, 1), substr(name, length(name), 1),
+                   opcode, nops)
+    for (i = 1; i <= 3; i++) {
+        if (i > nops) {
+            line = line ", ISA_NONE, 0, 0x0"
+            continue
+        }
+        if (!(i in shift)) {
+            printf("isagen: no field for operand '%s' of '%s'\n", opnames[i], name) > "/dev/stderr"
+            failed = 1
+        }
+        kind = substr(opnames[i], 1, 1) == "r" ? "ISA_REG" : \
+               substr(opnames[i], 1, 3) == "off" ? "ISA_OFF" : "ISA_IMM"
+        line = line sprintf(", %s, %d, 0x%X", kind, shift[i], mask[i])
+    }
+    entries[++count] = line ")"
+    name = ""
+}
+
+/^[a-z]+ .*:[ \t\r]*$/ {
+    flush()
+    name = $1
+    ops = substr($0, length($1) + 2)
+    gsub(/[<> \t\r:]/, "", ops)
+    nops = split(ops, opnames, ",")
+    split("", shift)
+    split("", mask)
+    opcode = 0
+    next
+}
+
+/^\[/ && name != "" {
+    bits = $1
+    gsub(/[\[\]]/, "", bits)
+    n = split(bits, range, ":")
+    hi = range[1] + 0
+    lo = (n > 1 ? range[2] : range[1]) + 0
+    if ($4 ~ /opcode/) {
+        opcode = bin2num($3)
+    } else if ($4 !~ /unused/) {
+        for (i = 1; i <= nops; i++) {
+            if (opnames[i] == $3) {
+                shift[i] = lo
+                mask[i] = 2 ^ (hi - lo + 1) - 1
+            }
+        }
+    }
+}
+
+END {
+    flush()
+    if (failed) exit 1
+    print "// Generated from instructions-encoding.txt by tools/isagen.awk. Do not edit."
+    print "#ifndef ISA_TABLE_H"
+    print "#define ISA_TABLE_H"
+    print ""
+    print "#define ISA_INSTRUCTIONS(X) \\"
+    for (i = 1; i <= count; i++) print entries[i] (i < count ? " \\" : "")
+    print ""
+    print "#endif // ISA_TABLE_H"
+}